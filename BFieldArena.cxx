@@ -0,0 +1,86 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldArena.h"
+#include <climits>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// MPOL_PREFERRED of <numaif.h>, without depending on libnuma
+constexpr int mpolPreferred = 1;
+constexpr int maxNumaNodes = 1024;
+
+// prefer node for the pages of [addr, addr + size), before they are
+// touched. Best effort: the pages stay first-touch placed otherwise.
+void
+preferNode(void* addr, size_t size, int node)
+{
+#ifdef SYS_mbind
+  constexpr int bitsPerWord = sizeof(unsigned long) * CHAR_BIT;
+  if (node < 0 || node >= maxNumaNodes) {
+    return;
+  }
+  unsigned long mask[maxNumaNodes / bitsPerWord] = {};
+  mask[node / bitsPerWord] = 1UL << (node % bitsPerWord);
+  // the kernel counts one node less than maxnode
+  syscall(SYS_mbind, addr, size, mpolPreferred, mask, maxNumaNodes + 1, 0);
+#else
+  (void)addr;
+  (void)size;
+  (void)node;
+#endif
+}
+
+} // namespace
+
+std::shared_ptr<BFieldArena>
+BFieldArena::create(size_t size, const BFieldArenaOptions& options)
+{
+  const size_t pageSize = sysconf(_SC_PAGESIZE);
+  const size_t granule = options.hugePages ? hugePageSize : pageSize;
+  size = (size + granule - 1) / granule * granule;
+  if (size == 0) {
+    size = granule;
+  }
+  // with huge pages, map one more of them to cut an aligned block out
+  const size_t mappingSize = size + (granule > pageSize ? granule : 0);
+  void* addr = mmap(nullptr,
+                    mappingSize,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1,
+                    0);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  char* mapping = static_cast<char*>(addr);
+  char* data = reinterpret_cast<char*>(
+    (reinterpret_cast<uintptr_t>(mapping) + granule - 1) / granule * granule);
+  // give back the unaligned head and the tail
+  if (data != mapping) {
+    munmap(mapping, data - mapping);
+  }
+  if (mapping + mappingSize != data + size) {
+    munmap(data + size, mapping + mappingSize - (data + size));
+  }
+  bool hugePages = false;
+#ifdef MADV_HUGEPAGE
+  if (options.hugePages) {
+    hugePages = madvise(data, size, MADV_HUGEPAGE) == 0;
+  }
+#endif
+  if (options.numaNode >= 0) {
+    preferNode(data, size, options.numaNode);
+  }
+  return std::shared_ptr<BFieldArena>(new BFieldArena(data, size, hugePages));
+}
+
+BFieldArena::~BFieldArena()
+{
+  munmap(m_data, m_size);
+}
@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldArena.h
+//
+// One block of anonymous memory holding the mesh edges, look-up tables
+// and field of one or several zones (see BFieldMesh::packArena and
+// BFieldMap::packArena), instead of a heap allocation per array: the
+// arrays of a zone are then contiguous, each on its own cache lines,
+// and can be backed by huge pages, cutting the TLB misses of the
+// look-ups on a large map.
+//
+// The pages are placed on a NUMA node when first written, by default
+// that of the thread filling the block, or on options.numaNode if set.
+// The block is shared, not copied, by the copies of the meshes viewing
+// it, and unmapped with the last of them.
+//
+#ifndef BFIELDARENA_H
+#define BFIELDARENA_H
+
+#include <cstddef>
+#include <memory>
+
+struct BFieldArenaOptions
+{
+  // ask for transparent huge pages; the block is then 2 MB aligned
+  // and its size rounded up to 2 MB
+  bool hugePages = false;
+  // the NUMA node preferred for the pages, -1 for the node of the
+  // thread that first writes them
+  int numaNode = -1;
+};
+
+class BFieldArena
+{
+public:
+  // every array in the block starts on a cache line
+  static constexpr size_t alignment = 64;
+  static constexpr size_t hugePageSize = size_t(2) << 20;
+
+  // a zero-filled block of at least size bytes.
+  // returns nullptr if it cannot be mapped.
+  static std::shared_ptr<BFieldArena> create(
+    size_t size,
+    const BFieldArenaOptions& options = BFieldArenaOptions());
+
+  BFieldArena(const BFieldArena&) = delete;
+  BFieldArena& operator=(const BFieldArena&) = delete;
+  ~BFieldArena();
+
+  // offset rounded up to the next multiple of alignment
+  static size_t alignUp(size_t offset)
+  {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  char* data() const { return m_data; }
+  size_t size() const { return m_size; }
+  // true if huge pages were asked for and accepted by the kernel
+  bool hugePages() const { return m_hugePages; }
+
+private:
+  BFieldArena(char* data, size_t size, bool hugePages)
+    : m_data(data)
+    , m_size(size)
+    , m_hugePages(hugePages)
+  {}
+
+  char* m_data;
+  size_t m_size;
+  bool m_hugePages;
+};
+
+#endif
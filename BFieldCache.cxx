@@ -3,7 +3,9 @@
 */
 
 #include "BFieldCache.h"
+#include "BFieldStats.h"
 #include "vec.h"
+#include <algorithm>
 #include <cmath>
 
 /// existing method
@@ -14,6 +16,7 @@ BFieldCache::getB(const double* ATH_RESTRICT xyz,
                   double* ATH_RESTRICT B,
                   double* ATH_RESTRICT deriv) const
 {
+  BFIELD_STATS_SCOPE(BFieldStats::Interpolate);
 
   const double x = xyz[0];
   const double y = xyz[1];
@@ -50,8 +53,8 @@ BFieldCache::getB(const double* ATH_RESTRICT xyz,
     s = y * invr;
   } else {
     invr = 0.0;
-    c = cos(m_phimin);
-    s = sin(m_phimin);
+    c = m_cosphimin;
+    s = m_sinphimin;
   }
   B[0] = Bzrphi[1] * c - Bzrphi[2] * s;
   B[1] = Bzrphi[1] * s + Bzrphi[2] * c;
@@ -106,16 +109,19 @@ BFieldCache::getB(const double* ATH_RESTRICT xyz,
   }
 }
 
-void
-BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
-                     double r,
-                     double phi,
-                     double* ATH_RESTRICT B,
-                     double* ATH_RESTRICT deriv) const
+// Vectorized interpolation in the cached bin, the body of the getBVec
+// variants
+template<bool withDeriv, bool unitScale>
+inline void
+BFieldCache::getBVecImpl(const double* ATH_RESTRICT xyz,
+                         double r,
+                         double invr,
+                         double phi,
+                         double* ATH_RESTRICT B,
+                         double* ATH_RESTRICT deriv) const
 {
+  BFIELD_STATS_SCOPE(BFieldStats::Interpolate);
 
-  const double x = xyz[0];
-  const double y = xyz[1];
   const double z = xyz[2];
 
   // make sure phi is inside [m_phimin,m_phimax]
@@ -124,13 +130,8 @@ BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
   }
   // fractional position inside this bin
   const double fz = (z - m_zmin) * m_invz;
-  const double gz = 1.0 - fz;
   const double fr = (r - m_rmin) * m_invr;
-  const double gr = 1.0 - fr;
   const double fphi = (phi - m_phimin) * m_invphi;
-  const double gphi = 1.0 - fphi;
-
-  CxxUtils::vec<double, 4> rInterCoeff = { gr, fr, gr, fr };
 
   // Load  Bz at 8 corners of the bin
   CxxUtils::vec<double, 4> field1_z = {
@@ -154,102 +155,282 @@ BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
     m_field[2][4], m_field[2][5], m_field[2][6], m_field[2][7]
   };
 
-  CxxUtils::vec<double, 4> gPhiM_z = field1_z * gphi;
-  CxxUtils::vec<double, 4> fPhiM_z = field2_z * fphi;
-  CxxUtils::vec<double, 4> interp_z = (gPhiM_z + fPhiM_z) * rInterCoeff;
-
-  CxxUtils::vec<double, 4> gPhiM_r = field1_r * gphi;
-  CxxUtils::vec<double, 4> fPhiM_r = field2_r * fphi;
-  CxxUtils::vec<double, 4> interp_r = (gPhiM_r + fPhiM_r) * rInterCoeff;
-
-  CxxUtils::vec<double, 4> gPhiM_phi = field1_phi * gphi;
-  CxxUtils::vec<double, 4> fPhiM_phi = field2_phi * fphi;
-  CxxUtils::vec<double, 4> interp_phi = (gPhiM_phi + fPhiM_phi) * rInterCoeff;
-
-  //  We end up with
-  //  3 (z,r,phi) size 4 SIMD vectors :
-  //  The entries of each of the 3 SIMD vectors are :
-  //  0 :  gr * (gphi * field[0] + fphi * field[4]) ,
-  //  1 : fr * (gphi * field[1] + fphi * field[5]) ,
-  //  2 : gr * (gphi * field[2] + fphi * field[6]) ,
-  //  3 :3 fr * (gphi * field[3] + fphi * field[7]) ,
-
-  // We want to retain also binary compatibility
-  // Switch to 2 vector of 3 entries (z,r,phi)
-  CxxUtils::vec<double, 4> BzrphiVec1= {
-    interp_z[0]+interp_z[1], interp_r[0]+interp_r[1], interp_phi[0]+interp_phi[1], 0
-  };
-  CxxUtils::vec<double, 4> BzrphiVec2= {
-    interp_z[2]+interp_z[3], interp_r[2]+interp_r[3], interp_phi[2]+interp_phi[3], 0
-  };
-
-  // now create the final (r,z,phi) values
-  CxxUtils::vec<double, 4> Bzrphi = (BzrphiVec1*gz  +  BzrphiVec2*fz) * m_scale;
+  interpolateVec<withDeriv, unitScale>(xyz,
+                                       r,
+                                       invr,
+                                       fz,
+                                       fr,
+                                       fphi,
+                                       field1_z,
+                                       field2_z,
+                                       field1_r,
+                                       field2_r,
+                                       field1_phi,
+                                       field2_phi,
+                                       m_scale,
+                                       m_invz,
+                                       m_invr,
+                                       m_invphi,
+                                       m_cosphimin,
+                                       m_sinphimin,
+                                       B,
+                                       deriv);
+}
 
-  // convert (Bz,Br,Bphi) to (Bx,By,Bz)
-  double invr;
-  double c;
-  double s;
-  if (r > 0.0) {
-    invr = 1.0 / r;
-    c = x * invr;
-    s = y * invr;
+BFIELD_TARGET_CLONES
+void
+BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
+                     double r,
+                     double phi,
+                     double* ATH_RESTRICT B,
+                     double* ATH_RESTRICT deriv) const
+{
+  const double invr = r > 0.0 ? 1.0 / r : 0.0;
+  if (deriv) {
+    getBVecImpl<true, false>(xyz, r, invr, phi, B, deriv);
   } else {
-    invr = 0.0;
-    c = cos(m_phimin);
-    s = sin(m_phimin);
+    getBVecImpl<false, false>(xyz, r, invr, phi, B, nullptr);
   }
-  B[0] = Bzrphi[1] * c - Bzrphi[2] * s;
-  B[1] = Bzrphi[1] * s + Bzrphi[2] * c;
-  B[2] = Bzrphi[0];
+}
 
-  // compute field derivatives if requested
-  // compute field derivatives if requested
+BFIELD_TARGET_CLONES
+void
+BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
+                     double r,
+                     double invr,
+                     double phi,
+                     double* ATH_RESTRICT B,
+                     double* ATH_RESTRICT deriv) const
+{
   if (deriv) {
-    const double sz = m_scale * m_invz;
-    const double sr = m_scale * m_invr;
-    const double sphi = m_scale * m_invphi;
-    std::array<double, 3> dBdz;
-    std::array<double, 3> dBdr;
-    std::array<double, 3> dBdphi;
+    getBVecImpl<true, false>(xyz, r, invr, phi, B, deriv);
+  } else {
+    getBVecImpl<false, false>(xyz, r, invr, phi, B, nullptr);
+  }
+}
 
-    for (int j = 0; j < 3; ++j) { // Bz, Br, Bphi components
+template<bool withDeriv, bool unitScale>
+BFIELD_TARGET_CLONES void
+BFieldCache::getBVec(const double* ATH_RESTRICT xyz,
+                     double r,
+                     double phi,
+                     double* ATH_RESTRICT B,
+                     double* ATH_RESTRICT deriv) const
+{
+  const double invr = r > 0.0 ? 1.0 / r : 0.0;
+  getBVecImpl<withDeriv, unitScale>(xyz, r, invr, phi, B, deriv);
+}
+
+template void
+BFieldCache::getBVec<false, false>(const double* ATH_RESTRICT,
+                                   double,
+                                   double,
+                                   double* ATH_RESTRICT,
+                                   double* ATH_RESTRICT) const;
+template void
+BFieldCache::getBVec<true, false>(const double* ATH_RESTRICT,
+                                  double,
+                                  double,
+                                  double* ATH_RESTRICT,
+                                  double* ATH_RESTRICT) const;
+template void
+BFieldCache::getBVec<false, true>(const double* ATH_RESTRICT,
+                                  double,
+                                  double,
+                                  double* ATH_RESTRICT,
+                                  double* ATH_RESTRICT) const;
+template void
+BFieldCache::getBVec<true, true>(const double* ATH_RESTRICT,
+                                 double,
+                                 double,
+                                 double* ATH_RESTRICT,
+                                 double* ATH_RESTRICT) const;
+
+BFIELD_TARGET_CLONES
+void
+BFieldCache::insideRange(const double* ATH_RESTRICT lo,
+                         const double* ATH_RESTRICT hi,
+                         const double* ATH_RESTRICT z,
+                         const double* ATH_RESTRICT r,
+                         const double* ATH_RESTRICT phi,
+                         size_t n,
+                         uint64_t* ATH_RESTRICT mask)
+{
+  // 2-wide vectors: wider ones have no native compare in the SSE2
+  // baseline and GCC splits them into scalar compares
+  typedef CxxUtils::vec<double, 2> vec2;
+  typedef CxxUtils::mask_type_t<vec2> mask2;
+  const size_t nwords = (n + 63) / 64;
+  std::fill(mask, mask + nwords, 0);
+  // 4 points per iteration, as two vector compares
+  const size_t nvec = n - n % 4;
+  size_t i = 0;
+  for (; i < nvec; i += 4) {
+    uint64_t bits = 0;
+    for (size_t k = 0; k < 4; k += 2) {
+      vec2 vz;
+      vec2 vr;
+      vec2 vphi;
+      CxxUtils::vload(vz, z + i + k);
+      CxxUtils::vload(vr, r + i + k);
+      CxxUtils::vload(vphi, phi + i + k);
+      const vec2 vphi2pi = vphi + 2.0 * M_PI;
+      CxxUtils::vselect(vphi, vphi2pi, vphi, vphi < lo[2]);
+      const mask2 in = (vz >= lo[0]) & (vz <= hi[0]) & (vr >= lo[1]) &
+                       (vr <= hi[1]) & (vphi >= lo[2]) & (vphi <= hi[2]);
+      // lanes are 0 or -1
+      bits |= uint64_t((in[0] & 1) | (in[1] & 2)) << k;
+    }
+    mask[i / 64] |= bits << (i % 64);
+  }
+  for (; i < n; ++i) {
+    const double p = phi[i] < lo[2] ? phi[i] + 2.0 * M_PI : phi[i];
+    const bool in = z[i] >= lo[0] && z[i] <= hi[0] && r[i] >= lo[1] &&
+                    r[i] <= hi[1] && p >= lo[2] && p <= hi[2];
+    mask[i / 64] |= uint64_t(in) << (i % 64);
+  }
+}
+
+BFIELD_TARGET_CLONES
+void
+BFieldCache::getBBatch(const double* ATH_RESTRICT x,
+                       const double* ATH_RESTRICT y,
+                       const double* ATH_RESTRICT z,
+                       const double* ATH_RESTRICT r,
+                       const double* ATH_RESTRICT phi,
+                       size_t n,
+                       double* ATH_RESTRICT Bx,
+                       double* ATH_RESTRICT By,
+                       double* ATH_RESTRICT Bz,
+                       double* ATH_RESTRICT deriv) const
+{
+  BFIELD_STATS_SCOPE(BFieldStats::Batch);
+  using vec4 = CxxUtils::vec<double, 4>;
+  constexpr size_t N = CxxUtils::vec_size<vec4>();
+
+  size_t i = 0;
+  for (; i + N <= n; i += N) {
+    vec4 vx;
+    vec4 vy;
+    vec4 vz;
+    vec4 vr;
+    vec4 vphi;
+    CxxUtils::vload(vx, x + i);
+    CxxUtils::vload(vy, y + i);
+    CxxUtils::vload(vz, z + i);
+    CxxUtils::vload(vr, r + i);
+    CxxUtils::vload(vphi, phi + i);
+
+    // make sure phi is inside [m_phimin,m_phimax]
+    const vec4 vphiWrapped = vphi + 2 * M_PI;
+    CxxUtils::vselect(vphi, vphiWrapped, vphi, vphi < m_phimin);
+
+    // fractional position inside this bin, one point per lane
+    const vec4 fz = (vz - m_zmin) * m_invz;
+    const vec4 gz = 1.0 - fz;
+    const vec4 fr = (vr - m_rmin) * m_invr;
+    const vec4 gr = 1.0 - fr;
+    const vec4 fphi = (vphi - m_phimin) * m_invphi;
+    const vec4 gphi = 1.0 - fphi;
+    const double scale = m_scale;
+
+    // interpolate field values in z, r, phi
+    vec4 Bzrphi[3];
+    for (int j = 0; j < 3; ++j) { // z, r, phi components
       const double* field = m_field[j];
-      dBdz[j] =
-        sz *
-        (gr * (gphi * (field[2] - field[0]) + fphi * (field[6] - field[4])) +
-         fr * (gphi * (field[3] - field[1]) + fphi * (field[7] - field[5])));
-      dBdr[j] =
-        sr *
-        (gz * (gphi * (field[1] - field[0]) + fphi * (field[5] - field[4])) +
-         fz * (gphi * (field[3] - field[2]) + fphi * (field[7] - field[6])));
-      dBdphi[j] =
-        sphi * (gz * (gr * (field[4] - field[0]) + fr * (field[5] - field[1])) +
-                fz * (gr * (field[6] - field[2]) + fr * (field[7] - field[3])));
+      Bzrphi[j] = scale * (gz * (gr * (gphi * field[0] + fphi * field[4]) +
+                                 fr * (gphi * field[1] + fphi * field[5])) +
+                           fz * (gr * (gphi * field[2] + fphi * field[6]) +
+                                 fr * (gphi * field[3] + fphi * field[7])));
     }
 
-    // convert to cartesian coordinates
-    const double cc = c * c;
-    const double cs = c * s;
-    const double ss = s * s;
-    const double ccinvr = cc * invr;
-    const double csinvr = cs * invr;
-    const double ssinvr = ss * invr;
-    const double sinvr = s * invr;
-    const double cinvr = c * invr;
-    deriv[0] = cc * dBdr[1] - cs * dBdr[2] - csinvr * dBdphi[1] +
-               ssinvr * dBdphi[2] + sinvr * B[1];
-    deriv[1] = cs * dBdr[1] - ss * dBdr[2] + ccinvr * dBdphi[1] -
-               csinvr * dBdphi[2] - cinvr * B[1];
-    deriv[2] = c * dBdz[1] - s * dBdz[2];
-    deriv[3] = cs * dBdr[1] + cc * dBdr[2] - ssinvr * dBdphi[1] -
-               csinvr * dBdphi[2] - sinvr * B[0];
-    deriv[4] = ss * dBdr[1] + cs * dBdr[2] + csinvr * dBdphi[1] +
-               ccinvr * dBdphi[2] + cinvr * B[0];
-    deriv[5] = s * dBdz[1] + c * dBdz[2];
-    deriv[6] = c * dBdr[0] - sinvr * dBdphi[0];
-    deriv[7] = s * dBdr[0] + cinvr * dBdphi[0];
-    deriv[8] = dBdz[0];
+    // convert (Bz,Br,Bphi) to (Bx,By,Bz)
+    const auto rPositive = vr > 0.0;
+    vec4 invr;
+    vec4 c;
+    vec4 s;
+    vec4 cphimin4;
+    vec4 sphimin4;
+    const vec4 zero = { 0 };
+    CxxUtils::vbroadcast(cphimin4, m_cosphimin);
+    CxxUtils::vbroadcast(sphimin4, m_sinphimin);
+    CxxUtils::vselect(invr, 1.0 / vr, zero, rPositive);
+    CxxUtils::vselect(c, vx * invr, cphimin4, rPositive);
+    CxxUtils::vselect(s, vy * invr, sphimin4, rPositive);
+
+    const vec4 B0 = Bzrphi[1] * c - Bzrphi[2] * s;
+    const vec4 B1 = Bzrphi[1] * s + Bzrphi[2] * c;
+    CxxUtils::vstore(Bx + i, B0);
+    CxxUtils::vstore(By + i, B1);
+    CxxUtils::vstore(Bz + i, Bzrphi[0]);
+
+    // compute field derivatives if requested
+    if (deriv) {
+      const double sz = m_scale * m_invz;
+      const double sr = m_scale * m_invr;
+      const double sphi = m_scale * m_invphi;
+
+      vec4 dBdz[3];
+      vec4 dBdr[3];
+      vec4 dBdphi[3];
+      for (int j = 0; j < 3; ++j) { // Bz, Br, Bphi components
+        const double* field = m_field[j];
+        dBdz[j] =
+          sz *
+          (gr * (gphi * (field[2] - field[0]) + fphi * (field[6] - field[4])) +
+           fr * (gphi * (field[3] - field[1]) + fphi * (field[7] - field[5])));
+        dBdr[j] =
+          sr *
+          (gz * (gphi * (field[1] - field[0]) + fphi * (field[5] - field[4])) +
+           fz * (gphi * (field[3] - field[2]) + fphi * (field[7] - field[6])));
+        dBdphi[j] =
+          sphi *
+          (gz * (gr * (field[4] - field[0]) + fr * (field[5] - field[1])) +
+           fz * (gr * (field[6] - field[2]) + fr * (field[7] - field[3])));
+      }
+      // convert to cartesian coordinates
+      const vec4 cc = c * c;
+      const vec4 cs = c * s;
+      const vec4 ss = s * s;
+      const vec4 ccinvr = cc * invr;
+      const vec4 csinvr = cs * invr;
+      const vec4 ssinvr = ss * invr;
+      const vec4 sinvr = s * invr;
+      const vec4 cinvr = c * invr;
+      const vec4 d[9] = {
+        cc * dBdr[1] - cs * dBdr[2] - csinvr * dBdphi[1] + ssinvr * dBdphi[2] +
+          sinvr * B1,
+        cs * dBdr[1] - ss * dBdr[2] + ccinvr * dBdphi[1] - csinvr * dBdphi[2] -
+          cinvr * B1,
+        c * dBdz[1] - s * dBdz[2],
+        cs * dBdr[1] + cc * dBdr[2] - ssinvr * dBdphi[1] - csinvr * dBdphi[2] -
+          sinvr * B0,
+        ss * dBdr[1] + cs * dBdr[2] + csinvr * dBdphi[1] + ccinvr * dBdphi[2] +
+          cinvr * B0,
+        s * dBdz[1] + c * dBdz[2],
+        c * dBdr[0] - sinvr * dBdphi[0],
+        s * dBdr[0] + cinvr * dBdphi[0],
+        dBdz[0]
+      };
+      for (int j = 0; j < 9; ++j) {
+        CxxUtils::vstore(deriv + j * n + i, d[j]);
+      }
+    }
   }
-}
 
+  // remaining points, one at a time
+  for (; i < n; ++i) {
+    const double xyz[3] = { x[i], y[i], z[i] };
+    double B[3];
+    double d[9];
+    getB(xyz, r[i], phi[i], B, deriv ? d : nullptr);
+    Bx[i] = B[0];
+    By[i] = B[1];
+    Bz[i] = B[2];
+    if (deriv) {
+      for (int j = 0; j < 9; ++j) {
+        deriv[j * n + i] = d[j];
+      }
+    }
+  }
+}
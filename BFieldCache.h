@@ -18,8 +18,10 @@
 #define BFIELDCACHE_H
 
 #define ATH_RESTRICT __restrict__
+#include "BFieldISA.h"
 #include "BFieldVector.h"
 #include "vec.h"
+#include <cstdint>
 class BFieldCache
 {
 public:
@@ -36,6 +38,32 @@ public:
                 double phimin,
                 double phimax);
 
+  // set the z, r, phi range that defines the bin,
+  // with the precomputed 1/(bin size) in z, r, phi
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double phimin,
+                double phimax,
+                double invz,
+                double invr,
+                double invphi);
+
+  // as above, also with the precomputed cos(phimin) and sin(phimin),
+  // used for points at r = 0
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double phimin,
+                double phimax,
+                double invz,
+                double invr,
+                double invphi,
+                double cosphimin,
+                double sinphimin);
+
   // set field array, filled externally
   void setField(double field[][8]);
 
@@ -49,8 +77,27 @@ public:
   void setBscale(double bscale);
   float bscale() const;
 
+  // accessors to the bin range
+  double zmin() const { return m_zmin; }
+  double zmax() const { return m_zmax; }
+  double rmin() const { return m_rmin; }
+  double rmax() const { return m_rmax; }
+  double phimin() const { return m_phimin; }
+  double phimax() const { return m_phimax; }
+
   // test if (z, r, phi) is inside this bin
   bool inside(double z, double r, double phi) const;
+  // as inside, without branches: the three ranges are tested
+  // with vector compares
+  bool insideVec(double z, double r, double phi) const;
+  // test n points, given in structure-of-arrays form.
+  // Bit i % 64 of mask[i / 64] is set if point i is inside this bin,
+  // mask must hold (n + 63) / 64 words.
+  void insideMask(const double* ATH_RESTRICT z,
+                  const double* ATH_RESTRICT r,
+                  const double* ATH_RESTRICT phi,
+                  size_t n,
+                  uint64_t* ATH_RESTRICT mask) const;
   // interpolate the field and return B[3].
   // also compute field derivatives if deriv[9] is given.
   void getB(const double* ATH_RESTRICT xyz,
@@ -65,7 +112,100 @@ public:
                double* ATH_RESTRICT B,
                double* ATH_RESTRICT deriv = nullptr) const;
 
+  // as getBVec, with the precomputed invr = 1/r (any value if r = 0),
+  // when the caller has it already
+  void getBVec(const double* ATH_RESTRICT xyz,
+               double r,
+               double invr,
+               double phi,
+               double* ATH_RESTRICT B,
+               double* ATH_RESTRICT deriv = nullptr) const;
+
+  // getBVec specialized at compile time: deriv[9] is filled only if
+  // withDeriv, and with unitScale the corner values are taken to be in
+  // kT already, as filled by BFieldMesh::getCacheVec<true>, and are not
+  // multiplied by bscale(). getBVec above picks between getBVec<true>
+  // and getBVec<false> at run time.
+  template<bool withDeriv, bool unitScale = false>
+  void getBVec(const double* ATH_RESTRICT xyz,
+               double r,
+               double phi,
+               double* ATH_RESTRICT B,
+               double* ATH_RESTRICT deriv = nullptr) const;
+
+  // interpolate the field for n points, all inside this bin, given in
+  // structure-of-arrays form. Each SIMD lane handles a different point.
+  // Returns Bx[n], By[n], Bz[n].
+  // also compute field derivatives if deriv[9*n] is given,
+  // with deriv[j*n + i] the j-th derivative of the i-th point.
+  void getBBatch(const double* ATH_RESTRICT x,
+                 const double* ATH_RESTRICT y,
+                 const double* ATH_RESTRICT z,
+                 const double* ATH_RESTRICT r,
+                 const double* ATH_RESTRICT phi,
+                 size_t n,
+                 double* ATH_RESTRICT Bx,
+                 double* ATH_RESTRICT By,
+                 double* ATH_RESTRICT Bz,
+                 double* ATH_RESTRICT deriv = nullptr) const;
+
 private:
+  template<class T>
+  friend class BFieldMesh;
+
+  // the body of the getBVec variants
+  template<bool withDeriv, bool unitScale>
+  void getBVecImpl(const double* ATH_RESTRICT xyz,
+                   double r,
+                   double invr,
+                   double phi,
+                   double* ATH_RESTRICT B,
+                   double* ATH_RESTRICT deriv) const;
+
+  // vectorized interpolation given the fractional position (fz, fr, fphi)
+  // inside the bin and the corner values, shared by
+  // getBVec and BFieldMesh::getB. The derivatives are computed if
+  // withDeriv, and the values multiplied by scale unless unitScale.
+  // invr is 1/r, and (cosphimin, sinphimin) the direction used at r = 0.
+  template<bool withDeriv, bool unitScale>
+  static void interpolateVec(const double* ATH_RESTRICT xyz,
+                             double r,
+                             double invr,
+                             double fz,
+                             double fr,
+                             double fphi,
+                             const CxxUtils::vec<double, 4>& field1_z,
+                             const CxxUtils::vec<double, 4>& field2_z,
+                             const CxxUtils::vec<double, 4>& field1_r,
+                             const CxxUtils::vec<double, 4>& field2_r,
+                             const CxxUtils::vec<double, 4>& field1_phi,
+                             const CxxUtils::vec<double, 4>& field2_phi,
+                             double scale,
+                             double binInvz,
+                             double binInvr,
+                             double binInvphi,
+                             double cosphimin,
+                             double sinphimin,
+                             double* ATH_RESTRICT B,
+                             double* ATH_RESTRICT deriv);
+
+  // inside test of n points against the (z, r, phi) ranges
+  // [lo, hi], shared by insideMask and BFieldMesh::insideMask.
+  // phi below lo[2] is moved up by 2pi first.
+  static void insideRange(const double* ATH_RESTRICT lo,
+                          const double* ATH_RESTRICT hi,
+                          const double* ATH_RESTRICT z,
+                          const double* ATH_RESTRICT r,
+                          const double* ATH_RESTRICT phi,
+                          size_t n,
+                          uint64_t* ATH_RESTRICT mask);
+
+  // dst = (sum(r0), sum(r1), sum(r2), 0)
+  static void hsum3(CxxUtils::vec<double, 4>& dst,
+                    const CxxUtils::vec<double, 4>& r0,
+                    const CxxUtils::vec<double, 4>& r1,
+                    const CxxUtils::vec<double, 4>& r2);
+
   // bin range in z
   double m_zmin = 0.0;
   double m_zmax = 0.0;
@@ -79,6 +219,9 @@ private:
   double m_invz;
   double m_invr;
   double m_invphi;
+  // cos(m_phimin), sin(m_phimin), for points at r = 0
+  double m_cosphimin;
+  double m_sinphimin;
   double m_scale;                   // unit of m_field in kT
   alignas(16) double m_field[3][8]; // (Bz,Br,Bphi) at 8 corners of the bin
 };
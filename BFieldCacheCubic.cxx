@@ -0,0 +1,171 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldCacheCubic.h"
+#include "BFieldStats.h"
+#include "vec.h"
+
+namespace {
+
+using vec4 = CxxUtils::vec<double, 4>;
+
+// the weights w of the 4 nodes in the spline through them at t in [0, 1]
+// of the bin between nodes 1 and 2, and their derivatives dw in t.
+// ta and tb are (bin size) / (node 2 - node 0), (bin size) / (node 3 -
+// node 1), which turn the node differences into the tangents at the edges.
+inline void
+splineWeights(double t, double ta, double tb, vec4& w, vec4& dw)
+{
+  const double t2 = t * t;
+  const double t3 = t2 * t;
+  // the cubic Hermite basis: values at 0 and 1, tangents at 0 and 1
+  const double h00 = 2 * t3 - 3 * t2 + 1;
+  const double h01 = 3 * t2 - 2 * t3;
+  const double h10 = t3 - 2 * t2 + t;
+  const double h11 = t3 - t2;
+  w[0] = -ta * h10;
+  w[1] = h00 - tb * h11;
+  w[2] = h01 + ta * h10;
+  w[3] = tb * h11;
+  const double d00 = 6 * t2 - 6 * t;
+  const double d10 = 3 * t2 - 4 * t + 1;
+  const double d11 = 3 * t2 - 2 * t;
+  dw[0] = -ta * d10;
+  dw[1] = d00 - tb * d11;
+  dw[2] = ta * d10 - d00;
+  dw[3] = tb * d11;
+}
+
+// sum of the lanes of a * b
+inline double
+dot(const vec4& a, const vec4& b)
+{
+  const vec4 p = a * b;
+  return (p[0] + p[1]) + (p[2] + p[3]);
+}
+
+} // namespace
+
+template<bool withDeriv>
+inline void
+BFieldCacheCubic::getBImpl(const double* ATH_RESTRICT xyz,
+                           double r,
+                           double phi,
+                           double* ATH_RESTRICT B,
+                           double* ATH_RESTRICT deriv) const
+{
+  BFIELD_STATS_SCOPE(BFieldStats::Interpolate);
+
+  const double x = xyz[0];
+  const double y = xyz[1];
+  const double z = xyz[2];
+
+  // make sure phi is inside [m_phimin,m_phimax]
+  if (phi < m_phimin) {
+    phi += 2 * M_PI;
+  }
+  // the node weights along z, r, phi at the fractional position inside
+  // this bin
+  vec4 wz;
+  vec4 dwz;
+  vec4 wr;
+  vec4 dwr;
+  vec4 wphi;
+  vec4 dwphi;
+  splineWeights((z - m_zmin) * m_invz, m_spline[0][0], m_spline[0][1], wz, dwz);
+  splineWeights((r - m_rmin) * m_invr, m_spline[1][0], m_spline[1][1], wr, dwr);
+  splineWeights(
+    (phi - m_phimin) * m_invphi, m_spline[2][0], m_spline[2][1], wphi, dwphi);
+
+  // interpolate field values in z, r, phi: the 4 r nodes are the
+  // lanes, summed over phi then z, and over r last
+  double Bzrphi[3];
+  double dBdz[3];
+  double dBdr[3];
+  double dBdphi[3];
+  for (int j = 0; j < 3; ++j) { // Bz, Br, Bphi components
+    vec4 sum = { 0., 0., 0., 0. };
+    vec4 sumdz = sum;
+    vec4 sumdphi = sum;
+    for (int iz = 0; iz < 4; ++iz) {
+      vec4 sumphi = { 0., 0., 0., 0. };
+      vec4 sumphidphi = sumphi;
+      for (int iphi = 0; iphi < 4; ++iphi) {
+        vec4 nodes;
+        CxxUtils::vload(nodes, m_field[j][iz][iphi]);
+        sumphi += wphi[iphi] * nodes;
+        if constexpr (withDeriv) {
+          sumphidphi += dwphi[iphi] * nodes;
+        }
+      }
+      sum += wz[iz] * sumphi;
+      if constexpr (withDeriv) {
+        sumdz += dwz[iz] * sumphi;
+        sumdphi += wz[iz] * sumphidphi;
+      }
+    }
+    Bzrphi[j] = m_scale * dot(sum, wr);
+    if constexpr (withDeriv) {
+      dBdz[j] = m_scale * m_invz * dot(sumdz, wr);
+      dBdr[j] = m_scale * m_invr * dot(sum, dwr);
+      dBdphi[j] = m_scale * m_invphi * dot(sumdphi, wr);
+    }
+  }
+  // convert (Bz,Br,Bphi) to (Bx,By,Bz)
+  double invr;
+  double c;
+  double s;
+  if (r > 0.0) {
+    invr = 1.0 / r;
+    c = x * invr;
+    s = y * invr;
+  } else {
+    invr = 0.0;
+    c = m_cosphimin;
+    s = m_sinphimin;
+  }
+  B[0] = Bzrphi[1] * c - Bzrphi[2] * s;
+  B[1] = Bzrphi[1] * s + Bzrphi[2] * c;
+  B[2] = Bzrphi[0];
+
+  if constexpr (withDeriv) {
+    // convert to cartesian coordinates
+    const double cc = c * c;
+    const double cs = c * s;
+    const double ss = s * s;
+    const double ccinvr = cc * invr;
+    const double csinvr = cs * invr;
+    const double ssinvr = ss * invr;
+    const double sinvr = s * invr;
+    const double cinvr = c * invr;
+    deriv[0] = cc * dBdr[1] - cs * dBdr[2] - csinvr * dBdphi[1] +
+               ssinvr * dBdphi[2] + sinvr * B[1];
+    deriv[1] = cs * dBdr[1] - ss * dBdr[2] + ccinvr * dBdphi[1] -
+               csinvr * dBdphi[2] - cinvr * B[1];
+    deriv[2] = c * dBdz[1] - s * dBdz[2];
+    deriv[3] = cs * dBdr[1] + cc * dBdr[2] - ssinvr * dBdphi[1] -
+               csinvr * dBdphi[2] - sinvr * B[0];
+    deriv[4] = ss * dBdr[1] + cs * dBdr[2] + csinvr * dBdphi[1] +
+               ccinvr * dBdphi[2] + cinvr * B[0];
+    deriv[5] = s * dBdz[1] + c * dBdz[2];
+    deriv[6] = c * dBdr[0] - sinvr * dBdphi[0];
+    deriv[7] = s * dBdr[0] + cinvr * dBdphi[0];
+    deriv[8] = dBdz[0];
+  }
+}
+
+BFIELD_TARGET_CLONES
+void
+BFieldCacheCubic::getB(const double* ATH_RESTRICT xyz,
+                       double r,
+                       double phi,
+                       double* ATH_RESTRICT B,
+                       double* ATH_RESTRICT deriv) const
+{
+  if (deriv) {
+    getBImpl<true>(xyz, r, phi, B, deriv);
+  } else {
+    getBImpl<false>(xyz, r, phi, B, nullptr);
+  }
+}
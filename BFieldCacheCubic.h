@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+/**
+ * BFieldCacheCubic.h
+ *
+ * Tricubic cache of one bin of the magnetic field map.
+ * Defined by the same ranges in z, r, phi as BFieldCache, but holding the
+ * (Bz, Br, Bphi) vectors at the 4 x 4 x 4 mesh nodes around the "bin".
+ *
+ * Along each axis the field is a cubic Hermite (Catmull-Rom) spline: the
+ * tangent at a node is the difference over its two neighbours, with the
+ * actual mesh spacings, and the one-sided difference at the edge of the
+ * zone. Neighbouring bins of a zone share their tangents, so the field
+ * and its first derivatives are continuous across the bin edges, where
+ * those of BFieldCache jump. The node values, and fields linear in z, r
+ * and phi, are reproduced exactly.
+ *
+ * The edges in phi are treated as zone edges even for a zone covering
+ * the full 2pi.
+ */
+
+#ifndef BFIELDCACHECUBIC_H
+#define BFIELDCACHECUBIC_H
+
+#define ATH_RESTRICT __restrict__
+#include "BFieldISA.h"
+#include "vec.h"
+class BFieldCacheCubic
+{
+public:
+  // default constructor sets unphysical boundaries, so that inside() will fail
+  BFieldCacheCubic() = default;
+  // make this cache invalid, so that inside() will fail
+  void invalidate();
+
+  // set the z, r, phi range that defines the bin,
+  // with the precomputed 1/(bin size) in z, r, phi,
+  // and cos(phimin) and sin(phimin), used for points at r = 0
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double phimin,
+                double phimax,
+                double invz,
+                double invr,
+                double invphi,
+                double cosphimin,
+                double sinphimin);
+
+  // set the multiplicative factor for the field vectors
+  void setBscale(double bscale);
+  float bscale() const;
+
+  // accessors to the bin range
+  double zmin() const { return m_zmin; }
+  double zmax() const { return m_zmax; }
+  double rmin() const { return m_rmin; }
+  double rmax() const { return m_rmax; }
+  double phimin() const { return m_phimin; }
+  double phimax() const { return m_phimax; }
+
+  // test if (z, r, phi) is inside this bin
+  bool inside(double z, double r, double phi) const;
+
+  // interpolate the field and return B[3].
+  // also compute field derivatives if deriv[9] is given.
+  void getB(const double* ATH_RESTRICT xyz,
+            double r,
+            double phi,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr) const;
+
+private:
+  template<class T>
+  friend class BFieldMesh;
+
+  // the body of getB, derivatives computed if withDeriv
+  template<bool withDeriv>
+  void getBImpl(const double* ATH_RESTRICT xyz,
+                double r,
+                double phi,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv) const;
+
+  // bin range in z
+  double m_zmin = 0.0;
+  double m_zmax = 0.0;
+  // bin range in r
+  double m_rmin = 0.0;
+  double m_rmax = 0.0;
+  // bin range in phi
+  double m_phimin = 0.0;
+  double m_phimax = -1.0;
+  // 1/(bin size) in z, r, phi
+  double m_invz;
+  double m_invr;
+  double m_invphi;
+  // cos(m_phimin), sin(m_phimin), for points at r = 0
+  double m_cosphimin;
+  double m_sinphimin;
+  double m_scale; // unit of m_field in kT
+  // along z, r, phi: (bin size) / (distance between the neighbours of
+  // the lower edge), and of the upper edge, scaling the tangents
+  double m_spline[3][2];
+  // (Bz,Br,Bphi) at the nodes [z][phi][r], the bin between nodes 1 and 2
+  alignas(32) double m_field[3][4][4][4];
+};
+
+#include "BFieldCacheCubic.icc"
+#endif
@@ -0,0 +1,172 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldCacheF.h"
+#include "BFieldStats.h"
+#include "vec.h"
+#include <cmath>
+
+namespace {
+using vec8f = CxxUtils::vec<float, 8>;
+
+// Fill the first 4 elements of dst with the horizontal sums of a, b, c, d
+inline void
+hsum4(vec8f& dst, const vec8f& a, const vec8f& b, const vec8f& c, const vec8f& d)
+{
+  vec8f t0;
+  vec8f t1;
+  // a0+a2 b0+b2 a1+a3 b1+b3 a4+a6 b4+b6 a5+a7 b5+b7
+  CxxUtils::vblend<0, 8, 1, 9, 4, 12, 5, 13>(t0, a, b);
+  CxxUtils::vblend<2, 10, 3, 11, 6, 14, 7, 15>(t1, a, b);
+  const vec8f ab = t0 + t1;
+  CxxUtils::vblend<0, 8, 1, 9, 4, 12, 5, 13>(t0, c, d);
+  CxxUtils::vblend<2, 10, 3, 11, 6, 14, 7, 15>(t1, c, d);
+  const vec8f cd = t0 + t1;
+  // sums of a, b, c, d over elements 0-3, then over elements 4-7
+  CxxUtils::vblend<0, 1, 8, 9, 4, 5, 12, 13>(t0, ab, cd);
+  CxxUtils::vblend<2, 3, 10, 11, 6, 7, 14, 15>(t1, ab, cd);
+  const vec8f abcd = t0 + t1;
+  CxxUtils::vpermute<4, 5, 6, 7, 0, 1, 2, 3>(t0, abcd);
+  dst = abcd + t0;
+}
+}
+
+BFIELD_TARGET_CLONES
+void
+BFieldCacheF::getBVec(const double* ATH_RESTRICT xyz,
+                      double r,
+                      double phi,
+                      double* ATH_RESTRICT B,
+                      double* ATH_RESTRICT deriv) const
+{
+  BFIELD_STATS_SCOPE(BFieldStats::Interpolate);
+
+  const double x = xyz[0];
+  const double y = xyz[1];
+  const double z = xyz[2];
+
+  // make sure phi is inside [m_phimin,m_phimax]
+  if (phi < m_phimin) {
+    phi += 2 * M_PI;
+  }
+  // fractional position inside this bin
+  const float fz = (z - m_zmin) * m_invz;
+  const float gz = 1.0f - fz;
+  const float fr = (r - m_rmin) * m_invr;
+  const float gr = 1.0f - fr;
+  const float fphi = (phi - m_phimin) * m_invphi;
+  const float gphi = 1.0f - fphi;
+
+  // Load (Bz, Br, Bphi) at 8 corners of the bin
+  vec8f field_z;
+  vec8f field_r;
+  vec8f field_phi;
+  CxxUtils::vload(field_z, m_field[0]);
+  CxxUtils::vload(field_r, m_field[1]);
+  CxxUtils::vload(field_phi, m_field[2]);
+
+  // The 8 corners are ordered as
+  // (z, r, phi) = (0,0,0) (0,1,0) (1,0,0) (1,1,0) (0,0,1) (0,1,1) (1,0,1) (1,1,1)
+  const vec8f zCoeff = { gz, gz, fz, fz, gz, gz, fz, fz };
+  const vec8f rCoeff = { gr, fr, gr, fr, gr, fr, gr, fr };
+  const vec8f phiCoeff = { gphi, gphi, gphi, gphi, fphi, fphi, fphi, fphi };
+  const vec8f zrCoeff = zCoeff * rCoeff;
+  const vec8f weight = zrCoeff * phiCoeff;
+
+  // convert (Bz,Br,Bphi) to (Bx,By,Bz)
+  double invr;
+  double c;
+  double s;
+  if (r > 0.0) {
+    invr = 1.0 / r;
+    c = x * invr;
+    s = y * invr;
+  } else {
+    invr = 0.0;
+    c = m_cosphimin;
+    s = m_sinphimin;
+  }
+
+  if (!deriv) {
+    const vec8f zero = { 0 };
+    vec8f Bzrphi;
+    hsum4(Bzrphi,
+          field_z * weight,
+          field_r * weight,
+          field_phi * weight,
+          zero);
+    const double Bz = m_scale * Bzrphi[0];
+    const double Br = m_scale * Bzrphi[1];
+    const double Bphi = m_scale * Bzrphi[2];
+    B[0] = Br * c - Bphi * s;
+    B[1] = Br * s + Bphi * c;
+    B[2] = Bz;
+    return;
+  }
+
+  // weights for the derivatives in z, r, phi
+  const vec8f zSign = { -1, -1, 1, 1, -1, -1, 1, 1 };
+  const vec8f rSign = { -1, 1, -1, 1, -1, 1, -1, 1 };
+  const vec8f phiSign = { -1, -1, -1, -1, 1, 1, 1, 1 };
+  const vec8f weight_z = zSign * rCoeff * phiCoeff;
+  const vec8f weight_r = zCoeff * rSign * phiCoeff;
+  const vec8f weight_phi = zrCoeff * phiSign;
+
+  // (B, dB/dz, dB/dr, dB/dphi) for each component
+  vec8f Bz4;
+  vec8f Br4;
+  vec8f Bphi4;
+  hsum4(Bz4,
+        field_z * weight,
+        field_z * weight_z,
+        field_z * weight_r,
+        field_z * weight_phi);
+  hsum4(Br4,
+        field_r * weight,
+        field_r * weight_z,
+        field_r * weight_r,
+        field_r * weight_phi);
+  hsum4(Bphi4,
+        field_phi * weight,
+        field_phi * weight_z,
+        field_phi * weight_r,
+        field_phi * weight_phi);
+
+  const double Bzrphi[3] = { m_scale * Bz4[0],
+                             m_scale * Br4[0],
+                             m_scale * Bphi4[0] };
+  B[0] = Bzrphi[1] * c - Bzrphi[2] * s;
+  B[1] = Bzrphi[1] * s + Bzrphi[2] * c;
+  B[2] = Bzrphi[0];
+
+  const double sz = m_scale * m_invz;
+  const double sr = m_scale * m_invr;
+  const double sphi = m_scale * m_invphi;
+  const double dBdz[3] = { sz * Bz4[1], sz * Br4[1], sz * Bphi4[1] };
+  const double dBdr[3] = { sr * Bz4[2], sr * Br4[2], sr * Bphi4[2] };
+  const double dBdphi[3] = { sphi * Bz4[3], sphi * Br4[3], sphi * Bphi4[3] };
+
+  // convert to cartesian coordinates
+  const double cc = c * c;
+  const double cs = c * s;
+  const double ss = s * s;
+  const double ccinvr = cc * invr;
+  const double csinvr = cs * invr;
+  const double ssinvr = ss * invr;
+  const double sinvr = s * invr;
+  const double cinvr = c * invr;
+  deriv[0] = cc * dBdr[1] - cs * dBdr[2] - csinvr * dBdphi[1] +
+             ssinvr * dBdphi[2] + sinvr * B[1];
+  deriv[1] = cs * dBdr[1] - ss * dBdr[2] + ccinvr * dBdphi[1] -
+             csinvr * dBdphi[2] - cinvr * B[1];
+  deriv[2] = c * dBdz[1] - s * dBdz[2];
+  deriv[3] = cs * dBdr[1] + cc * dBdr[2] - ssinvr * dBdphi[1] -
+             csinvr * dBdphi[2] - sinvr * B[0];
+  deriv[4] = ss * dBdr[1] + cs * dBdr[2] + csinvr * dBdphi[1] +
+             ccinvr * dBdphi[2] + cinvr * B[0];
+  deriv[5] = s * dBdz[1] + c * dBdz[2];
+  deriv[6] = c * dBdr[0] - sinvr * dBdphi[0];
+  deriv[7] = s * dBdr[0] + cinvr * dBdphi[0];
+  deriv[8] = dBdz[0];
+}
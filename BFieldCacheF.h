@@ -0,0 +1,103 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+/**
+ * BFieldCacheF.h
+ *
+ * Single precision cache of one bin of the magnetic field map.
+ * Same bin definition as BFieldCache, but the B vectors at the 8 corners
+ * are kept as float, so that one component of the 8 corners fits in a
+ * single CxxUtils::vec<float,8> (one 256 bit register) and the interpolation
+ * is done in float.
+ *
+ * Accuracy : for each component, the difference to the double precision
+ * BFieldCache::getBVec is bounded by
+ *   |B_float - B_double| <= 1e-6 * bscale * max_corner |field|
+ * and for the derivatives by the same bound times 1/(bin size)
+ * (and 1/r for the phi derivatives).
+ */
+
+#ifndef BFIELDCACHEF_H
+#define BFIELDCACHEF_H
+
+#define ATH_RESTRICT __restrict__
+#include "BFieldISA.h"
+#include "vec.h"
+class BFieldCacheF
+{
+public:
+  // default constructor sets unphysical boundaries, so that inside() will fail
+  BFieldCacheF() = default;
+  // make this cache invalid, so that inside() will fail
+  void invalidate();
+
+  // set the z, r, phi range that defines the bin,
+  // with the precomputed 1/(bin size) in z, r, phi
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double phimin,
+                double phimax,
+                double invz,
+                double invr,
+                double invphi);
+
+  // as above, also with the precomputed cos(phimin) and sin(phimin),
+  // used for points at r = 0
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double phimin,
+                double phimax,
+                double invz,
+                double invr,
+                double invphi,
+                double cosphimin,
+                double sinphimin);
+
+  // set field array, filled externally
+  void setFieldVec(const CxxUtils::vec<float, 8>& field1,
+                   const CxxUtils::vec<float, 8>& field2,
+                   const CxxUtils::vec<float, 8>& field3);
+
+  // set the multiplicative factor for the field vectors
+  void setBscale(double bscale);
+  float bscale() const;
+
+  // test if (z, r, phi) is inside this bin
+  bool inside(double z, double r, double phi) const;
+
+  // interpolate the field and return B[3].
+  // also compute field derivatives if deriv[9] is given.
+  void getBVec(const double* ATH_RESTRICT xyz,
+               double r,
+               double phi,
+               double* ATH_RESTRICT B,
+               double* ATH_RESTRICT deriv = nullptr) const;
+
+private:
+  // bin range in z
+  double m_zmin = 0.0;
+  double m_zmax = 0.0;
+  // bin range in r
+  double m_rmin = 0.0;
+  double m_rmax = 0.0;
+  // bin range in phi
+  double m_phimin = 0.0;
+  double m_phimax = -1.0;
+  // 1/(bin size) in z, r, phi
+  double m_invz;
+  double m_invr;
+  double m_invphi;
+  // cos(m_phimin), sin(m_phimin), for points at r = 0
+  double m_cosphimin;
+  double m_sinphimin;
+  double m_scale;                  // unit of m_field in kT
+  alignas(32) float m_field[3][8]; // (Bz,Br,Bphi) at 8 corners of the bin
+};
+
+#include "BFieldCacheF.icc"
+#endif
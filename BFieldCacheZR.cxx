@@ -0,0 +1,89 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldCacheZR.h"
+#include "BFieldStats.h"
+#include "vec.h"
+
+BFIELD_TARGET_CLONES
+void
+BFieldCacheZR::getB(const double* ATH_RESTRICT xyz,
+                    double r,
+                    double* ATH_RESTRICT B,
+                    double* ATH_RESTRICT deriv) const
+{
+  BFIELD_STATS_SCOPE(BFieldStats::Interpolate);
+  using vec8 = CxxUtils::vec<double, 8>;
+
+  const double x = xyz[0];
+  const double y = xyz[1];
+  const double z = xyz[2];
+
+  // fractional position inside this bin
+  const double fz = (z - m_zmin) * m_invz;
+  const double gz = 1.0 - fz;
+  const double fr = (r - m_rmin) * m_invr;
+  const double gr = 1.0 - fr;
+
+  // Load (Bz, Br) at the 4 corners of the bin, ordered as
+  // (z, r) = (0,0) (0,1) (1,0) (1,1)
+  vec8 field;
+  CxxUtils::vload(field, &m_field[0][0]);
+
+  // the same 4 weights for both components
+  const vec8 weight = { gz * gr, gz * fr, fz * gr, fz * fr,
+                        gz * gr, gz * fr, fz * gr, fz * fr };
+  const vec8 interp = field * weight;
+  const double Bz =
+    m_scale * ((interp[0] + interp[1]) + (interp[2] + interp[3]));
+  const double Br =
+    m_scale * ((interp[4] + interp[5]) + (interp[6] + interp[7]));
+
+  // convert (Bz,Br) to (Bx,By,Bz)
+  double invr;
+  double c;
+  double s;
+  if (r > 0.0) {
+    invr = 1.0 / r;
+    c = x * invr;
+    s = y * invr;
+  } else {
+    invr = 0.0;
+    c = 1.0;
+    s = 0.0;
+  }
+  B[0] = Br * c;
+  B[1] = Br * s;
+  B[2] = Bz;
+
+  // compute field derivatives if requested
+  if (deriv) {
+    const double sz = m_scale * m_invz;
+    const double sr = m_scale * m_invr;
+    // weights of the corners in the z and r differences
+    const vec8 zCoeff = { -gr, -fr, gr, fr, -gr, -fr, gr, fr };
+    const vec8 rCoeff = { -gz, gz, -fz, fz, -gz, gz, -fz, fz };
+    const vec8 dz = field * zCoeff;
+    const vec8 dr = field * rCoeff;
+    const double dBzdz = sz * ((dz[0] + dz[1]) + (dz[2] + dz[3]));
+    const double dBrdz = sz * ((dz[4] + dz[5]) + (dz[6] + dz[7]));
+    const double dBzdr = sr * ((dr[0] + dr[1]) + (dr[2] + dr[3]));
+    const double dBrdr = sr * ((dr[4] + dr[5]) + (dr[6] + dr[7]));
+
+    // convert to cartesian coordinates
+    const double cc = c * c;
+    const double cs = c * s;
+    const double ss = s * s;
+    const double Brinvr = Br * invr;
+    deriv[0] = cc * dBrdr + ss * Brinvr;
+    deriv[1] = cs * (dBrdr - Brinvr);
+    deriv[2] = c * dBrdz;
+    deriv[3] = deriv[1];
+    deriv[4] = ss * dBrdr + cc * Brinvr;
+    deriv[5] = s * dBrdz;
+    deriv[6] = c * dBzdr;
+    deriv[7] = s * dBzdr;
+    deriv[8] = dBzdz;
+  }
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+/**
+ * BFieldCacheZR.h
+ *
+ * Cache of one bin of the 2D (z, r) field map of the solenoid.
+ * Defined by ranges in z, r, and the (Bz, Br) vectors at the 4 corners
+ * of the "bin". The field is taken to be axially symmetric, with no
+ * Bphi component.
+ *
+ * The 4 corners of one component are one CxxUtils::vec<double,4>
+ * (one AVX register), and both components one vec<double,8>.
+ */
+
+#ifndef BFIELDCACHEZR_H
+#define BFIELDCACHEZR_H
+
+#define ATH_RESTRICT __restrict__
+#include "BFieldISA.h"
+#include "vec.h"
+class BFieldCacheZR
+{
+public:
+  // default constructor sets unphysical boundaries, so that inside() will fail
+  BFieldCacheZR() = default;
+  // make this cache invalid, so that inside() will fail
+  void invalidate();
+
+  // set the z, r range that defines the bin,
+  // with the precomputed 1/(bin size) in z, r
+  void setRange(double zmin,
+                double zmax,
+                double rmin,
+                double rmax,
+                double invz,
+                double invr);
+
+  // set field array, filled externally: (Bz, Br) at the 4 corners,
+  // in the corner order (z, r) = (0,0) (0,1) (1,0) (1,1)
+  void setFieldVec(const CxxUtils::vec<double, 8>& field);
+
+  // set the multiplicative factor for the field vectors
+  void setBscale(double bscale);
+  float bscale() const;
+
+  // accessors to the bin range
+  double zmin() const { return m_zmin; }
+  double zmax() const { return m_zmax; }
+  double rmin() const { return m_rmin; }
+  double rmax() const { return m_rmax; }
+
+  // test if (z, r) is inside this bin
+  bool inside(double z, double r) const;
+
+  // interpolate the field and return B[3].
+  // also compute field derivatives if deriv[9] is given.
+  void getB(const double* ATH_RESTRICT xyz,
+            double r,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr) const;
+
+private:
+  // bin range in z
+  double m_zmin = 0.0;
+  double m_zmax = -1.0;
+  // bin range in r
+  double m_rmin = 0.0;
+  double m_rmax = 0.0;
+  // 1/(bin size) in z, r
+  double m_invz;
+  double m_invr;
+  double m_scale;                   // unit of m_field in kT
+  alignas(64) double m_field[2][4]; // (Bz,Br) at 4 corners of the bin
+};
+
+#include "BFieldCacheZR.icc"
+#endif
@@ -0,0 +1,294 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldFlat.h
+//
+// A BFieldMap as flat arrays of plain numbers, and the look-up and
+// interpolation of the field on them, for code that cannot use the
+// BFieldMap objects, e.g. on an accelerator. Header only, with no
+// dependency beyond <cmath>: the functions are host and device functions
+// when compiled by CUDA, and plain inline functions otherwise (e.g. for
+// SYCL kernels).
+//
+// BFieldFlatMap only points to the arrays: BFieldFlatBuffers fills them
+// from a BFieldMap on the host, and its view() points to them there. For
+// a device, copy each array and point a copy of view() to the copies.
+//
+// bfieldFlatGetB repeats the arithmetic of a BFieldMap::getCache
+// followed by BFieldCache::getB, operation by operation, and gives the
+// same bits on the host. On a device, it is as exact as its sqrt and
+// atan2.
+//
+#ifndef BFIELDFLAT_H
+#define BFIELDFLAT_H
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__CUDACC__)
+#define BFIELD_HOST_DEVICE __host__ __device__
+#else
+#define BFIELD_HOST_DEVICE
+#endif
+
+// one zone: its ranges, and the start of its arrays in BFieldFlatMap
+struct BFieldFlatZone
+{
+  double min[3]; // zmin, rmin, phimin
+  double max[3]; // zmax, rmax, phimax
+  double scale;  // bscale of the zone
+  double invUnit[3];
+  // the nmesh[j] edges along z, r, phi start at mesh[j] in
+  // BFieldFlatMap::mesh, and their inverse spacings at the same index of
+  // BFieldFlatMap::invMesh (the last one unused)
+  int32_t mesh[3];
+  int32_t nmesh[3];
+  // the LUTs start at LUT[j] in BFieldFlatMap::LUT
+  int32_t LUT[3];
+  int32_t nLUT[3];
+  // index of node 0 in the field arrays of BFieldFlatMap
+  int32_t field;
+  int32_t roff; // index offset for incrementing r by 1
+  int32_t zoff; // index offset for incrementing z by 1
+};
+
+// the arrays, and the zone look-up table of the map
+struct BFieldFlatMap
+{
+  const BFieldFlatZone* zones;
+  int32_t nzones;
+  // the mesh edges of all the zones
+  const double* mesh;
+  const double* invMesh;
+  // cos and sin of the mesh edges, used along phi only
+  const double* cosMesh;
+  const double* sinMesh;
+  const int32_t* LUT;
+  // the field at all the nodes, per component
+  const int16_t* fieldz;
+  const int16_t* fieldr;
+  const int16_t* fieldphi;
+  // the zone edges along z, r, phi start at edge[j] in edges, and the
+  // edge LUTs at edgeLUT[j] in edgeLUTs
+  const double* edges;
+  const int32_t* edgeLUTs;
+  int32_t edge[3];
+  int32_t nedge[3];
+  int32_t edgeLUT[3];
+  double edgeInvUnit[3];
+  // zone index of each cell, -1 if not covered by any zone
+  const int32_t* zoneLUT;
+  int32_t roff;
+  int32_t zoff;
+  // the scale factor of the map, see BFieldMap::setScale
+  double scale;
+};
+
+// the index of the zone containing (z, r, phi), -1 if outside the map.
+// phi is expected in [-pi, pi]. As BFieldMap::findZone.
+BFIELD_HOST_DEVICE inline int
+bfieldFlatFindZone(const BFieldFlatMap& map, double z, double r, double phi)
+{
+  if (phi < 0) {
+    phi += 2 * M_PI;
+  }
+  const double pos[3] = { z, r, phi };
+  int index[3];
+  for (int j = 0; j < 3; ++j) {
+    const double* edge = map.edges + map.edge[j];
+    if (!(pos[j] >= edge[0] && pos[j] <= edge[map.nedge[j] - 1])) {
+      return -1;
+    }
+    int i = int((pos[j] - edge[0]) * map.edgeInvUnit[j]); // index to LUT
+    i = map.edgeLUTs[map.edgeLUT[j] + i]; // tentative edge index from LUT
+    if (pos[j] > edge[i + 1]) {
+      ++i;
+    }
+    index[j] = i;
+  }
+  return map.zoneLUT[index[0] * map.zoff + index[1] * map.roff + index[2]];
+}
+
+// interpolate the field at xyz and return B[3], zero outside the map.
+// also compute field derivatives if deriv[9] is given.
+BFIELD_HOST_DEVICE inline void
+bfieldFlatGetB(const BFieldFlatMap& map,
+               const double* xyz,
+               double* B,
+               double* deriv = nullptr)
+{
+  const double x = xyz[0];
+  const double y = xyz[1];
+  const double z = xyz[2];
+  const double r = sqrt(x * x + y * y);
+  double phi = atan2(y, x);
+  const int izone = bfieldFlatFindZone(map, z, r, phi);
+  if (izone < 0) {
+    // outside the map
+    for (int j = 0; j < 3; ++j) {
+      B[j] = 0.;
+    }
+    if (deriv) {
+      for (int j = 0; j < 9; ++j) {
+        deriv[j] = 0.;
+      }
+    }
+    return;
+  }
+  const BFieldFlatZone& zone = map.zones[izone];
+
+  // the bin, as BFieldMesh::getCache
+  if (phi < zone.min[2]) {
+    phi += 2.0 * M_PI;
+  }
+  const double pos[3] = { z, r, phi };
+  int index[3];
+  for (int j = 0; j < 3; ++j) {
+    const double* mesh = map.mesh + zone.mesh[j];
+    int i = int((pos[j] - zone.min[j]) * zone.invUnit[j]); // index to LUT
+    i = map.LUT[zone.LUT[j] + i]; // tentative mesh index from LUT
+    i += (pos[j] > mesh[i + 1]);
+    index[j] = i;
+  }
+  const int iz = zone.mesh[0] + index[0];
+  const int ir = zone.mesh[1] + index[1];
+  const int iphi = zone.mesh[2] + index[2];
+  const double zmin = map.mesh[iz];
+  const double rmin = map.mesh[ir];
+  const double phimin = map.mesh[iphi];
+  const double invz = map.invMesh[iz];
+  const double invr = map.invMesh[ir];
+  const double invphi = map.invMesh[iphi];
+  // the field at the 8 corners, in the order of BFieldCache
+  const int roff = zone.roff;
+  const int zoff = zone.zoff;
+  const int im0 = zone.field + index[0] * zoff + index[1] * roff + index[2];
+  const int corner[8] = { im0,
+                          im0 + roff,
+                          im0 + zoff,
+                          im0 + zoff + roff,
+                          im0 + 1,
+                          im0 + roff + 1,
+                          im0 + zoff + 1,
+                          im0 + zoff + roff + 1 };
+  const int16_t* nodes[3] = { map.fieldz, map.fieldr, map.fieldphi };
+  const double sf = map.scale;
+  double field[3][8];
+  for (int j = 0; j < 3; ++j) {
+    for (int k = 0; k < 8; ++k) {
+      field[j][k] = sf * nodes[j][corner[k]];
+    }
+  }
+
+  // the interpolation, as BFieldCache::getB
+  if (phi < phimin) {
+    phi += 2 * M_PI;
+  }
+  // fractional position inside this bin
+  const double fz = (z - zmin) * invz;
+  const double gz = 1.0 - fz;
+  const double fr = (r - rmin) * invr;
+  const double gr = 1.0 - fr;
+  const double fphi = (phi - phimin) * invphi;
+  const double gphi = 1.0 - fphi;
+  const double scale = zone.scale;
+  // interpolate field values in z, r, phi
+  double Bzrphi[3];
+  for (int i = 0; i < 3; ++i) { // z, r, phi components
+    const double* f = field[i];
+    Bzrphi[i] = scale * (gz * (gr * (gphi * f[0] + fphi * f[4]) +
+                               fr * (gphi * f[1] + fphi * f[5])) +
+                         fz * (gr * (gphi * f[2] + fphi * f[6]) +
+                               fr * (gphi * f[3] + fphi * f[7])));
+  }
+  // convert (Bz,Br,Bphi) to (Bx,By,Bz)
+  double rinv;
+  double c;
+  double s;
+  if (r > 0.0) {
+    rinv = 1.0 / r;
+    c = x * rinv;
+    s = y * rinv;
+  } else {
+    rinv = 0.0;
+    c = map.cosMesh[iphi];
+    s = map.sinMesh[iphi];
+  }
+  B[0] = Bzrphi[1] * c - Bzrphi[2] * s;
+  B[1] = Bzrphi[1] * s + Bzrphi[2] * c;
+  B[2] = Bzrphi[0];
+
+  // compute field derivatives if requested
+  if (deriv) {
+    const double sz = scale * invz;
+    const double sr = scale * invr;
+    const double sphi = scale * invphi;
+
+    double dBdz[3];
+    double dBdr[3];
+    double dBdphi[3];
+    for (int j = 0; j < 3; ++j) { // Bz, Br, Bphi components
+      const double* f = field[j];
+      dBdz[j] = sz * (gr * (gphi * (f[2] - f[0]) + fphi * (f[6] - f[4])) +
+                      fr * (gphi * (f[3] - f[1]) + fphi * (f[7] - f[5])));
+      dBdr[j] = sr * (gz * (gphi * (f[1] - f[0]) + fphi * (f[5] - f[4])) +
+                      fz * (gphi * (f[3] - f[2]) + fphi * (f[7] - f[6])));
+      dBdphi[j] = sphi * (gz * (gr * (f[4] - f[0]) + fr * (f[5] - f[1])) +
+                          fz * (gr * (f[6] - f[2]) + fr * (f[7] - f[3])));
+    }
+    // convert to cartesian coordinates
+    const double cc = c * c;
+    const double cs = c * s;
+    const double ss = s * s;
+    const double ccinvr = cc * rinv;
+    const double csinvr = cs * rinv;
+    const double ssinvr = ss * rinv;
+    const double sinvr = s * rinv;
+    const double cinvr = c * rinv;
+    deriv[0] = cc * dBdr[1] - cs * dBdr[2] - csinvr * dBdphi[1] +
+               ssinvr * dBdphi[2] + sinvr * B[1];
+    deriv[1] = cs * dBdr[1] - ss * dBdr[2] + ccinvr * dBdphi[1] -
+               csinvr * dBdphi[2] - cinvr * B[1];
+    deriv[2] = c * dBdz[1] - s * dBdz[2];
+    deriv[3] = cs * dBdr[1] + cc * dBdr[2] - ssinvr * dBdphi[1] -
+               csinvr * dBdphi[2] - sinvr * B[0];
+    deriv[4] = ss * dBdr[1] + cs * dBdr[2] + csinvr * dBdphi[1] +
+               ccinvr * dBdphi[2] + cinvr * B[0];
+    deriv[5] = s * dBdz[1] + c * dBdz[2];
+    deriv[6] = c * dBdr[0] - sinvr * dBdphi[0];
+    deriv[7] = s * dBdr[0] + cinvr * dBdphi[0];
+    deriv[8] = dBdz[0];
+  }
+}
+
+// bfieldFlatGetB for point i of the n points xyz[3 * n], returning
+// B[3 * n], and deriv[9 * n] if given: the body of a batch kernel,
+// one point per device thread, or the loop of bfieldFlatGetBBatch
+BFIELD_HOST_DEVICE inline void
+bfieldFlatGetBPoint(const BFieldFlatMap& map,
+                    const double* xyz,
+                    int64_t i,
+                    double* B,
+                    double* deriv = nullptr)
+{
+  bfieldFlatGetB(
+    map, xyz + 3 * i, B + 3 * i, deriv ? deriv + 9 * i : nullptr);
+}
+
+// bfieldFlatGetB for the n points xyz[3 * n], returning B[3 * n],
+// and deriv[9 * n] if given, one point after the other
+BFIELD_HOST_DEVICE inline void
+bfieldFlatGetBBatch(const BFieldFlatMap& map,
+                    const double* xyz,
+                    int64_t n,
+                    double* B,
+                    double* deriv = nullptr)
+{
+  for (int64_t i = 0; i < n; ++i) {
+    bfieldFlatGetBPoint(map, xyz, i, B, deriv);
+  }
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldFlatBuffers.h"
+#include <cmath>
+
+BFieldFlatBuffers::BFieldFlatBuffers(const BFieldMap& map)
+{
+  zones.resize(map.nzones());
+  // a zone that cannot be filled keeps an empty record, and its cells
+  // are outside the map in zoneLUT, as for BFieldMap::findZone
+  std::vector<bool> filled(map.nzones());
+  for (unsigned i = 0; i < map.nzones(); ++i) {
+    filled[i] = map.m_lazy.ensure(i, map.m_zones[i]);
+    const BFieldZone& zone = map.m_zones[i];
+    BFieldFlatZone& fz = zones[i];
+    if (!filled[i]) {
+      fz = BFieldFlatZone{};
+      for (int j = 0; j < 3; ++j) {
+        fz.min[j] = zone.min(j);
+        fz.max[j] = zone.max(j);
+        fz.mesh[j] = mesh.size();
+        fz.LUT[j] = LUT.size();
+      }
+      fz.scale = zone.bscale();
+      fz.field = fieldz.size();
+      continue;
+    }
+    const BFieldZone::View& view = zone.view();
+    for (int j = 0; j < 3; ++j) {
+      fz.min[j] = zone.min(j);
+      fz.max[j] = zone.max(j);
+      fz.invUnit[j] = view.invUnit[j];
+      fz.mesh[j] = mesh.size();
+      fz.nmesh[j] = view.nmesh[j];
+      for (unsigned k = 0; k < view.nmesh[j]; ++k) {
+        const double edge = view.mesh[j][k];
+        mesh.push_back(edge);
+        // as BFieldMesh::buildPhiTrig, which getCache reads
+        cosMesh.push_back(j == 2 ? cos(edge) : 0.);
+        sinMesh.push_back(j == 2 ? sin(edge) : 0.);
+      }
+      invMesh.insert(
+        invMesh.end(), view.invMesh[j], view.invMesh[j] + view.nmesh[j] - 1);
+      invMesh.push_back(0.);
+      fz.LUT[j] = LUT.size();
+      fz.nLUT[j] = view.nLUT[j];
+      LUT.insert(LUT.end(), view.LUT[j], view.LUT[j] + view.nLUT[j]);
+    }
+    fz.scale = zone.bscale();
+    fz.field = fieldz.size();
+    fz.roff = view.roff;
+    fz.zoff = view.zoff;
+    for (unsigned k = 0; k < view.nfield; ++k) {
+      fieldz.push_back(view.field[k].z());
+      fieldr.push_back(view.field[k].r());
+      fieldphi.push_back(view.field[k].phi());
+    }
+  }
+
+  // the zone look-up table
+  for (int j = 0; j < 3; ++j) {
+    m_map.edge[j] = edges.size();
+    m_map.nedge[j] = map.m_edge[j].size();
+    edges.insert(edges.end(), map.m_edge[j].begin(), map.m_edge[j].end());
+    m_map.edgeLUT[j] = edgeLUTs.size();
+    edgeLUTs.insert(
+      edgeLUTs.end(), map.m_edgeLUT[j].begin(), map.m_edgeLUT[j].end());
+    m_map.edgeInvUnit[j] = map.m_invUnit[j];
+  }
+  zoneLUT.assign(map.m_zoneLUT.begin(), map.m_zoneLUT.end());
+  for (int32_t& izone : zoneLUT) {
+    if (izone >= 0 && !filled[izone]) {
+      izone = -1;
+    }
+  }
+  m_map.roff = map.m_roff;
+  m_map.zoff = map.m_zoff;
+  m_map.scale = map.scale().factor;
+  m_map.nzones = zones.size();
+}
+
+BFieldFlatMap
+BFieldFlatBuffers::view() const
+{
+  BFieldFlatMap flat = m_map;
+  flat.zones = zones.data();
+  flat.mesh = mesh.data();
+  flat.invMesh = invMesh.data();
+  flat.cosMesh = cosMesh.data();
+  flat.sinMesh = sinMesh.data();
+  flat.LUT = LUT.data();
+  flat.fieldz = fieldz.data();
+  flat.fieldr = fieldr.data();
+  flat.fieldphi = fieldphi.data();
+  flat.edges = edges.data();
+  flat.edgeLUTs = edgeLUTs.data();
+  flat.zoneLUT = zoneLUT.data();
+  return flat;
+}
@@ -0,0 +1,51 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldFlatBuffers.h
+//
+// The arrays of a BFieldFlatMap (see BFieldFlat.h), filled from a
+// BFieldMap on the host: the zone records and, concatenated over the
+// zones, the mesh edges, inverse spacings, LUTs and the field as one
+// array of shorts per component, then the zone look-up table of the map.
+// Each array is one contiguous block of plain numbers, to be copied to a
+// device as it is.
+//
+#ifndef BFIELDFLATBUFFERS_H
+#define BFIELDFLATBUFFERS_H
+
+#include "BFieldFlat.h"
+#include "BFieldMap.h"
+#include <vector>
+
+class BFieldFlatBuffers
+{
+public:
+  // export map, whose zone and map LUTs should be built, with its
+  // current scale factor. Zones filled on demand are filled first; those
+  // that cannot be are exported empty and outside the map.
+  explicit BFieldFlatBuffers(const BFieldMap& map);
+
+  // the arrays below, on the host
+  BFieldFlatMap view() const;
+
+  std::vector<BFieldFlatZone> zones;
+  std::vector<double> mesh;
+  std::vector<double> invMesh;
+  std::vector<double> cosMesh;
+  std::vector<double> sinMesh;
+  std::vector<int32_t> LUT;
+  std::vector<int16_t> fieldz;
+  std::vector<int16_t> fieldr;
+  std::vector<int16_t> fieldphi;
+  std::vector<double> edges;
+  std::vector<int32_t> edgeLUTs;
+  std::vector<int32_t> zoneLUT;
+
+private:
+  // the scalars of view()
+  BFieldFlatMap m_map{};
+};
+
+#endif
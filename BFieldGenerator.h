@@ -0,0 +1,202 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldGenerator.h
+//
+// Synthetic toroid-like field maps for tests and benchmarks.
+// The field is smooth, dominated by Bphi ~ 1/r with an 8-fold phi
+// modulation, and stored as short in units of bscale.
+// Also a solenoid-like axially symmetric field, dominated by Bz and
+// stored as double, on a 3d BFieldMesh<double> or a 2d BFieldMeshZR.
+//
+#ifndef BFIELDGENERATOR_H
+#define BFIELDGENERATOR_H
+
+#include "BFieldMap.h"
+#include "BFieldMeshZR.h"
+#include "BFieldZone.h"
+#include <cmath>
+#include <vector>
+
+// fill zone with a nz x nr x nphi mesh, uniformly spaced over its range.
+// The LUT is not built.
+inline void
+generateZoneField(BFieldZone& zone, int nz, int nr, int nphi)
+{
+  const int n[3] = { nz, nr, nphi };
+  std::vector<double> mesh[3];
+  for (int j = 0; j < 3; ++j) {
+    mesh[j].resize(n[j]);
+    for (int i = 0; i < n[j]; ++i) {
+      mesh[j][i] = zone.min(j) + i * (zone.max(j) - zone.min(j)) / (n[j] - 1);
+    }
+  }
+  // field index runs fastest in phi, then r, then z
+  std::vector<BFieldVector<short>> field;
+  field.reserve(nz * nr * nphi);
+  for (int iz = 0; iz < nz; ++iz) {
+    const double z = mesh[0][iz];
+    for (int ir = 0; ir < nr; ++ir) {
+      const double r = mesh[1][ir];
+      const double rnorm = zone.rmin() / r;
+      for (int iphi = 0; iphi < nphi; ++iphi) {
+        const double phi = mesh[2][iphi];
+        const double mod = cos(8 * phi);
+        const double bphi = 20000. * rnorm * (1. + 0.1 * mod);
+        const double br = 1500. * sin(8 * phi) * cos(z * 1e-3);
+        const double bz = 2000. * rnorm * mod * sin(z * 1e-3);
+        field.emplace_back(static_cast<short>(bz),
+                           static_cast<short>(br),
+                           static_cast<short>(bphi));
+      }
+    }
+  }
+  for (int j = 0; j < 3; ++j) {
+    zone.setMesh(j, std::move(mesh[j]));
+  }
+  zone.setField(std::move(field));
+}
+
+// a full phi zone, nz x nr x nphi nodes
+inline BFieldZone
+generateZone(int id,
+             double zmin,
+             double zmax,
+             int nz,
+             double rmin,
+             double rmax,
+             int nr,
+             int nphi,
+             double bscale = 1e-07)
+{
+  BFieldZone zone(id, zmin, zmax, rmin, rmax, 0, 2 * M_PI, bscale);
+  generateZoneField(zone, nz, nr, nphi);
+  return zone;
+}
+
+// a map of nzslice x nrslice x nsector zones covering
+// [-zmax, zmax] x [rmin, rmax] x [-pi/nsector, 2pi - pi/nsector],
+// each zone with nz x nr x nphi nodes. Sector 0 crosses phi = 0.
+// The zone and map LUTs are built.
+inline BFieldMap
+generateMap(int nzslice,
+            int nrslice,
+            int nsector,
+            int nz,
+            int nr,
+            int nphi,
+            double zmax = 12000.,
+            double rmin = 4000.,
+            double rmax = 10000.,
+            bool binMajor = false)
+{
+  BFieldMap map;
+  const double dz = 2 * zmax / nzslice;
+  const double dr = (rmax - rmin) / nrslice;
+  const double dphi = 2 * M_PI / nsector;
+  int id = 0;
+  for (int iz = 0; iz < nzslice; ++iz) {
+    for (int ir = 0; ir < nrslice; ++ir) {
+      for (int iphi = 0; iphi < nsector; ++iphi) {
+        BFieldZone zone(id++,
+                        -zmax + iz * dz,
+                        -zmax + (iz + 1) * dz,
+                        rmin + ir * dr,
+                        rmin + (ir + 1) * dr,
+                        (iphi - 0.5) * dphi,
+                        (iphi + 0.5) * dphi,
+                        1e-07);
+        generateZoneField(zone, nz, nr, nphi);
+        zone.buildLUT(binMajor);
+        map.appendZone(std::move(zone));
+      }
+    }
+  }
+  map.buildLUT();
+  return map;
+}
+
+// (Bz, Br) of the solenoid-like field, in units of bscale = 1e-07
+inline void
+solenoidField(double z, double r, double zmax, double rmax, double B[2])
+{
+  const double zn = z / zmax;
+  const double rn = r / rmax;
+  B[0] = 20000. * (1. - 0.3 * zn * zn) * (1. - 0.05 * rn * rn);
+  B[1] = 6000. * zn * rn;
+}
+
+// a full phi solenoid mesh over [zmin, zmax] x [rmin, rmax],
+// nz x nr x nphi nodes uniformly spaced, with no Bphi.
+// The LUT is built.
+inline BFieldMesh<double>
+generateSolenoid(double zmin,
+                 double zmax,
+                 int nz,
+                 double rmin,
+                 double rmax,
+                 int nr,
+                 int nphi,
+                 double bscale = 1e-07)
+{
+  BFieldMesh<double> mesh(zmin, zmax, rmin, rmax, 0, 2 * M_PI, bscale);
+  const int n[3] = { nz, nr, nphi };
+  for (int j = 0; j < 3; ++j) {
+    std::vector<double> edges(n[j]);
+    for (int i = 0; i < n[j]; ++i) {
+      edges[i] = mesh.min(j) + i * (mesh.max(j) - mesh.min(j)) / (n[j] - 1);
+    }
+    mesh.setMesh(j, std::move(edges));
+  }
+  std::vector<BFieldVector<double>> field;
+  field.reserve(nz * nr * nphi);
+  for (int iz = 0; iz < nz; ++iz) {
+    for (int ir = 0; ir < nr; ++ir) {
+      double B[2];
+      solenoidField(mesh.mesh(0, iz), mesh.mesh(1, ir), zmax, rmax, B);
+      for (int iphi = 0; iphi < nphi; ++iphi) {
+        field.emplace_back(B[0], B[1], 0.);
+      }
+    }
+  }
+  mesh.setField(std::move(field));
+  mesh.buildLUT();
+  return mesh;
+}
+
+// the same field on a 2d mesh of nz x nr nodes. The LUT is built.
+inline BFieldMeshZR
+generateSolenoidZR(double zmin,
+                   double zmax,
+                   int nz,
+                   double rmin,
+                   double rmax,
+                   int nr,
+                   double bscale = 1e-07)
+{
+  BFieldMeshZR mesh(zmin, zmax, rmin, rmax, bscale);
+  const int n[2] = { nz, nr };
+  for (int j = 0; j < 2; ++j) {
+    std::vector<double> edges(n[j]);
+    for (int i = 0; i < n[j]; ++i) {
+      edges[i] = mesh.min(j) + i * (mesh.max(j) - mesh.min(j)) / (n[j] - 1);
+    }
+    mesh.setMesh(j, std::move(edges));
+  }
+  std::vector<BFieldVectorZR> field;
+  field.reserve(nz * nr);
+  for (int iz = 0; iz < nz; ++iz) {
+    for (int ir = 0; ir < nr; ++ir) {
+      double B[2];
+      solenoidField(mesh.mesh(0, iz), mesh.mesh(1, ir), zmax, rmax, B);
+      field.emplace_back(B[0], B[1]);
+    }
+  }
+  mesh.setField(std::move(field));
+  mesh.buildLUT();
+  return mesh;
+}
+
+#endif
@@ -0,0 +1,47 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldISA.h"
+
+// The versions of isaName are resolved with the same cpuid priority
+// as the BFIELD_TARGET_CLONES kernels, so the one chosen names the
+// variant the kernels run. The dispatcher is only generated in a
+// translation unit calling isaName, hence the wrapper below. When the
+// baseline ISA already implies the best version, as with -march=native,
+// the call is resolved at compile time and the others are unused.
+#if BFIELD_ISA_DISPATCH
+namespace {
+__attribute__((target("avx512f"), unused)) const char*
+isaName()
+{
+  return "avx512f";
+}
+
+__attribute__((target("avx2"), unused)) const char*
+isaName()
+{
+  return "avx2";
+}
+
+__attribute__((target("default"), unused)) const char*
+isaName()
+{
+  return "default";
+}
+}
+#else
+namespace {
+const char*
+isaName()
+{
+  return "default";
+}
+}
+#endif
+
+const char*
+BFieldActiveISA()
+{
+  return isaName();
+}
@@ -0,0 +1,35 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldISA.h
+//
+// Runtime selection of the instruction set for the vectorized kernels
+// (getBVec, getBBatch, insideMask, getCacheVec and the fused getB).
+// They are compiled for AVX-512, AVX2 and the SSE2 baseline; the
+// variant matching the CPU is chosen once, when the program is loaded.
+//
+// Define BFIELD_NO_ISA_DISPATCH to build the baseline only.
+//
+#ifndef BFIELDISA_H
+#define BFIELDISA_H
+
+#include "features.h"
+
+#if HAVE_TARGET_CLONES && !defined(BFIELD_NO_ISA_DISPATCH)
+#define BFIELD_ISA_DISPATCH 1
+// flatten, so that the helpers the kernels call are compiled
+// inside each variant rather than once for the baseline
+#define BFIELD_TARGET_CLONES                                                 \
+  __attribute__((target_clones("avx512f", "avx2", "default"), flatten))
+#else
+#define BFIELD_ISA_DISPATCH 0
+#define BFIELD_TARGET_CLONES
+#endif
+
+// name of the variant in use: "avx512f", "avx2" or "default"
+const char*
+BFieldActiveISA();
+
+#endif
@@ -0,0 +1,464 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldMap.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+namespace {
+
+// points per unit of work of getBParallel: enough for points to share
+// bins, small enough to balance the load across threads
+constexpr size_t chunkSize = 2048;
+
+// points sorted together by getBBinned, so that their index in the
+// block fits in the low 16 bits of the sort key
+constexpr int indexBits = 16;
+constexpr size_t blockSize = size_t(1) << indexBits;
+// the bin number of the remaining 48 bits of the key: the zone index,
+// above the index of the bin in its zone. It does not depend on the
+// zones filled on demand meanwhile.
+constexpr int zoneShift = 32;
+
+// bins with fewer points are interpolated point by point
+constexpr size_t minBatch = 4;
+
+// sort the keys, one byte at a time from the least significant, starting
+// at byte first and skipping the bytes common to all keys
+void
+radixSort(std::vector<uint64_t>& keys, int first)
+{
+  if (keys.empty()) {
+    return;
+  }
+  size_t count[8][256] = {};
+  for (const uint64_t key : keys) {
+    for (int b = first; b < 8; ++b) {
+      ++count[b][(key >> (8 * b)) & 0xff];
+    }
+  }
+  std::vector<uint64_t> sorted(keys.size());
+  for (int b = first; b < 8; ++b) {
+    const int shift = 8 * b;
+    if (count[b][(keys[0] >> shift) & 0xff] == keys.size()) {
+      continue;
+    }
+    size_t offset = 0;
+    for (size_t& c : count[b]) {
+      const size_t nc = c;
+      c = offset;
+      offset += nc;
+    }
+    for (const uint64_t key : keys) {
+      sorted[count[b][(key >> shift) & 0xff]++] = key;
+    }
+    keys.swap(sorted);
+  }
+}
+
+} // namespace
+
+//
+// Construct the look-up tables of the zone edges and of the cells
+//
+void
+BFieldMap::buildLUT()
+{
+  for (int j = 0; j < 3; ++j) {
+    m_edge[j].clear();
+    m_edgeLUT[j].clear();
+  }
+  // collect the zone edges, phi folded into [0, 2pi]
+  m_edge[2].push_back(0.);
+  m_edge[2].push_back(2 * M_PI);
+  for (const BFieldZone& zone : m_zones) {
+    for (int j = 0; j < 2; ++j) {
+      m_edge[j].push_back(zone.min(j));
+      m_edge[j].push_back(zone.max(j));
+    }
+    const double phimin = zone.phimin() < 0 ? zone.phimin() + 2 * M_PI
+                                            : zone.phimin();
+    m_edge[2].push_back(phimin);
+    m_edge[2].push_back(zone.phimax());
+  }
+  for (int j = 0; j < 3; ++j) {
+    std::vector<double>& edge = m_edge[j];
+    std::sort(edge.begin(), edge.end());
+    edge.erase(std::unique(edge.begin(), edge.end()), edge.end());
+    // determine the unit size, q, to be used in the LUTs
+    const double width = edge.back() - edge.front();
+    double q(width);
+    for (unsigned i = 0; i < edge.size() - 1; ++i) {
+      q = std::min(q, edge[i + 1] - edge[i]);
+    }
+    // find the number of units in the LUT
+    int n = int(width / q) + 1;
+    q = width / (n + 0.5);
+    m_invUnit[j] = 1.0 / q; // new unit size
+    ++n;
+    int m = 0;                    // edge number
+    for (int i = 0; i < n; ++i) { // LUT index
+      if (i * q + edge.front() > edge[m + 1]) {
+        m++;
+      }
+      m_edgeLUT[j].push_back(m);
+    }
+  }
+  // assign a zone to each cell, by testing its centre
+  const int nz = m_edge[0].size() - 1;
+  const int nr = m_edge[1].size() - 1;
+  const int nphi = m_edge[2].size() - 1;
+  m_roff = nphi;
+  m_zoff = nr * nphi;
+  m_zoneLUT.assign(nz * nr * nphi, -1);
+  for (int iz = 0; iz < nz; ++iz) {
+    const double z = 0.5 * (m_edge[0][iz] + m_edge[0][iz + 1]);
+    for (int ir = 0; ir < nr; ++ir) {
+      const double r = 0.5 * (m_edge[1][ir] + m_edge[1][ir + 1]);
+      for (int iphi = 0; iphi < nphi; ++iphi) {
+        double phi = 0.5 * (m_edge[2][iphi] + m_edge[2][iphi + 1]);
+        // BFieldMesh::inside expects phi in [-pi, pi]
+        if (phi > M_PI) {
+          phi -= 2 * M_PI;
+        }
+        for (unsigned i = 0; i < m_zones.size(); ++i) {
+          if (m_zones[i].inside(z, r, phi)) {
+            m_zoneLUT[iz * m_zoff + ir * m_roff + iphi] = i;
+            break;
+          }
+        }
+      }
+    }
+  }
+}
+
+int
+BFieldMap::findCell(double z, double r, double phi) const
+{
+  const double pos[3] = { z, r, phi };
+  int index[3];
+  for (int j = 0; j < 3; ++j) {
+    const std::vector<double>& edge = m_edge[j];
+    if (!(pos[j] >= edge.front() && pos[j] <= edge.back())) {
+      return -1;
+    }
+    int i = int((pos[j] - edge.front()) * m_invUnit[j]); // index to LUT
+    i = m_edgeLUT[j][i]; // tentative edge index from LUT
+    if (pos[j] > edge[i + 1]) {
+      ++i;
+    }
+    index[j] = i;
+  }
+  return index[0] * m_zoff + index[1] * m_roff + index[2];
+}
+
+const BFieldZone*
+BFieldMap::findZone(double z, double r, double phi) const
+{
+  if (phi < 0) {
+    phi += 2 * M_PI;
+  }
+  const int cell = findCell(z, r, phi);
+  if (cell < 0) {
+    return nullptr;
+  }
+  const int izone = m_zoneLUT[cell];
+  if (izone < 0 || !m_lazy.ensure(izone, m_zones[izone])) {
+    return nullptr;
+  }
+  return &m_zones[izone];
+}
+
+void
+BFieldMap::getB(const double* ATH_RESTRICT xyz,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv) const
+{
+  const double x = xyz[0];
+  const double y = xyz[1];
+  const double z = xyz[2];
+  const double r = std::sqrt(x * x + y * y);
+  const double phi = std::atan2(y, x);
+  const BFieldZone* zone = findZone(z, r, phi);
+  if (!zone) {
+    // outside the map
+    std::fill(B, B + 3, 0.);
+    if (deriv) {
+      std::fill(deriv, deriv + 9, 0.);
+    }
+    return;
+  }
+  zone->getB(xyz, r, phi, B, deriv, scale().factor);
+}
+
+bool
+BFieldMap::getCache(double z,
+                    double r,
+                    double phi,
+                    BFieldCache& cache,
+                    double scaleFactor) const
+{
+  const BFieldZone* zone = findZone(z, r, phi);
+  if (!zone) {
+    cache.invalidate();
+    return false;
+  }
+  zone->getCacheVec(z, r, phi, cache, scaleFactor * scale().factor);
+  return true;
+}
+
+bool
+BFieldMap::getCache(double z,
+                    double r,
+                    double phi,
+                    BFieldCacheCubic& cache,
+                    double scaleFactor) const
+{
+  const BFieldZone* zone = findZone(z, r, phi);
+  if (!zone) {
+    cache.invalidate();
+    return false;
+  }
+  zone->getCache(z, r, phi, cache, scaleFactor * scale().factor);
+  return true;
+}
+
+void
+BFieldMap::getBBinned(const double* ATH_RESTRICT xyz,
+                      size_t n,
+                      double* ATH_RESTRICT B,
+                      double* ATH_RESTRICT deriv) const
+{
+  getBBinned(xyz, n, B, deriv, scale().factor);
+}
+
+//
+// Evaluate a batch of points bin by bin, in blocks of up to blockSize
+// points. The points of a block inside the map are sorted by bin, with
+// a radix sort of (bin << indexBits | index in the block), the bins
+// numbered by zone and by index in the zone. Then for each run of points
+// in the same bin the cache is filled once, the points are gathered in
+// structure-of-arrays form for getBBatch, and the results scattered
+// back to the original order.
+//
+void
+BFieldMap::getBBinned(const double* ATH_RESTRICT xyz,
+                      size_t n,
+                      double* ATH_RESTRICT B,
+                      double* ATH_RESTRICT deriv,
+                      double factor) const
+{
+  std::vector<double> r(std::min(n, blockSize));
+  std::vector<double> phi(r.size());
+  std::vector<uint64_t> keys;
+  keys.reserve(r.size());
+  BFieldCache cache;
+  // x, y, z, r, phi, Bx, By, Bz and deriv of the points of one bin
+  std::vector<double> soa;
+  for (size_t block = 0; block < n; block += blockSize) {
+    const size_t nblock = std::min(blockSize, n - block);
+    const double* bxyz = xyz + 3 * block;
+    double* bB = B + 3 * block;
+    double* bD = deriv ? deriv + 9 * block : nullptr;
+
+    keys.clear();
+    for (size_t i = 0; i < nblock; ++i) {
+      const double x = bxyz[3 * i];
+      const double y = bxyz[3 * i + 1];
+      const double z = bxyz[3 * i + 2];
+      r[i] = std::sqrt(x * x + y * y);
+      phi[i] = std::atan2(y, x);
+      const BFieldZone* zone = findZone(z, r[i], phi[i]);
+      if (!zone) {
+        // outside the map
+        std::fill(bB + 3 * i, bB + 3 * i + 3, 0.);
+        if (bD) {
+          std::fill(bD + 9 * i, bD + 9 * i + 9, 0.);
+        }
+        continue;
+      }
+      const uint64_t bin = uint64_t(zone - m_zones.data()) << zoneShift |
+                           zone->binIndex(z, r[i], phi[i]);
+      keys.push_back(bin << indexBits | i);
+    }
+    radixSort(keys, indexBits / 8);
+
+    for (size_t begin = 0; begin < keys.size();) {
+      const uint64_t bin = keys[begin] >> indexBits;
+      size_t end = begin + 1;
+      while (end < keys.size() && (keys[end] >> indexBits) == bin) {
+        ++end;
+      }
+      const size_t m = end - begin;
+      auto index = [&keys, begin](size_t k) {
+        return keys[begin + k] & (blockSize - 1);
+      };
+      const size_t first = index(0);
+      m_zones[bin >> zoneShift].getCacheVec(
+        bxyz[3 * first + 2], r[first], phi[first], cache, factor);
+      if (m < minBatch) {
+        for (size_t k = 0; k < m; ++k) {
+          const size_t i = index(k);
+          cache.getBVec(bxyz + 3 * i,
+                        r[i],
+                        phi[i],
+                        bB + 3 * i,
+                        bD ? bD + 9 * i : nullptr);
+        }
+        begin = end;
+        continue;
+      }
+      soa.resize(std::max(soa.size(), 17 * m));
+      double* sx = soa.data();
+      double* sy = sx + m;
+      double* sz = sy + m;
+      double* sr = sz + m;
+      double* sphi = sr + m;
+      double* sBx = sphi + m;
+      double* sBy = sBx + m;
+      double* sBz = sBy + m;
+      double* sD = bD ? sBz + m : nullptr;
+      for (size_t k = 0; k < m; ++k) {
+        const size_t i = index(k);
+        sx[k] = bxyz[3 * i];
+        sy[k] = bxyz[3 * i + 1];
+        sz[k] = bxyz[3 * i + 2];
+        sr[k] = r[i];
+        sphi[k] = phi[i];
+      }
+      cache.getBBatch(sx, sy, sz, sr, sphi, m, sBx, sBy, sBz, sD);
+      for (size_t k = 0; k < m; ++k) {
+        const size_t i = index(k);
+        bB[3 * i] = sBx[k];
+        bB[3 * i + 1] = sBy[k];
+        bB[3 * i + 2] = sBz[k];
+        if (sD) {
+          for (int j = 0; j < 9; ++j) {
+            bD[9 * i + j] = sD[j * m + k];
+          }
+        }
+      }
+      begin = end;
+    }
+  }
+}
+
+//
+// Evaluate a batch of points on several threads. The batch is cut into
+// chunks, which the threads claim in turn from a shared counter until
+// none is left, so that a thread slowed down by cache misses simply
+// takes fewer chunks. Each chunk is evaluated by getBBinned, all with
+// the scale factor of the start of the call.
+//
+void
+BFieldMap::getBParallel(const double* ATH_RESTRICT xyz,
+                        size_t n,
+                        double* ATH_RESTRICT B,
+                        unsigned nthreads,
+                        double* ATH_RESTRICT deriv) const
+{
+  const size_t nchunks = (n + chunkSize - 1) / chunkSize;
+  if (nthreads == 0) {
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nthreads = std::min<size_t>(nthreads, nchunks);
+
+  const double factor = scale().factor;
+  std::atomic<size_t> nextChunk{ 0 };
+  auto work = [&]() {
+    for (size_t chunk = nextChunk++; chunk < nchunks; chunk = nextChunk++) {
+      const size_t begin = chunk * chunkSize;
+      getBBinned(xyz + 3 * begin,
+                 std::min(chunkSize, n - begin),
+                 B + 3 * begin,
+                 deriv ? deriv + 9 * begin : nullptr,
+                 factor);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads);
+  for (unsigned i = 1; i < nthreads; ++i) {
+    try {
+      threads.emplace_back(work);
+    } catch (const std::system_error&) {
+      // the threads already running, and this one, do all the work
+      break;
+    }
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+void
+BFieldMap::prefetch(double z, double r, double phi) const
+{
+  const BFieldZone* zone = findZone(z, r, phi);
+  if (zone) {
+    zone->prefetch(z, r, phi);
+  }
+}
+
+BFieldMap
+BFieldMap::reduced(double tolerance) const
+{
+  BFieldMap map;
+  for (size_t i = 0; i < m_zones.size(); ++i) {
+    if (m_lazy.ensure(i, m_zones[i])) {
+      map.appendZone(m_zones[i].reduced(tolerance));
+    }
+  }
+  map.buildLUT();
+  return map;
+}
+
+//
+// One arena for all the zones, rather than one each: a zone is much
+// smaller than a huge page
+//
+bool
+BFieldMap::packArena(const BFieldArenaOptions& options)
+{
+  std::vector<size_t> offset(m_zones.size() + 1, 0);
+  std::vector<bool> filled(m_zones.size());
+  for (size_t i = 0; i < m_zones.size(); ++i) {
+    filled[i] = m_lazy.ensure(i, m_zones[i]);
+    offset[i + 1] = offset[i] + (filled[i] ? m_zones[i].arenaSize() : 0);
+  }
+  std::shared_ptr<BFieldArena> arena =
+    BFieldArena::create(offset.back(), options);
+  if (!arena) {
+    return false;
+  }
+  for (size_t i = 0; i < m_zones.size(); ++i) {
+    if (filled[i]) {
+      m_zones[i].packArena(arena->data() + offset[i], arena);
+    }
+  }
+  return true;
+}
+
+int
+BFieldMap::memSize() const
+{
+  int size = 0;
+  // a zone being filled by a look-up is not read until published
+  for (size_t i = 0; i < m_zones.size(); ++i) {
+    if (m_lazy.filled(i)) {
+      size += m_zones[i].memSize();
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    size += sizeof(double) * m_edge[i].capacity();
+    size += sizeof(int) * m_edgeLUT[i].capacity();
+  }
+  size += sizeof(int) * m_zoneLUT.capacity();
+  return size;
+}
@@ -0,0 +1,166 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldMap.h
+//
+// The whole field map: owns all the BFieldZones and a coarse z/r/phi
+// look-up table that maps a point to its zone in O(1).
+//
+// The look-up cells are formed by all the zone edges along z, r and phi,
+// so that every cell is either fully inside one zone or outside all of
+// them. The cell containing a point is found with the same LUT technique
+// as in BFieldMesh.
+//
+// Once buildLUT has been called the map must not be modified, except for
+// its scale factor (setScale); all the look-up methods are const and can
+// then be used concurrently, also with setScale.
+//
+// The zones may also be filled on demand (setLoader): they are then
+// appended with their ranges only, and each one is filled by the first
+// look-up reaching it, from any thread.
+//
+#ifndef BFIELDMAP_H
+#define BFIELDMAP_H
+
+#include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldScale.h"
+#include "BFieldZone.h"
+#include "BFieldZoneLoader.h"
+#include <array>
+#include <vector>
+
+class BFieldMap
+{
+public:
+  BFieldMap() = default;
+  // add a zone. Its LUT should be built already.
+  void appendZone(const BFieldZone& zone) { m_zones.push_back(zone); }
+  void appendZone(BFieldZone&& zone) { m_zones.push_back(std::move(zone)); }
+  // build the zone look-up table, once all zones have been added
+  void buildLUT();
+  // fill the zones, appended with their ranges and bscale only, with
+  // loader on demand: zone i by loader->load(i, zone) on the first
+  // look-up reaching it. A zone that cannot be filled is left out of
+  // the map, as outside it. Call once all zones have been added.
+  void setLoader(std::shared_ptr<const BFieldZoneLoader> loader)
+  {
+    m_lazy = BFieldLazyZones(std::move(loader), m_zones.size());
+  }
+  // move the mesh edges, look-up tables and field of all the zones to
+  // one BFieldArena, filled by this thread, zone after zone (see
+  // BFieldMesh::packArena), before the map is shared. The zone LUTs
+  // should be built. Returns false, leaving the zones unchanged, if the
+  // arena cannot be mapped.
+  bool packArena(const BFieldArenaOptions& options = BFieldArenaOptions());
+  // this map with all its zones reduced to fewer mesh planes, within
+  // tolerance (in kT, before the scale factor of the map) at all their
+  // nodes, see BFieldMesh::reduce.
+  // The LUT of this map should be built; that of the result is.
+  BFieldMap reduced(double tolerance) const;
+  // find the zone containing (z, r, phi), nullptr if outside the map.
+  // phi is expected in [-pi, pi].
+  const BFieldZone* findZone(double z, double r, double phi) const;
+  // interpolate the field at xyz and return B[3], zero outside the map.
+  // also compute field derivatives if deriv[9] is given.
+  void getB(const double* ATH_RESTRICT xyz,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr) const;
+  // fill the cache of the bin containing (z, r, phi).
+  // returns false, with an invalid cache, if outside the map.
+  bool getCache(double z,
+                double r,
+                double phi,
+                BFieldCache& cache,
+                double scaleFactor = 1.0) const;
+  // as getCache, for the tricubic cache
+  bool getCache(double z,
+                double r,
+                double phi,
+                BFieldCacheCubic& cache,
+                double scaleFactor = 1.0) const;
+  // interpolate the field at the n points xyz[3 * n] and return
+  // B[3 * n], zero outside the map, using nthreads threads
+  // (the hardware concurrency if 0), the caller being one of them.
+  // also compute field derivatives if deriv[9 * n] is given.
+  void getBParallel(const double* ATH_RESTRICT xyz,
+                    size_t n,
+                    double* ATH_RESTRICT B,
+                    unsigned nthreads = 0,
+                    double* ATH_RESTRICT deriv = nullptr) const;
+  // as getB for the n points xyz[3 * n], returning B[3 * n], with the
+  // points grouped by bin first: each bin is loaded in a BFieldCache
+  // once, and its points are interpolated together by getBBatch.
+  // also compute field derivatives if deriv[9 * n] is given.
+  void getBBinned(const double* ATH_RESTRICT xyz,
+                  size_t n,
+                  double* ATH_RESTRICT B,
+                  double* ATH_RESTRICT deriv = nullptr) const;
+  // prefetch the field of the bin containing (z, r, phi), if any.
+  // phi is expected in [-pi, pi].
+  void prefetch(double z, double r, double phi) const;
+  // apply factor to the nominal field of all the zones, e.g. after a
+  // change of current, from now on. Safe while other threads do look-ups,
+  // which see either factor or the previous one, see BFieldScale.
+  // All the look-ups of the map apply it, on top of their scaleFactor.
+  void setScale(double factor) { m_scale.set(factor); }
+  // free the replaced scale snapshots, once no look-up can be in flight
+  void reclaimScales() { m_scale.reclaim(); }
+  // the current scale factor and its generation
+  const BFieldScaleSnapshot& scale() const { return m_scale.current(); }
+  // fill zone i if filled on demand, unless done already, and return
+  // false if it cannot be filled. Always true otherwise.
+  bool loadZone(size_t i) const { return m_lazy.ensure(i, m_zones[i]); }
+  // accessors. zone(i) fills zone i if filled on demand; a zone that
+  // cannot be filled (see loadZone) keeps its ranges and bscale only,
+  // with an empty view()
+  unsigned nzones() const { return m_zones.size(); }
+  const BFieldZone& zone(size_t i) const
+  {
+    loadZone(i);
+    return m_zones[i];
+  }
+  // the zones filled so far, all of them unless filled on demand,
+  // and those that could not be filled
+  unsigned nloaded() const
+  {
+    return m_lazy.lazy() ? m_lazy.nloaded() : m_zones.size();
+  }
+  unsigned nfailed() const { return m_lazy.nfailed(); }
+  // memory owned, by the zones filled so far. Safe during look-ups,
+  // which may be filling other zones meanwhile.
+  int memSize() const;
+
+private:
+  // exports the zone look-up table
+  friend class BFieldFlatBuffers;
+
+  // getBBinned with the field multiplied by factor
+  void getBBinned(const double* ATH_RESTRICT xyz,
+                  size_t n,
+                  double* ATH_RESTRICT B,
+                  double* ATH_RESTRICT deriv,
+                  double factor) const;
+  // index of the zone look-up cell containing (z, r, phi), -1 if outside.
+  // phi is expected in [0, 2pi].
+  int findCell(double z, double r, double phi) const;
+
+  // filled on demand by const look-ups, if m_lazy has a loader
+  mutable std::vector<BFieldZone> m_zones;
+  BFieldLazyZones m_lazy;
+  // zone edges along z, r, phi (phi in [0, 2pi])
+  std::array<std::vector<double>, 3> m_edge;
+  // look-up table of the edges and related variables
+  std::array<std::vector<int>, 3> m_edgeLUT;
+  std::array<double, 3> m_invUnit; // inverse unit size in the edge LUT
+  // zone index for each cell, -1 if not covered by any zone
+  std::vector<int> m_zoneLUT;
+  int m_roff = 0;
+  int m_zoff = 0;
+  // the current-dependent scale factor
+  BFieldScale m_scale;
+};
+
+#endif
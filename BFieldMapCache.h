@@ -0,0 +1,81 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldMapCache.h
+//
+// Per-thread (caller owned) context for field look-ups in a BFieldMap.
+// Keeps the BFieldCache of the last bin used: a point inside it is
+// interpolated directly, and only on a miss is the bin looked up in
+// the map and the cache refilled.
+//
+// The BFieldMap is shared and only read, so it must not be modified
+// once its LUT is built, except for its scale factor: the cache keeps
+// the generation of the BFieldMap::scale() it was filled with, and is
+// refilled once the map has published a new one. Each thread should own
+// its BFieldMapCache: there are no locks on the look-up path, only the
+// acquire load of the map scale.
+//
+#ifndef BFIELDMAPCACHE_H
+#define BFIELDMAPCACHE_H
+
+#include "BFieldCache.h"
+#include "BFieldMap.h"
+
+class BFieldMapCache
+{
+public:
+  BFieldMapCache() = default;
+  // if countHits, the number of cache hits and misses is recorded
+  explicit BFieldMapCache(const BFieldMap* map, bool countHits = false)
+    : m_map(map)
+    , m_count(countHits)
+  {}
+  // change the map, invalidating the cache
+  void setMap(const BFieldMap* map);
+  // return the field B[3] at xyz, zero outside the map.
+  // also compute field derivatives if deriv[9] is given.
+  void getField(const double* ATH_RESTRICT xyz,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv = nullptr);
+  // return the field at the 4 stage points of a Runge-Kutta-Nystrom step
+  // of length h (mm) from state (x, y, z, tx, ty, tz), t the unit
+  // direction, for q/p qop (1/GeV): x, x + h/2 t + h^2/8 A twice (the
+  // 2nd and 3rd stages share their point), and x + h t + h^2/2 A, with
+  // A = 0.299792458 qop t x Bstart the bending in the field Bstart[3]
+  // (kT) given for the start, e.g. the last stage of the previous step.
+  // B[3 * i + j] is component j of stage i, and derivatives are computed
+  // if deriv[36] is given, deriv[9 * i + j] as in getField.
+  // The point shared by the 2nd and 3rd stages is interpolated once.
+  void getFieldStages(const double* ATH_RESTRICT state,
+                      double qop,
+                      double h,
+                      const double* ATH_RESTRICT Bstart,
+                      double* ATH_RESTRICT B,
+                      double* ATH_RESTRICT deriv = nullptr);
+  // prefetch the field at xyz, typically the next step of a track,
+  // unless it is inside the cached bin
+  void prefetch(const double* xyz) const;
+  // hit/miss counters, zero unless counting was requested
+  unsigned long long hits() const { return m_hits; }
+  unsigned long long misses() const { return m_misses; }
+  void resetCounters()
+  {
+    m_hits = 0;
+    m_misses = 0;
+  }
+
+private:
+  const BFieldMap* m_map = nullptr;
+  BFieldCache m_cache;
+  // generation of the map scale m_cache was filled with
+  uint64_t m_generation = 0;
+  unsigned long long m_hits = 0;
+  unsigned long long m_misses = 0;
+  // 1 if counting, 0 otherwise, so that counting does not branch
+  unsigned m_count = 0;
+};
+
+#include "BFieldMapCache.icc"
+#endif
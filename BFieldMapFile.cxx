@@ -0,0 +1,402 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldMapFile.h"
+#include "BFieldArena.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t alignment = 64;
+const char magicString[8] = { 'B', 'F', 'I', 'E', 'L', 'D', 'M', 'P' };
+
+uint64_t
+alignUp(uint64_t offset)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+// a read-only file mapping, unmapped with its last user
+struct Mapping
+{
+  void* addr;
+  size_t size;
+  Mapping(void* a, size_t s)
+    : addr(a)
+    , size(s)
+  {}
+  Mapping(const Mapping&) = delete;
+  Mapping& operator=(const Mapping&) = delete;
+  ~Mapping() { munmap(addr, size); }
+};
+
+// true if the n elements of size elsize at offset fit in the file, aligned
+bool
+validArray(uint64_t offset, uint64_t n, uint64_t elsize, uint64_t fileSize)
+{
+  return offset % alignment == 0 && offset <= fileSize &&
+         n <= (fileSize - offset) / elsize;
+}
+
+// true if the zone record is consistent and its arrays inside the file
+bool
+validZone(const BFieldFileZone& fz, uint64_t fileSize)
+{
+  uint64_t nnodes = 1;
+  uint64_t nbins = 1;
+  for (int j = 0; j < 3; ++j) {
+    // the LUT index of any point inside the zone must be in the LUT
+    if (fz.nmesh[j] < 2 || fz.nLUT[j] == 0 ||
+        !((fz.max[j] - fz.min[j]) * fz.invUnit[j] < fz.nLUT[j]) ||
+        !validArray(fz.mesh[j], fz.nmesh[j], sizeof(double), fileSize) ||
+        !validArray(fz.LUT[j], fz.nLUT[j], sizeof(int), fileSize) ||
+        !validArray(fz.invMesh[j], fz.nmesh[j] - 1, sizeof(double), fileSize)) {
+      return false;
+    }
+    nnodes *= fz.nmesh[j];
+    nbins *= fz.nmesh[j] - 1;
+  }
+  if (fz.nfield != nnodes || fz.roff != int64_t(fz.nmesh[2]) ||
+      fz.zoff != int64_t(fz.nmesh[1]) * fz.nmesh[2] ||
+      !validArray(fz.field, fz.nfield, sizeof(BFieldVector<short>), fileSize)) {
+    return false;
+  }
+  if (fz.nbin == 0) {
+    return fz.binField == 0;
+  }
+  return fz.nbin == nbins && fz.binRoff == int64_t(fz.nmesh[2] - 1) &&
+         fz.binZoff == int64_t(fz.nmesh[1] - 1) * (fz.nmesh[2] - 1) &&
+         validArray(
+           fz.binField, fz.nbin, sizeof(BFieldZone::BinField), fileSize);
+}
+
+// true if every LUT entry of the view of a valid zone is the index of a bin
+bool
+validLUTs(const BFieldZone::View& view)
+{
+  for (int j = 0; j < 3; ++j) {
+    for (unsigned i = 0; i < view.nLUT[j]; ++i) {
+      const int bin = view.LUT[j][i];
+      if (bin < 0 || unsigned(bin) > view.nmesh[j] - 2) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// the view of the arrays of fz, with the bytes of the file from offset
+// begin on at base
+BFieldZone::View
+zoneView(const BFieldFileZone& fz, const char* base, uint64_t begin)
+{
+  base -= begin;
+  BFieldZone::View view;
+  for (int j = 0; j < 3; ++j) {
+    view.mesh[j] = reinterpret_cast<const double*>(base + fz.mesh[j]);
+    view.nmesh[j] = fz.nmesh[j];
+    view.LUT[j] = reinterpret_cast<const int*>(base + fz.LUT[j]);
+    view.nLUT[j] = fz.nLUT[j];
+    view.invMesh[j] = reinterpret_cast<const double*>(base + fz.invMesh[j]);
+    view.invUnit[j] = fz.invUnit[j];
+  }
+  view.field = reinterpret_cast<const BFieldVector<short>*>(base + fz.field);
+  view.nfield = fz.nfield;
+  view.binField =
+    fz.nbin ? reinterpret_cast<const BFieldZone::BinField*>(base + fz.binField)
+            : nullptr;
+  view.nbin = fz.nbin;
+  view.roff = fz.roff;
+  view.zoff = fz.zoff;
+  view.binRoff = fz.binRoff;
+  view.binZoff = fz.binZoff;
+  return view;
+}
+
+// the zone of fz, with its ranges and bscale and no data yet
+BFieldZone
+emptyZone(const BFieldFileZone& fz)
+{
+  return BFieldZone(fz.id,
+                    fz.min[0],
+                    fz.max[0],
+                    fz.min[1],
+                    fz.max[1],
+                    fz.min[2],
+                    fz.max[2],
+                    fz.scale);
+}
+
+// true if the header is that of a file of fileSize bytes in the
+// current version and format
+bool
+validHeader(const BFieldFileHeader& header, uint64_t fileSize)
+{
+  return std::memcmp(header.magic, magicString, sizeof(header.magic)) == 0 &&
+         header.version == BFieldFileHeader::currentVersion &&
+         header.byteOrder == BFieldFileHeader::byteOrderMark &&
+         header.fieldSize == sizeof(BFieldVector<short>) &&
+         header.binSize == sizeof(BFieldZone::BinField) &&
+         header.zoneSize == sizeof(BFieldFileZone) &&
+         header.fileSize == fileSize &&
+         header.nzones <=
+           (fileSize - sizeof(header)) / sizeof(BFieldFileZone);
+}
+
+// read size bytes at offset of the file, resuming after interruptions
+// and short reads. Returns false on an error or at the end of the file.
+bool
+readAt(int fd, void* data, size_t size, uint64_t offset)
+{
+  char* dest = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t n = pread(fd, dest, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    dest += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// fills the zones of openBFieldMap, each from its own bytes of the file,
+// read into an arena block. The file stays open as long as the loader.
+class FileZoneLoader : public BFieldZoneLoader
+{
+public:
+  FileZoneLoader(int fd, std::vector<BFieldFileZone> zones)
+    : m_fd(fd)
+    , m_zones(std::move(zones))
+  {}
+  FileZoneLoader(const FileZoneLoader&) = delete;
+  FileZoneLoader& operator=(const FileZoneLoader&) = delete;
+  ~FileZoneLoader() override { close(m_fd); }
+
+  bool load(size_t i, BFieldZone& zone) const override
+  {
+    const BFieldFileZone& fz = m_zones[i];
+    // the arrays of a zone are contiguous in the file, in the order
+    // written, but take their extent from the record anyway
+    uint64_t begin = fz.field;
+    uint64_t end = fz.field + sizeof(BFieldVector<short>) * fz.nfield;
+    auto extend = [&begin, &end](uint64_t offset, uint64_t size) {
+      begin = std::min(begin, offset);
+      end = std::max(end, offset + size);
+    };
+    for (int j = 0; j < 3; ++j) {
+      extend(fz.mesh[j], sizeof(double) * fz.nmesh[j]);
+      extend(fz.LUT[j], sizeof(int) * fz.nLUT[j]);
+      extend(fz.invMesh[j], sizeof(double) * (fz.nmesh[j] - 1));
+    }
+    if (fz.nbin) {
+      extend(fz.binField, sizeof(BFieldZone::BinField) * fz.nbin);
+    }
+    auto arena = BFieldArena::create(end - begin);
+    if (!arena || !readAt(m_fd, arena->data(), end - begin, begin)) {
+      return false;
+    }
+    const BFieldZone::View view = zoneView(fz, arena->data(), begin);
+    if (!validLUTs(view)) {
+      return false;
+    }
+    zone.setView(view, std::move(arena));
+    return true;
+  }
+
+private:
+  int m_fd;
+  std::vector<BFieldFileZone> m_zones;
+};
+
+} // namespace
+
+bool
+writeBFieldMap(const BFieldMap& map, const std::string& path)
+{
+  // the zones filled on demand are all needed
+  for (unsigned i = 0; i < map.nzones(); ++i) {
+    if (!map.loadZone(i)) {
+      return false;
+    }
+  }
+  // lay out the zone records and their arrays
+  BFieldFileHeader header;
+  std::memcpy(header.magic, magicString, sizeof(header.magic));
+  header.version = BFieldFileHeader::currentVersion;
+  header.byteOrder = BFieldFileHeader::byteOrderMark;
+  header.fieldSize = sizeof(BFieldVector<short>);
+  header.binSize = sizeof(BFieldZone::BinField);
+  header.zoneSize = sizeof(BFieldFileZone);
+  header.nzones = map.nzones();
+  uint64_t offset =
+    alignUp(sizeof(BFieldFileHeader) + map.nzones() * sizeof(BFieldFileZone));
+  std::vector<BFieldFileZone> zones(map.nzones());
+  for (unsigned i = 0; i < map.nzones(); ++i) {
+    const BFieldZone& zone = map.zone(i);
+    const BFieldZone::View& view = zone.view();
+    BFieldFileZone& fz = zones[i];
+    std::memset(&fz, 0, sizeof(fz));
+    fz.id = zone.id();
+    fz.roff = view.roff;
+    fz.zoff = view.zoff;
+    fz.binRoff = view.binRoff;
+    fz.binZoff = view.binZoff;
+    fz.nfield = view.nfield;
+    fz.nbin = view.nbin;
+    fz.scale = zone.nomScale();
+    for (int j = 0; j < 3; ++j) {
+      fz.nmesh[j] = view.nmesh[j];
+      fz.nLUT[j] = view.nLUT[j];
+      fz.min[j] = zone.min(j);
+      fz.max[j] = zone.max(j);
+      fz.invUnit[j] = view.invUnit[j];
+    }
+    for (int j = 0; j < 3; ++j) {
+      fz.mesh[j] = offset;
+      offset = alignUp(offset + sizeof(double) * fz.nmesh[j]);
+      fz.LUT[j] = offset;
+      offset = alignUp(offset + sizeof(int) * fz.nLUT[j]);
+      fz.invMesh[j] = offset;
+      offset = alignUp(offset + sizeof(double) * (fz.nmesh[j] - 1));
+    }
+    fz.field = offset;
+    offset = alignUp(offset + sizeof(BFieldVector<short>) * fz.nfield);
+    if (fz.nbin) {
+      fz.binField = offset;
+      offset = alignUp(offset + sizeof(BFieldZone::BinField) * fz.nbin);
+    }
+  }
+  header.fileSize = offset;
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+  uint64_t pos = 0;
+  auto write = [&out, &pos](uint64_t at, const void* data, uint64_t size) {
+    static const char zeros[alignment] = {};
+    // pad up to the aligned offset
+    out.write(zeros, at - pos);
+    out.write(static_cast<const char*>(data), size);
+    pos = at + size;
+  };
+  write(0, &header, sizeof(header));
+  write(pos, zones.data(), sizeof(BFieldFileZone) * zones.size());
+  for (unsigned i = 0; i < map.nzones(); ++i) {
+    const BFieldZone::View& view = map.zone(i).view();
+    const BFieldFileZone& fz = zones[i];
+    for (int j = 0; j < 3; ++j) {
+      write(fz.mesh[j], view.mesh[j], sizeof(double) * fz.nmesh[j]);
+      write(fz.LUT[j], view.LUT[j], sizeof(int) * fz.nLUT[j]);
+      write(
+        fz.invMesh[j], view.invMesh[j], sizeof(double) * (fz.nmesh[j] - 1));
+    }
+    write(fz.field, view.field, sizeof(BFieldVector<short>) * fz.nfield);
+    if (fz.nbin) {
+      write(
+        fz.binField, view.binField, sizeof(BFieldZone::BinField) * fz.nbin);
+    }
+  }
+  write(header.fileSize, nullptr, 0);
+  return bool(out.flush());
+}
+
+bool
+mapBFieldMap(const std::string& path, BFieldMap& map)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < sizeof(BFieldFileHeader)) {
+    close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid once the file is closed
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  auto mapping = std::make_shared<const Mapping>(addr, size);
+  const char* base = static_cast<const char*>(addr);
+
+  BFieldFileHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  if (!validHeader(header, size)) {
+    return false;
+  }
+  const BFieldFileZone* zones =
+    reinterpret_cast<const BFieldFileZone*>(base + sizeof(header));
+
+  BFieldMap newMap;
+  for (uint32_t i = 0; i < header.nzones; ++i) {
+    const BFieldFileZone& fz = zones[i];
+    if (!validZone(fz, size)) {
+      return false;
+    }
+    const BFieldZone::View view = zoneView(fz, base, 0);
+    if (!validLUTs(view)) {
+      return false;
+    }
+    BFieldZone zone = emptyZone(fz);
+    zone.setView(view, mapping);
+    newMap.appendZone(std::move(zone));
+  }
+  newMap.buildLUT();
+  map = std::move(newMap);
+  return true;
+}
+
+bool
+openBFieldMap(const std::string& path, BFieldMap& map)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  BFieldFileHeader header;
+  if (fstat(fd, &st) != 0 || !readAt(fd, &header, sizeof(header), 0) ||
+      !validHeader(header, st.st_size)) {
+    close(fd);
+    return false;
+  }
+  std::vector<BFieldFileZone> zones(header.nzones);
+  const size_t zonesSize = sizeof(BFieldFileZone) * zones.size();
+  if (!readAt(fd, zones.data(), zonesSize, sizeof(header))) {
+    close(fd);
+    return false;
+  }
+  BFieldMap newMap;
+  for (const BFieldFileZone& fz : zones) {
+    if (!validZone(fz, header.fileSize)) {
+      close(fd);
+      return false;
+    }
+    newMap.appendZone(emptyZone(fz));
+  }
+  newMap.buildLUT();
+  // the loader closes the file
+  newMap.setLoader(
+    std::make_shared<const FileZoneLoader>(fd, std::move(zones)));
+  map = std::move(newMap);
+  return true;
+}
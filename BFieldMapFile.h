@@ -0,0 +1,96 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldMapFile.h
+//
+// Binary file format of a BFieldMap, laid out to be used in place once
+// mapped in memory. For each zone it stores the mesh edges, the look-up
+// tables, the inverse mesh spacings and the field vectors (and the
+// bin-major copy of the field, if built), as the BFieldMesh::View needs
+// them. Every array starts on a 64 byte boundary.
+//
+// Layout, in the native byte order and type sizes recorded in the header:
+//   BFieldFileHeader
+//   BFieldFileZone[nzones]
+//   the arrays, at the byte offsets given in each BFieldFileZone
+//
+// mapBFieldMap maps the file read-only, so that all the processes of a
+// node share one page-cache copy, and the zones view it: there is no
+// parsing and no BFieldMesh::buildLUT at startup. Only the zone look-up
+// table of the map, which depends on the zone ranges only, is rebuilt.
+//
+// openBFieldMap reads only the header and the zone records at startup:
+// the arrays of each zone are read, into a BFieldArena block of its own,
+// on the first look-up reaching the zone (see BFieldMap::setLoader), so
+// that a job using part of the detector reads and holds that part only.
+//
+#ifndef BFIELDMAPFILE_H
+#define BFIELDMAPFILE_H
+
+#include "BFieldMap.h"
+#include <cstdint>
+#include <string>
+
+struct BFieldFileHeader
+{
+  static constexpr uint32_t currentVersion = 1;
+  static constexpr uint32_t byteOrderMark = 0x01020304;
+  char magic[8];       // "BFIELDMP"
+  uint32_t version;    // currentVersion
+  uint32_t byteOrder;  // byteOrderMark, as written
+  uint32_t fieldSize;  // sizeof(BFieldVector<short>)
+  uint32_t binSize;    // sizeof(BFieldZone::BinField)
+  uint32_t zoneSize;   // sizeof(BFieldFileZone)
+  uint32_t nzones;
+  uint64_t fileSize;   // in bytes
+};
+
+struct BFieldFileZone
+{
+  int32_t id;
+  int32_t roff;
+  int32_t zoff;
+  int32_t binRoff;
+  int32_t binZoff;
+  uint32_t nfield;
+  uint32_t nbin;
+  uint32_t nmesh[3];
+  uint32_t nLUT[3];
+  double min[3];
+  double max[3];
+  double scale; // nominal bscale
+  double invUnit[3];
+  // byte offsets of the arrays from the start of the file
+  uint64_t mesh[3];
+  uint64_t LUT[3];
+  uint64_t invMesh[3];
+  uint64_t field;
+  uint64_t binField; // 0 if no bin-major copy
+};
+
+// write map to path, its zone LUTs should be built.
+// returns false if the file cannot be written, or a zone filled on
+// demand cannot be filled.
+bool
+writeBFieldMap(const BFieldMap& map, const std::string& path);
+
+// replace the content of map by zones viewing the file at path,
+// mapped read-only, and build the map LUT.
+// returns false, leaving map untouched, if the file cannot be mapped
+// or is not a valid file of the current version.
+bool
+mapBFieldMap(const std::string& path, BFieldMap& map);
+
+// replace the content of map by the zones of the file at path, with
+// their ranges only, and build the map LUT. The arrays of a zone are
+// read from the file, kept open meanwhile, when first looked up. A
+// zone that cannot be read then, e.g. from a file truncated since, is
+// outside the map (see BFieldMap::nfailed).
+// returns false, leaving map untouched, if the file cannot be read or
+// is not a valid file of the current version.
+bool
+openBFieldMap(const std::string& path, BFieldMap& map);
+
+#endif
@@ -14,21 +14,60 @@
 #ifndef BFIELDMESH_H
 #define BFIELDMESH_H
 
+#include "BFieldArena.h"
 #include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldCacheF.h"
+#include "BFieldStats.h"
 #include "BFieldVector.h"
 #include <array>
+#include <cassert>
 #include <cmath>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 template<class T>
 class BFieldMesh
 {
 public:
+  // (Bz,Br,Bphi) at the 8 corners of one bin, in the corner order
+  // of BFieldCache, on its own cache line for T = short
+  struct alignas(64) BinField
+  {
+    T field[3][8];
+  };
+
+  // The mesh edges, look-up tables and field used by the look-ups.
+  // They point either to the vectors of this mesh, once buildLUT has
+  // been called, or to memory owned elsewhere (see setView).
+  struct View
+  {
+    std::array<const double*, 3> mesh{};
+    std::array<unsigned, 3> nmesh{};
+    std::array<const int*, 3> LUT{};
+    std::array<unsigned, 3> nLUT{};
+    // inverse mesh spacings, nmesh - 1 of them
+    std::array<const double*, 3> invMesh{};
+    // inverse unit size in the LUT
+    std::array<double, 3> invUnit{};
+    const BFieldVector<T>* field = nullptr;
+    unsigned nfield = 0;
+    // optional bin-major copy of field
+    const BinField* binField = nullptr;
+    unsigned nbin = 0;
+    int roff = 0;    // index offset for incrementing r by 1
+    int zoff = 0;    // index offset for incrementing z by 1
+    int binRoff = 0; // bin index offset for incrementing r by 1
+    int binZoff = 0; // bin index offset for incrementing z by 1
+  };
+
   BFieldMesh() = default;
-  BFieldMesh(const BFieldMesh&) = default;
-  BFieldMesh(BFieldMesh&&) = default;
-  BFieldMesh& operator=(const BFieldMesh&) = default;
-  BFieldMesh& operator=(BFieldMesh&&) = default;
+  // the copy views its own vectors, or shares the external memory
+  BFieldMesh(const BFieldMesh& other);
+  BFieldMesh(BFieldMesh&&) noexcept = default;
+  BFieldMesh& operator=(const BFieldMesh& other);
+  BFieldMesh& operator=(BFieldMesh&&) noexcept = default;
   ~BFieldMesh() = default;
   // constructor
   BFieldMesh(double zmin,
@@ -57,7 +96,8 @@ public:
   }
   // set bscale
   void setBscale(double bscale) { m_scale = m_nomScale = bscale; }
-  // scale bscale by a factor
+  // scale bscale by a factor. Neither is safe while other threads read
+  // this mesh: a map shared by threads is rescaled by BFieldMap::setScale
   void scaleBscale(double factor) { m_scale = factor * m_nomScale; }
   // allocate space to vectors
   void reserve(int nz, int nr, int nphi, int nfield);
@@ -68,10 +108,73 @@ public:
   // add elements to vectors
   void appendMesh(int i, double mesh) { m_mesh[i].push_back(mesh); }
   void appendField(const BFieldVector<T>& field) { m_field.push_back(field); }
-  // build Look Up Table
-  void buildLUT();
+  // set all the mesh edges along axis i in one go
+  void setMesh(int i, const double* begin, size_t n)
+  {
+    m_mesh[i].assign(begin, begin + n);
+  }
+  void setMesh(int i, std::vector<double>&& mesh)
+  {
+    m_mesh[i] = std::move(mesh);
+  }
+  // set all the n field vectors in one go, from one array per component,
+  // in the node order of appendField
+  void setField(const T* bz, const T* br, const T* bphi, size_t n);
+  void setField(std::vector<BFieldVector<T>>&& field)
+  {
+    m_field = std::move(field);
+  }
+  // build Look Up Table and the inverse mesh spacings.
+  // the mesh edges should not be modified afterwards.
+  // Owned meshes only: a view (see setView, packArena) has them built.
+  // If binMajor is true, also store the field "bin-major":
+  // the 8 corners of each bin contiguous and aligned, which
+  // getCacheVec and getB then read instead of the node array.
+  void buildLUT(bool binMajor = false);
+  // as above, then move the arrays to an arena block of this mesh
+  // (see packArena). Returns false, the arrays staying in the vectors,
+  // if the block cannot be allocated.
+  bool buildLUT(bool binMajor, const BFieldArenaOptions& arena);
+  // fill reduced, another mesh, with this one on fewer mesh planes,
+  // and build its LUT (bin-major if this one is). Along z, r, then phi,
+  // interior planes are dropped while the linear interpolation between
+  // the planes kept on either side is within tolerance / 3 (in kT) of
+  // the field at all the nodes of the dropped planes, so that reduced
+  // is within tolerance of this mesh at all of its nodes. tolerance is
+  // at the current bscale, as scaled by scaleBscale, before any scale
+  // factor of the map. The ranges and bscale are copied; this mesh
+  // should have its LUT built.
+  void reduce(double tolerance, BFieldMesh& reduced) const;
+  // use the mesh, look-up tables and field of view, in memory kept
+  // alive by backing (e.g. a read-only file mapping), instead of the
+  // vectors of this mesh. Nothing is copied and buildLUT is not needed;
+  // the ranges and bscale should be set as for an owned mesh.
+  void setView(const View& view, std::shared_ptr<const void> backing);
+  // what the look-ups use, once buildLUT or setView has been called
+  const View& view() const { return m_view; }
+  // true if the data are held elsewhere (see setView)
+  bool isView() const { return m_backing != nullptr; }
+  // bytes needed to hold the arrays of view() in an arena block
+  size_t arenaSize() const;
+  // copy the arrays of view() to block, aligned on BFieldArena::alignment
+  // and arenaSize() bytes long, and view them there, kept alive by
+  // backing. The copies of this mesh then share block instead of
+  // copying the arrays. The LUT should be built (or a view set).
+  void packArena(char* block, std::shared_ptr<const void> backing);
+  // as above, into a BFieldArena of its own filled by this thread.
+  // Returns false, leaving this mesh unchanged, if it cannot be mapped.
+  bool packArena(const BFieldArenaOptions& options = BFieldArenaOptions());
   // test if a point is inside this zone
   bool inside(double z, double r, double phi) const;
+  // as inside, without branches: the three ranges are tested
+  // with vector compares
+  bool insideVec(double z, double r, double phi) const;
+  // test n points, as BFieldCache::insideMask
+  void insideMask(const double* ATH_RESTRICT z,
+                  const double* ATH_RESTRICT r,
+                  const double* ATH_RESTRICT phi,
+                  size_t n,
+                  uint64_t* ATH_RESTRICT mask) const;
   // find the bin
   void getCache(double z,
                 double r,
@@ -85,7 +188,84 @@ public:
                 double phi,
                 BFieldCache& cache,
                 double scaleFactor = 1.0) const;
- 
+
+  // as getCacheVec; with foldScale, scaleFactor * bscale() is folded
+  // into the corner values once here, and the cache bscale is 1,
+  // for BFieldCache::getBVec<withDeriv, true>
+  template<bool foldScale>
+  void getCacheVec(double z,
+                   double r,
+                   double phi,
+                   BFieldCache& cache,
+                   double scaleFactor = 1.0) const;
+
+  // find the bin, and prefetch the bin of the predicted next position
+  // (znext, rnext, phinext), e.g. one step ahead along a track, so that
+  // its memory latency overlaps with the use of this cache
+  void getCacheVec(double z,
+                   double r,
+                   double phi,
+                   double znext,
+                   double rnext,
+                   double phinext,
+                   BFieldCache& cache,
+                   double scaleFactor = 1.0) const;
+
+  // prefetch the field at the 8 corners of the bin containing
+  // (z, r, phi), if inside this zone
+  void prefetch(double z, double r, double phi) const;
+
+  // index of the bin containing (z, r, phi), which must be inside this
+  // zone, as iphi + (nmesh(2) - 1) * (ir + (nmesh(1) - 1) * iz)
+  int binIndex(double z, double r, double phi) const;
+
+  // find the bin, single precision cache
+  void getCacheVec(double z,
+                   double r,
+                   double phi,
+                   BFieldCacheF& cache,
+                   double scaleFactor = 1.0) const;
+
+  // find the bin, tricubic cache: the nodes of the bin and their
+  // neighbours, the edge nodes repeated at the edges of this zone
+  void getCache(double z,
+                double r,
+                double phi,
+                BFieldCacheCubic& cache,
+                double scaleFactor = 1.0) const;
+
+  // find the bin and interpolate the field at xyz in one go,
+  // without filling a BFieldCache.
+  // also compute field derivatives if deriv[9] is given.
+  // The scale is applied as by getCacheVec + BFieldCache::getBVec,
+  // not folded, so that the result is bit-identical to theirs.
+  void getB(const double* ATH_RESTRICT xyz,
+            double r,
+            double phi,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr,
+            double scaleFactor = 1.0) const;
+
+  // as getB, with the precomputed invr = 1/r (any value if r = 0),
+  // when the caller has it already
+  void getB(const double* ATH_RESTRICT xyz,
+            double r,
+            double invr,
+            double phi,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr,
+            double scaleFactor = 1.0) const;
+
+  // getB with the derivatives deriv[9] computed only if withDeriv,
+  // chosen at compile time
+  template<bool withDeriv>
+  void getB(const double* ATH_RESTRICT xyz,
+            double r,
+            double phi,
+            double* ATH_RESTRICT B,
+            double* ATH_RESTRICT deriv = nullptr,
+            double scaleFactor = 1.0) const;
+
   // accessors
   double min(size_t i) const { return m_min[i]; }
   double max(size_t i) const { return m_max[i]; }
@@ -95,27 +275,100 @@ public:
   double rmax() const { return m_max[1]; }
   double phimin() const { return m_min[2]; }
   double phimax() const { return m_max[2]; }
-  unsigned nmesh(size_t i) const { return m_mesh[i].size(); }
-  double mesh(size_t i, size_t j) const { return m_mesh[i][j]; }
-  unsigned nfield() const { return m_field.size(); }
-  const BFieldVector<T>& field(size_t i) const { return m_field[i]; }
+  unsigned nmesh(size_t i) const
+  {
+    return isView() ? m_view.nmesh[i] : m_mesh[i].size();
+  }
+  double mesh(size_t i, size_t j) const
+  {
+    return isView() ? m_view.mesh[i][j] : m_mesh[i][j];
+  }
+  unsigned nfield() const
+  {
+    return isView() ? m_view.nfield : m_field.size();
+  }
+  const BFieldVector<T>& field(size_t i) const
+  {
+    return isView() ? m_view.field[i] : m_field[i];
+  }
   double bscale() const { return m_scale; }
+  double nomScale() const { return m_nomScale; }
+  bool binMajor() const { return m_view.binField != nullptr; }
+  // memory owned, including the bin-major copy of the field if built.
+  // A view owns none of its mesh, look-up tables or field.
   int memSize() const;
 
 protected:
+  int m_id = -1; // zone ID number, -1 if not a BFieldZone
   std::array<double, 3> m_min;
   std::array<double, 3> m_max;
   std::array<std::vector<double>,3> m_mesh;
 
 private:
+  // find the mesh indices of the bin containing (z,r,phi),
+  // phi is expected inside [phimin, phimax]
+  void findBin(double z,
+               double r,
+               double phi,
+               int& iz,
+               int& ir,
+               int& iphi) const;
+
+  // point m_view to the vectors of this mesh
+  void seatView();
+  // fill m_cosPhi and m_sinPhi from the phi mesh of m_view
+  void buildPhiTrig();
+
+  // convert the field values to double in registers. Integers go
+  // through int: GCC converts short to double one element at a time,
+  // but short to int and int to double with vector instructions.
+  static void widen(CxxUtils::vec<double, 8>& dst,
+                    const CxxUtils::vec<T, 8>& src);
+
+  // the bodies of the getCacheVec and getB variants
+  template<bool foldScale>
+  void getCacheVecImpl(double z,
+                       double r,
+                       double phi,
+                       BFieldCache& cache,
+                       double scaleFactor) const;
+  template<bool withDeriv>
+  void getBImpl(const double* ATH_RESTRICT xyz,
+                double r,
+                double invr,
+                double phi,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv,
+                double scaleFactor) const;
+
+  // load the 8 corners of the bin starting at node im0 from m_field
+  void loadCorners(int im0,
+                   CxxUtils::vec<double, 4>& field1_z,
+                   CxxUtils::vec<double, 4>& field2_z,
+                   CxxUtils::vec<double, 4>& field1_r,
+                   CxxUtils::vec<double, 4>& field2_r,
+                   CxxUtils::vec<double, 4>& field1_phi,
+                   CxxUtils::vec<double, 4>& field2_phi) const;
+
   std::vector<BFieldVector<T>> m_field;
+  // optional bin-major copy of m_field
+  std::vector<BinField> m_binField;
   double m_scale = 1.0;
   double m_nomScale; // nominal m_scale from the map
 
-  // look-up table and related variables
+  // look-up table
   std::array<std::vector<int>,3> m_LUT;
-  std::array<double,3> m_invUnit; // inverse unit size in the LUT
-  int m_roff, m_zoff;
+  // inverse mesh spacings, 1/(m_mesh[j][i+1]-m_mesh[j][i])
+  std::array<std::vector<double>,3> m_invMesh;
+  // cos and sin of the phi mesh edges, for the caches of the bins,
+  // always owned: the points at r = 0 use the direction of phimin
+  std::vector<double> m_cosPhi;
+  std::vector<double> m_sinPhi;
+
+  // what the look-ups read
+  View m_view;
+  // owner of the memory m_view points to, if not this mesh
+  std::shared_ptr<const void> m_backing;
 
 };
 #include "BFieldMesh.icc"
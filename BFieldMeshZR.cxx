@@ -0,0 +1,106 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldMeshZR.h"
+#include "BFieldStats.h"
+#include "vec.h"
+#include <algorithm>
+
+//
+// Construct the look-up table to accelerate bin-finding.
+//
+void
+BFieldMeshZR::buildLUT()
+{
+  for (int j = 0; j < 2; ++j) { // z, r
+    // align the m_mesh edges to m_min/m_max
+    m_mesh[j].front() = m_min[j];
+    m_mesh[j].back() = m_max[j];
+    // determine the unit size, q, to be used in the LUTs
+    const double width = m_mesh[j].back() - m_mesh[j].front();
+    double q(width);
+    for (unsigned i = 0; i < m_mesh[j].size() - 1; ++i) {
+      q = std::min(q, m_mesh[j][i + 1] - m_mesh[j][i]);
+    }
+    // find the number of units in the LUT
+    int n = int(width / q) + 1;
+    q = width / (n + 0.5);
+    m_invUnit[j] = 1.0 / q; // new unit size
+    ++n;
+    int m = 0;                    // mesh number
+    m_LUT[j].clear();
+    for (int i = 0; i < n; ++i) { // LUT index
+      if (i * q + m_mesh[j].front() > m_mesh[j][m + 1]) {
+        m++;
+      }
+      m_LUT[j].push_back(m);
+    }
+    // inverse of the mesh spacings, used when filling the caches
+    m_invMesh[j].resize(m_mesh[j].size() - 1);
+    for (unsigned i = 0; i < m_mesh[j].size() - 1; ++i) {
+      m_invMesh[j][i] = 1.0 / (m_mesh[j][i + 1] - m_mesh[j][i]);
+    }
+  }
+  m_zoff = m_mesh[1].size(); // index offset for incrementing z by 1
+}
+
+int
+BFieldMeshZR::memSize() const
+{
+  int size = 0;
+  size += sizeof(double) * 8;
+  size += sizeof(int) * 1;
+  for (int i = 0; i < 2; ++i) {
+    size += sizeof(double) * m_mesh[i].capacity();
+    size += sizeof(int) * m_LUT[i].capacity();
+    size += sizeof(double) * m_invMesh[i].capacity();
+  }
+  size += sizeof(BFieldVectorZR) * m_field.capacity();
+  return size;
+}
+
+//
+// Find and return the cache of the bin containing (z,r)
+//
+BFIELD_TARGET_CLONES
+void
+BFieldMeshZR::getCache(double z,
+                       double r,
+                       BFieldCacheZR& cache,
+                       double scaleFactor) const
+{
+  BFIELD_STATS_SCOPE(BFieldStats::Fill, -1);
+  // find the mesh, and relative location in the mesh
+  // z
+  const std::vector<double>& mz(m_mesh[0]);
+  int iz = int((z - zmin()) * m_invUnit[0]); // index to LUT
+  iz = m_LUT[0][iz];                         // tentative mesh index from LUT
+  iz += (z > mz[iz + 1]);
+  // r
+  const std::vector<double>& mr(m_mesh[1]);
+  int ir = int((r - rmin()) * m_invUnit[1]); // index to LUT
+  ir = m_LUT[1][ir];                         // tentative mesh index from LUT
+  ir += (r > mr[ir + 1]);
+  // store the bin edges
+  cache.setRange(mz[iz],
+                 mz[iz + 1],
+                 mr[ir],
+                 mr[ir + 1],
+                 m_invMesh[0][iz],
+                 m_invMesh[1][ir]);
+
+  // store the B field at the 4 corners, Bz then Br
+  const int im0 = iz * m_zoff + ir; // index of the first corner
+  const BFieldVectorZR& c0 = m_field[im0];
+  const BFieldVectorZR& c1 = m_field[im0 + 1];
+  const BFieldVectorZR& c2 = m_field[im0 + m_zoff];
+  const BFieldVectorZR& c3 = m_field[im0 + m_zoff + 1];
+  const CxxUtils::vec<double, 8> field = {
+    c0[0], c1[0], c2[0], c3[0], c0[1], c1[1], c2[1], c3[1]
+  };
+  cache.setFieldVec(scaleFactor * field);
+
+  // store the B scale
+  cache.setBscale(m_scale);
+}
@@ -0,0 +1,109 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldMeshZR.h
+//
+// Simple 2-d (z,r) mesh of the solenoid field, taken to be axially
+// symmetric: the 2d counterpart of BFieldMesh<double>, filling a
+// BFieldCacheZR.
+//
+#ifndef BFIELDMESHZR_H
+#define BFIELDMESHZR_H
+
+#include "BFieldCacheZR.h"
+#include "BFieldVectorZR.h"
+#include <array>
+#include <vector>
+
+class BFieldMeshZR
+{
+public:
+  BFieldMeshZR() = default;
+  // constructor
+  BFieldMeshZR(double zmin,
+               double zmax,
+               double rmin,
+               double rmax,
+               double bscale)
+    : m_min{ zmin, rmin }
+    , m_max{ zmax, rmax }
+    , m_scale(bscale)
+    , m_nomScale(bscale)
+  {}
+  // set ranges
+  void setRange(double zmin, double zmax, double rmin, double rmax)
+  {
+    m_min = { zmin, rmin };
+    m_max = { zmax, rmax };
+  }
+  // set bscale
+  void setBscale(double bscale) { m_scale = m_nomScale = bscale; }
+  // scale bscale by a factor
+  void scaleBscale(double factor) { m_scale = factor * m_nomScale; }
+  // allocate space to vectors
+  void reserve(int nz, int nr)
+  {
+    m_mesh[0].reserve(nz);
+    m_mesh[1].reserve(nr);
+    m_field.reserve(nz * nr);
+  }
+  // add elements to vectors
+  void appendMesh(int i, double mesh) { m_mesh[i].push_back(mesh); }
+  void appendField(const BFieldVectorZR& field) { m_field.push_back(field); }
+  // set all the mesh edges along axis i in one go
+  void setMesh(int i, std::vector<double>&& mesh)
+  {
+    m_mesh[i] = std::move(mesh);
+  }
+  // set all the field vectors in one go, running fastest in r
+  void setField(std::vector<BFieldVectorZR>&& field)
+  {
+    m_field = std::move(field);
+  }
+  // build Look Up Table and the inverse mesh spacings.
+  // the mesh edges should not be modified afterwards.
+  void buildLUT();
+  // test if a point is inside this mesh
+  bool inside(double z, double r) const
+  {
+    return (z >= zmin() && z <= zmax() && r >= rmin() && r <= rmax());
+  }
+  // find the bin
+  void getCache(double z,
+                double r,
+                BFieldCacheZR& cache,
+                double scaleFactor = 1.0) const;
+  // accessors
+  double min(size_t i) const { return m_min[i]; }
+  double max(size_t i) const { return m_max[i]; }
+  double zmin() const { return m_min[0]; }
+  double zmax() const { return m_max[0]; }
+  double rmin() const { return m_min[1]; }
+  double rmax() const { return m_max[1]; }
+  unsigned nmesh(size_t i) const { return m_mesh[i].size(); }
+  double mesh(size_t i, size_t j) const { return m_mesh[i][j]; }
+  unsigned nfield() const { return m_field.size(); }
+  const BFieldVectorZR& field(size_t i) const { return m_field[i]; }
+  double bscale() const { return m_scale; }
+  double nomScale() const { return m_nomScale; }
+  int memSize() const;
+
+private:
+  std::array<double, 2> m_min;
+  std::array<double, 2> m_max;
+  std::array<std::vector<double>, 2> m_mesh;
+  std::vector<BFieldVectorZR> m_field;
+  double m_scale = 1.0;
+  double m_nomScale; // nominal m_scale from the map
+
+  // look-up table and related variables
+  std::array<std::vector<int>, 2> m_LUT;
+  std::array<double, 2> m_invUnit; // inverse unit size in the LUT
+  // inverse mesh spacings, 1/(m_mesh[j][i+1]-m_mesh[j][i])
+  std::array<std::vector<double>, 2> m_invMesh;
+  int m_zoff; // index offset for incrementing z by 1
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldMultiCache.h
+//
+// Per-thread (caller owned) context for field look-ups in a BFieldMap,
+// keeping the BFieldCache of the last N bins used, rather than of one
+// bin as BFieldMapCache does. A track zig-zagging across a bin boundary,
+// or several tracks stepped in turn, then keep hitting in the cache.
+//
+// The entry last used is tested first, as by BFieldMapCache, so that
+// a track staying in one bin pays no more. Otherwise the point is
+// tested against all the entries at once: their bin ranges are also
+// kept in structure-of-arrays form, compared with 2-wide vectors and
+// no branches. On a miss in every entry, the next entry in round-robin
+// order is refilled with BFieldMesh::getCacheVec. A point outside the
+// map refills none.
+//
+// As BFieldMapCache, getField refills all the entries once the map has
+// published a new scale factor (see BFieldMap::setScale).
+//
+// N must be 2, 4 or 8.
+//
+#ifndef BFIELDMULTICACHE_H
+#define BFIELDMULTICACHE_H
+
+#include "BFieldCache.h"
+#include "BFieldMap.h"
+#include "BFieldMesh.h"
+#include "vec.h"
+
+template<int N>
+class BFieldMultiCache
+{
+  static_assert(N == 2 || N == 4 || N == 8, "N must be 2, 4 or 8");
+
+public:
+  BFieldMultiCache() { invalidate(); }
+  // if countHits, the number of cache hits and misses is recorded
+  explicit BFieldMultiCache(const BFieldMap* map, bool countHits = false)
+    : m_map(map)
+    , m_count(countHits)
+  {
+    invalidate();
+  }
+  // change the map, invalidating the entries
+  void setMap(const BFieldMap* map);
+  // make all entries invalid
+  void invalidate();
+
+  // return the entry whose bin contains (z, r, phi), nullptr if none
+  const BFieldCache* find(double z, double r, double phi) const;
+  // return the entry whose bin contains (z, r, phi), refilling one
+  // from mesh if none does. (z, r, phi) must be inside mesh.
+  template<class T>
+  const BFieldCache& getCache(const BFieldMesh<T>& mesh,
+                              double z,
+                              double r,
+                              double phi,
+                              double scaleFactor = 1.0);
+  // return the field B[3] at xyz, zero outside the map.
+  // also compute field derivatives if deriv[9] is given.
+  void getField(const double* ATH_RESTRICT xyz,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv = nullptr);
+  // as above, with r and phi of xyz already known
+  void getField(const double* ATH_RESTRICT xyz,
+                double r,
+                double phi,
+                double* ATH_RESTRICT B,
+                double* ATH_RESTRICT deriv = nullptr);
+
+  // hit/miss counters, zero unless counting was requested
+  unsigned long long hits() const { return m_hits; }
+  unsigned long long misses() const { return m_misses; }
+  void resetCounters()
+  {
+    m_hits = 0;
+    m_misses = 0;
+  }
+
+private:
+  // index of the entry containing (z, r, phi), -1 if none,
+  // testing the last used one first
+  int findIndex(double z, double r, double phi) const;
+  // the entry to refill on a miss, with its range updated once filled
+  BFieldCache& nextEntry() { return m_cache[m_next]; }
+  void commitEntry();
+
+  const BFieldMap* m_map = nullptr;
+  // bin ranges of the entries, as in m_cache
+  alignas(64) double m_zmin[N];
+  alignas(64) double m_zmax[N];
+  alignas(64) double m_rmin[N];
+  alignas(64) double m_rmax[N];
+  alignas(64) double m_phimin[N];
+  alignas(64) double m_phimax[N];
+  BFieldCache m_cache[N];
+  // generation of the map scale the entries were filled with
+  uint64_t m_generation = 0;
+  // the entry last used, and the one to replace on the next miss
+  int m_last = 0;
+  int m_next = 0;
+  unsigned long long m_hits = 0;
+  unsigned long long m_misses = 0;
+  // 1 if counting, 0 otherwise, so that counting does not branch
+  unsigned m_count = 0;
+};
+
+#include "BFieldMultiCache.icc"
+#endif
@@ -0,0 +1,51 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldScale.h"
+#include <algorithm>
+
+BFieldScale::BFieldScale(double factor)
+  : m_owned(new BFieldScaleSnapshot{ factor, 0 })
+{
+  m_current.store(m_owned.get(), std::memory_order_release);
+}
+
+BFieldScale::BFieldScale(const BFieldScale& other)
+  : m_owned(new BFieldScaleSnapshot(other.current()))
+{
+  m_current.store(m_owned.get(), std::memory_order_release);
+}
+
+BFieldScale&
+BFieldScale::operator=(const BFieldScale& other)
+{
+  if (this != &other) {
+    const BFieldScaleSnapshot& snapshot = other.current();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // never back to a generation a cache may have seen here
+    const uint64_t generation =
+      std::max(m_owned->generation + 1, snapshot.generation);
+    m_retired.push_back(std::move(m_owned));
+    m_owned.reset(new BFieldScaleSnapshot{ snapshot.factor, generation });
+    m_current.store(m_owned.get(), std::memory_order_release);
+  }
+  return *this;
+}
+
+void
+BFieldScale::set(double factor)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const uint64_t generation = m_owned->generation + 1;
+  m_retired.push_back(std::move(m_owned));
+  m_owned.reset(new BFieldScaleSnapshot{ factor, generation });
+  m_current.store(m_owned.get(), std::memory_order_release);
+}
+
+void
+BFieldScale::reclaim()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_retired.clear();
+}
@@ -0,0 +1,66 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldScale.h
+//
+// The current-dependent state of a BFieldMap: the factor applied to the
+// nominal field of its zones (the ratio of the current to the nominal
+// one), with a generation number bumped at every change, kept as an
+// immutable snapshot behind an atomic pointer.
+//
+// Readers get the snapshot with one acquire load and never wait; a change
+// published meanwhile is seen by their next load. The caches filled from
+// a map (BFieldMapCache, BFieldMultiCache) keep the generation they were
+// filled with, and refill once it has changed.
+//
+// set() publishes a new snapshot, writers being serialized by a mutex.
+// Readers may still use the snapshot it replaces, so the old snapshots
+// are kept (a few bytes per change) until the BFieldScale is destroyed,
+// or until reclaim() is called at a point where no reader can hold one
+// (e.g. between events, with no look-up in flight).
+//
+#ifndef BFIELDSCALE_H
+#define BFIELDSCALE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct BFieldScaleSnapshot
+{
+  double factor = 1.0;     // multiplies the nominal bscale of the zones
+  uint64_t generation = 0; // bumped at each change
+};
+
+class BFieldScale
+{
+public:
+  explicit BFieldScale(double factor = 1.0);
+  // a copy starts from the current snapshot of other, generation included
+  // (an assignment does not go back to an earlier generation)
+  BFieldScale(const BFieldScale& other);
+  BFieldScale& operator=(const BFieldScale& other);
+  ~BFieldScale() = default;
+
+  // the current snapshot, without waiting
+  const BFieldScaleSnapshot& current() const
+  {
+    return *m_current.load(std::memory_order_acquire);
+  }
+  // publish factor, with the next generation
+  void set(double factor);
+  // free the snapshots replaced so far: no reader may still use one
+  void reclaim();
+
+private:
+  std::atomic<const BFieldScaleSnapshot*> m_current;
+  std::unique_ptr<const BFieldScaleSnapshot> m_owned; // *m_current
+  std::vector<std::unique_ptr<const BFieldScaleSnapshot>> m_retired;
+  std::mutex m_mutex; // serializes the writers
+};
+
+#endif
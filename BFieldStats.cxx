@@ -0,0 +1,170 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldStats.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+namespace {
+const char* const kindName[BFieldStats::nKinds] = { "fill",
+                                                    "fused getB",
+                                                    "interpolate",
+                                                    "batch" };
+}
+
+#if BFIELD_INSTRUMENT
+namespace {
+
+// all the counters ever used, and those of no running thread
+struct Registry
+{
+  std::mutex mutex;
+  std::vector<std::unique_ptr<BFieldStats::ThreadCounters>> all;
+  std::vector<BFieldStats::ThreadCounters*> free;
+};
+
+Registry&
+registry()
+{
+  static Registry reg;
+  return reg;
+}
+
+void
+clear(BFieldStats::ThreadCounters& counters)
+{
+  for (int k = 0; k < BFieldStats::nKinds; ++k) {
+    counters.calls[k].store(0, std::memory_order_relaxed);
+    counters.cycles[k].store(0, std::memory_order_relaxed);
+    for (int b = 0; b < BFieldStats::nBuckets; ++b) {
+      counters.histogram[k][b].store(0, std::memory_order_relaxed);
+    }
+  }
+  for (int z = 0; z < BFieldStats::nZoneSlots; ++z) {
+    counters.zone[z].store(0, std::memory_order_relaxed);
+  }
+}
+
+} // namespace
+
+// reuse the counters of an exited thread, keeping their counts
+BFieldStats::ThreadSlot::ThreadSlot()
+{
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  if (!reg.free.empty()) {
+    counters = reg.free.back();
+    reg.free.pop_back();
+    return;
+  }
+  reg.all.push_back(std::make_unique<ThreadCounters>());
+  counters = reg.all.back().get();
+  clear(*counters);
+}
+
+BFieldStats::ThreadSlot::~ThreadSlot()
+{
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  reg.free.push_back(counters);
+}
+
+bool
+BFieldStats::enabled()
+{
+  return true;
+}
+
+BFieldStats::Report
+BFieldStats::report()
+{
+  Report rep;
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (const std::unique_ptr<ThreadCounters>& counters : reg.all) {
+    for (int k = 0; k < nKinds; ++k) {
+      rep.calls[k] += counters->calls[k].load(std::memory_order_relaxed);
+      rep.cycles[k] += counters->cycles[k].load(std::memory_order_relaxed);
+      for (int b = 0; b < nBuckets; ++b) {
+        rep.histogram[k][b] +=
+          counters->histogram[k][b].load(std::memory_order_relaxed);
+      }
+    }
+    for (int z = 0; z < nZoneSlots; ++z) {
+      rep.zone[z] += counters->zone[z].load(std::memory_order_relaxed);
+    }
+  }
+  return rep;
+}
+
+void
+BFieldStats::reset()
+{
+  Registry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (const std::unique_ptr<ThreadCounters>& counters : reg.all) {
+    clear(*counters);
+  }
+}
+#else
+bool
+BFieldStats::enabled()
+{
+  return false;
+}
+
+BFieldStats::Report
+BFieldStats::report()
+{
+  return Report();
+}
+
+void
+BFieldStats::reset()
+{}
+#endif
+
+void
+BFieldStats::Report::print(std::ostream& out, int maxZones) const
+{
+  for (int k = 0; k < nKinds; ++k) {
+    if (calls[k] == 0) {
+      continue;
+    }
+    out << ' ' << kindName[k] << ": " << calls[k] << " calls, "
+        << double(cycles[k]) / calls[k] << " cycles mean" << '\n';
+    for (int b = 0; b < nBuckets; ++b) {
+      if (histogram[k][b]) {
+        out << "   [" << (b ? uint64_t(1) << (b - 1) : 0) << ", "
+            << (uint64_t(1) << b) << ") cycles: " << histogram[k][b] << '\n';
+      }
+    }
+  }
+  // the zones with the most look-ups first
+  std::vector<int> slots;
+  for (int z = 0; z < int(zone.size()); ++z) {
+    if (zone[z]) {
+      slots.push_back(z);
+    }
+  }
+  std::stable_sort(slots.begin(), slots.end(), [this](int a, int b) {
+    return zone[a] > zone[b];
+  });
+  if (int(slots.size()) > maxZones) {
+    slots.resize(maxZones);
+  }
+  for (int z : slots) {
+    out << ' ';
+    if (z == 0) {
+      out << "no zone";
+    } else if (z == nZoneSlots - 1) {
+      out << "zones above " << maxZoneId;
+    } else {
+      out << "zone " << z - 1;
+    }
+    out << ": " << zone[z] << " look-ups" << '\n';
+  }
+}
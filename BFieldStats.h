@@ -0,0 +1,180 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldStats.h
+//
+// Opt-in instrumentation of the hot paths: the cache fills of
+// BFieldMesh (getCache, getCacheVec), its fused getB, and the
+// interpolations of BFieldCache, BFieldCacheF and BFieldCacheCubic (and of
+// their 2d solenoid counterparts BFieldMeshZR, BFieldCacheZR). Each call is
+// counted, its duration in time-stamp counter cycles is put in a log2
+// histogram, and the fills and fused calls are also counted for the zone
+// (BFieldZone::id()) they read.
+//
+// The counters are per thread and written by their thread only, with
+// relaxed atomic stores: recording takes no lock, and report() merges
+// them while other threads run. The counters of an exited thread are
+// kept, and handed to the next new thread.
+//
+// Compiled in only with BFIELD_INSTRUMENT defined (the CMake option of
+// the same name). Otherwise BFIELD_STATS_SCOPE expands to nothing and
+// report() returns zero counts.
+//
+#ifndef BFIELDSTATS_H
+#define BFIELDSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#if BFIELD_INSTRUMENT
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+#endif
+
+namespace BFieldStats {
+
+// what is timed
+enum Kind
+{
+  Fill,        // BFieldMesh::getCache, getCacheVec
+  FusedGetB,   // BFieldMesh::getB
+  Interpolate, // BFieldCache::getB, getBVec, BFieldCacheF::getBVec,
+               // BFieldCacheCubic::getB
+  Batch,       // BFieldCache::getBBatch, one call for all its points
+               // (the last n % 4 are also interpolations)
+  nKinds
+};
+
+// bucket b of the histograms counts the calls of [2^(b-1), 2^b) cycles
+constexpr int nBuckets = 32;
+// zone ids up to maxZoneId are counted one by one, the larger ones
+// together, and the meshes that are not zones (id -1) on their own
+constexpr int maxZoneId = 4094;
+constexpr int nZoneSlots = maxZoneId + 3;
+
+// the counts merged over all threads
+struct Report
+{
+  uint64_t calls[nKinds] = {};
+  uint64_t cycles[nKinds] = {};
+  uint64_t histogram[nKinds][nBuckets] = {};
+  // look-ups (fills and fused getB) per zone: zone[id + 1] for id in
+  // [-1, maxZoneId], then those of all the larger ids
+  std::vector<uint64_t> zone = std::vector<uint64_t>(nZoneSlots, 0);
+  // print the calls, mean cycles and non-empty buckets of each kind,
+  // and the maxZones zones with the most look-ups
+  void print(std::ostream& out, int maxZones = 20) const;
+};
+
+// true if compiled with BFIELD_INSTRUMENT
+bool
+enabled();
+// merge the counters of all threads
+Report
+report();
+// zero all the counters; no thread should be recording meanwhile
+void
+reset();
+
+#if BFIELD_INSTRUMENT
+// the counters of one thread
+struct ThreadCounters
+{
+  std::atomic<uint64_t> calls[nKinds];
+  std::atomic<uint64_t> cycles[nKinds];
+  std::atomic<uint64_t> histogram[nKinds][nBuckets];
+  std::atomic<uint64_t> zone[nZoneSlots];
+};
+
+// owns the counters of its thread while the thread runs
+struct ThreadSlot
+{
+  ThreadSlot();
+  ~ThreadSlot();
+  ThreadSlot(const ThreadSlot&) = delete;
+  ThreadSlot& operator=(const ThreadSlot&) = delete;
+  ThreadCounters* counters;
+};
+
+inline ThreadCounters&
+threadCounters()
+{
+  static thread_local ThreadSlot slot;
+  return *slot.counters;
+}
+
+// the only writer of the counter: no read-modify-write needed
+inline void
+add(std::atomic<uint64_t>& counter, uint64_t n)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+inline uint64_t
+now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+#endif
+}
+
+// times its own lifetime, and records it as one call of kind.
+// If zoneId is given, the call is also counted as a look-up of the zone.
+class Scope
+{
+public:
+  explicit Scope(Kind kind)
+    : m_kind(kind)
+    , m_start(now())
+  {}
+  Scope(Kind kind, int zoneId)
+    : m_kind(kind)
+    , m_zoneId(zoneId)
+    , m_countZone(true)
+    , m_start(now())
+  {}
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+  ~Scope()
+  {
+    const uint64_t cycles = now() - m_start;
+    ThreadCounters& counters = threadCounters();
+    add(counters.calls[m_kind], 1);
+    add(counters.cycles[m_kind], cycles);
+    const int bucket = 64 - __builtin_clzll(cycles | 1);
+    add(counters.histogram[m_kind][bucket < nBuckets ? bucket : nBuckets - 1],
+        1);
+    if (m_countZone) {
+      const int slot = m_zoneId < 0           ? 0
+                       : m_zoneId > maxZoneId ? nZoneSlots - 1
+                                              : m_zoneId + 1;
+      add(counters.zone[slot], 1);
+    }
+  }
+
+private:
+  Kind m_kind;
+  int m_zoneId = -1;
+  bool m_countZone = false;
+  uint64_t m_start;
+};
+
+#define BFIELD_STATS_SCOPE(...) BFieldStats::Scope bfieldStatsScope(__VA_ARGS__)
+#else
+#define BFIELD_STATS_SCOPE(...)
+#endif
+
+} // namespace BFieldStats
+
+#endif
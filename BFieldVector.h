@@ -16,6 +16,7 @@
 #define BFIELDVECTOR_H
 
 #include <array>
+#include <cstddef>
 
 template<class T>
 class BFieldVector
@@ -13,6 +13,7 @@
 #define BFIELDZONE_H
 
 #include "BFieldMesh.h"
+#include <cassert>
 #include <vector>
 
 class BFieldZone : public BFieldMesh<short>
@@ -28,9 +29,8 @@ public:
              double phimax,
              double scale)
     : BFieldMesh<short>(zmin, zmax, rmin, rmax, phimin, phimax, scale)
-    , m_id(id)
   {
-    ;
+    m_id = id;
   }
   // scale B field by a multiplicative factor: RDS 2019/09 - no longer used.
   // Scaling is done in cachec
@@ -40,20 +40,29 @@ public:
   }
   // accessors
   int id() const { return m_id; }
-  // adjust the min/max edges to a new value
+  // this zone on fewer mesh planes, within tolerance (in kT) at all
+  // its nodes, see BFieldMesh::reduce
+  BFieldZone reduced(double tolerance) const
+  {
+    BFieldZone zone(
+      m_id, zmin(), zmax(), rmin(), rmax(), phimin(), phimax(), bscale());
+    reduce(tolerance, zone);
+    return zone;
+  }
+  // adjust the min/max edges to a new value, before buildLUT.
+  // Owned meshes only: the edges of a view are read-only.
   void adjustMin(int i, double x)
   {
+    assert(!isView());
     m_min[i] = x;
     m_mesh[i].front() = x;
   }
   void adjustMax(int i, double x)
   {
+    assert(!isView());
     m_max[i] = x;
     m_mesh[i].back() = x;
   }
-
-private:
-  int m_id;                       // zone ID number
 };
 
 
@@ -0,0 +1,146 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// BFieldZoneLoader.h
+//
+// On-demand filling of the zones of a BFieldMap (see BFieldMap::setLoader):
+// the zones are registered with their ranges only, and the mesh, LUTs and
+// field of each one are filled by a BFieldZoneLoader on the first look-up
+// reaching it, e.g. from the binary file of the map (openBFieldMap).
+//
+// BFieldLazyZones keeps the state of each zone of one map. A zone is
+// filled once, under a std::once_flag, while the threads looking it up
+// meanwhile wait; once filled, a look-up only tests an atomic flag.
+//
+#ifndef BFIELDZONELOADER_H
+#define BFIELDZONELOADER_H
+
+#include "BFieldZone.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class BFieldZoneLoader
+{
+public:
+  virtual ~BFieldZoneLoader() = default;
+  // fill zone i of the map, with its ranges and bscale set, with its
+  // mesh, LUTs and field. Returns false if they cannot be read.
+  // Called once per zone and map, and concurrently for different zones.
+  virtual bool load(size_t i, BFieldZone& zone) const = 0;
+};
+
+class BFieldLazyZones
+{
+public:
+  BFieldLazyZones() = default;
+  // nzones zones, none filled yet
+  BFieldLazyZones(std::shared_ptr<const BFieldZoneLoader> loader,
+                  size_t nzones);
+  // the copy shares the loader, and has the zones filled so far filled,
+  // as the zones of a copy of the map have their data. No zone should
+  // be filled meanwhile.
+  BFieldLazyZones(const BFieldLazyZones& other);
+  BFieldLazyZones(BFieldLazyZones&&) noexcept = default;
+  BFieldLazyZones& operator=(const BFieldLazyZones& other);
+  BFieldLazyZones& operator=(BFieldLazyZones&&) noexcept = default;
+  ~BFieldLazyZones() = default;
+
+  // fill zone i with the loader, unless done already, and return
+  // false if it could not be filled. Always true without a loader.
+  bool ensure(size_t i, BFieldZone& zone) const;
+  // true if zone i is filled, without filling it. Always true without
+  // a loader.
+  bool filled(size_t i) const
+  {
+    return !m_loader || m_state[i].load(std::memory_order_acquire) == loaded;
+  }
+  // true if the zones are filled on demand
+  bool lazy() const { return m_loader != nullptr; }
+  // the zones filled, and those that could not be
+  size_t nloaded() const { return count(loaded); }
+  size_t nfailed() const { return count(failed); }
+
+private:
+  enum State : uint8_t
+  {
+    pending,
+    loaded,
+    failed
+  };
+  size_t count(State state) const;
+
+  std::shared_ptr<const BFieldZoneLoader> m_loader;
+  size_t m_nzones = 0;
+  std::unique_ptr<std::once_flag[]> m_once;
+  std::unique_ptr<std::atomic<uint8_t>[]> m_state;
+};
+
+inline BFieldLazyZones::BFieldLazyZones(
+  std::shared_ptr<const BFieldZoneLoader> loader,
+  size_t nzones)
+  : m_loader(std::move(loader))
+  , m_nzones(nzones)
+  , m_once(new std::once_flag[nzones])
+  , m_state(new std::atomic<uint8_t>[nzones])
+{
+  for (size_t i = 0; i < nzones; ++i) {
+    m_state[i].store(pending, std::memory_order_relaxed);
+  }
+}
+
+inline BFieldLazyZones::BFieldLazyZones(const BFieldLazyZones& other)
+  : m_loader(other.m_loader)
+  , m_nzones(other.m_nzones)
+{
+  if (!m_loader) {
+    return;
+  }
+  m_once.reset(new std::once_flag[m_nzones]);
+  m_state.reset(new std::atomic<uint8_t>[m_nzones]);
+  for (size_t i = 0; i < m_nzones; ++i) {
+    m_state[i].store(other.m_state[i].load(std::memory_order_acquire),
+                     std::memory_order_relaxed);
+  }
+}
+
+inline BFieldLazyZones&
+BFieldLazyZones::operator=(const BFieldLazyZones& other)
+{
+  if (this != &other) {
+    *this = BFieldLazyZones(other);
+  }
+  return *this;
+}
+
+inline bool
+BFieldLazyZones::ensure(size_t i, BFieldZone& zone) const
+{
+  if (!m_loader) {
+    return true;
+  }
+  const uint8_t state = m_state[i].load(std::memory_order_acquire);
+  if (state != pending) {
+    return state == loaded;
+  }
+  std::call_once(m_once[i], [this, i, &zone]() {
+    m_state[i].store(m_loader->load(i, zone) ? loaded : failed,
+                     std::memory_order_release);
+  });
+  return m_state[i].load(std::memory_order_acquire) == loaded;
+}
+
+inline size_t
+BFieldLazyZones::count(State state) const
+{
+  size_t n = 0;
+  for (size_t i = 0; m_loader && i < m_nzones; ++i) {
+    n += (m_state[i].load(std::memory_order_acquire) == state);
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration.
+ */
+/**
+ * @file CxxUtils/features.h
+ * @brief Some additional feature test macros.
+ */
+
+#ifndef CXXUTILS_FEATURES_H
+#define CXXUTILS_FEATURES_H
+
+/// Do we have function multiversioning?  GCC and clang > 7 support
+/// the target attribute, resolved at load time through an ifunc.
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__ELF__) &&        \
+  defined(__GNUC__) && !defined(__CLING__) && !defined(__ICC) &&             \
+  !defined(__COVERITY__) && !defined(__CUDACC__)
+#define HAVE_FUNCTION_MULTIVERSIONING 1
+#else
+#define HAVE_FUNCTION_MULTIVERSIONING 0
+#endif
+
+/// Do we also have the target_clones attribute?
+/// clang supports it only from version 14.
+#if HAVE_FUNCTION_MULTIVERSIONING &&                                         \
+  (!defined(__clang__) || (__clang_major__ >= 14))
+#define HAVE_TARGET_CLONES 1
+#else
+#define HAVE_TARGET_CLONES 0
+#endif
+
+#endif // CXXUTILS_FEATURES_H
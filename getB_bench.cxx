@@ -3,9 +3,14 @@
 */
 
 #include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldCacheF.h"
+#include "BFieldCacheZR.h"
+#include "BFieldGenerator.h"
 #include "BFieldZone.h"
 #include <benchmark/benchmark.h>
 #include <iostream>
+#include <vector>
 constexpr int nmeshz{ 4 };
 constexpr int nmeshr{ 5 };
 constexpr int nmeshphi{ 6 };
@@ -14,7 +19,7 @@ constexpr int nfield = nmeshz * nmeshr * nmeshphi;
 struct BFieldData
 {
 
-  double fieldz[nfield] = {
+  short fieldz[nfield] = {
     19487, 19487, 19488, 19488, 19487, 19487, 19531, 19531, 19532, 19532, 19531,
     19531, 6399,  6400,  6400,  6400,  6399,  -1561, -1561, -1560, -1560, -1560,
     -1561, -1516, -1516, -1515, -1515, -1516, -1516, 20310, 20310, 20311, 20311,
@@ -28,7 +33,7 @@ struct BFieldData
     -1560, -1561, -1516, -1516, -1515, -1515, -1515, -1516, -1516, -1516
   };
 
-  double fieldr[nfield] = {
+  short fieldr[nfield] = {
     -1357, -1356, -1353, -1354, -1354, -1357, -1366, -1366, -1362, -1363, -1363,
     -1366, -1378, -1374, -1375, -1375, -1378, -1388, -1388, -1385, -1386, -1386,
     -1388, -1394, -1394, -1390, -1391, -1391, -1394, -318,  -318,  -314,  -315,
@@ -42,7 +47,7 @@ struct BFieldData
     1386,  1383,  1388,  1388,  1393,  1391,  1391,  1388,  1388,  1388
   };
 
-  double fieldphi[nfield] = {
+  short fieldphi[nfield] = {
     -2, 7,  3,  1,  6, -2, -2, 7, 3,  1,  6, -2, -2, 3, 1,  6,  -2, -2, 7, 3,
     1,  6,  -2, -2, 7, 3,  1,  6, -2, -1, 7, 3,  1,  6, -1, -1, 7,  3,  1, 6,
     -1, -1, 3,  1,  6, -1, -1, 7, 3,  1,  6, -1, -1, 8, 3,  1,  6,  -1, 1, 7,
@@ -69,23 +74,10 @@ struct BFieldData
   BFieldData()
     : zone(id, zmin, zmax, rmin, rmax, phimin, phimax, bscale)
   {
-    zone.reserve(nmeshz, nmeshr, nmeshphi);
-    for (int j = 0; j < nmeshz; j++) {
-      zone.appendMesh(0, meshz[j]);
-    }
-
-    for (int j = 0; j < nmeshr; j++) {
-      zone.appendMesh(1, meshr[j]);
-    }
-
-    for (int j = 0; j < nmeshphi; j++) {
-      zone.appendMesh(2, meshphi[j]);
-    }
-
-    for (int j = 0; j < nfield; j++) {
-      BFieldVector<short> field(fieldz[j], fieldr[j], fieldphi[j]);
-      zone.appendField(field);
-    }
+    zone.setMesh(0, meshz, nmeshz);
+    zone.setMesh(1, meshr, nmeshr);
+    zone.setMesh(2, meshphi, nmeshphi);
+    zone.setField(fieldz, fieldr, fieldphi, nfield);
 
     // build (trivial) look up table for zone
     zone.buildLUT();
@@ -154,8 +146,332 @@ getBVec(benchmark::State& state)
 
 BENCHMARK(getBVec)->RangeMultiplier(2)->Range(1024,8192);
 
+void
+getBDeriv(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  double z0 = z;
+  double r0 = 1200;
+  double phi0 = phi;
+  double xyz[3] = { 0, 0, 0 };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
 
+  double r1 = r0 + 5;
+  xyz[0] = r1 * cos(phi0);
+  xyz[1] = r1 * sin(phi0);
+  xyz[2] = z0;
+  // fill the cache, pass in current scale factor
+  BFieldCache cache3d;
+  // do interpolation (cache3d has correct scale factor)
+  data.zone.getCache(z, r, phi, cache3d, 1);
 
-// main
-BENCHMARK_MAIN();
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      cache3d.getB(xyz, r1, phi, bxyz, derivatives);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBDeriv)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getBVecDeriv(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  double z0 = z;
+  double r0 = 1200;
+  double phi0 = phi;
+  double xyz[3] = { 0, 0, 0 };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+
+  double r1 = r0 + 5;
+  xyz[0] = r1 * cos(phi0);
+  xyz[1] = r1 * sin(phi0);
+  xyz[2] = z0;
+  // fill the cache, pass in current scale factor
+  BFieldCache cache3d;
+  // do interpolation (cache3d has correct scale factor)
+  data.zone.getCache(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      cache3d.getBVec(xyz, r1, phi, bxyz, derivatives);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBVecDeriv)->RangeMultiplier(2)->Range(1024, 8192);
+
+// the tricubic interpolation. Arg(1) also computes the derivatives.
+void
+getBCubic(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  const double r1 = 1205;
+  const double xyz[3] = { r1 * cos(phi), r1 * sin(phi), z };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+  BFieldCacheCubic cache;
+  data.zone.getCache(z, r, phi, cache, 1);
+  double* deriv = state.range(0) ? derivatives : nullptr;
+
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      cache.getB(xyz, r1, phi, bxyz, deriv);
+      benchmark::DoNotOptimize(bxyz);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBCubic)->Arg(0)->Arg(1);
+
+// getBVec on the beam line, r = 0, where the direction of the bin
+// phimin is used. Arg(1) passes the precomputed 1/r of a point at r > 0.
+void
+getBVecAxis(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  const bool axis = state.range(0) == 0;
+  const double r1 = axis ? 0. : 1205.;
+  const double invr = axis ? 0. : 1. / r1;
+  const double xyz[3] = { r1 * cos(phi), r1 * sin(phi), z };
+  double bxyz[3] = { 0, 0, 0 };
+  BFieldCache cache3d;
+  data.zone.getCacheVec(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      cache3d.getBVec(xyz, r1, invr, phi, bxyz);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(getBVecAxis)->Arg(0)->Arg(1);
+
+// getBVec specialized at compile time, the scale folded into the cache
+// if foldScale
+template<bool withDeriv, bool foldScale>
+void
+getBVecT(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  double z0 = z;
+  double r0 = 1200;
+  double phi0 = phi;
+  double xyz[3] = { 0, 0, 0 };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+
+  double r1 = r0 + 5;
+  xyz[0] = r1 * cos(phi0);
+  xyz[1] = r1 * sin(phi0);
+  xyz[2] = z0;
+  BFieldCache cache3d;
+  data.zone.getCacheVec<foldScale>(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      cache3d.getBVec<withDeriv, foldScale>(
+        xyz, r1, phi, bxyz, withDeriv ? derivatives : nullptr);
+      benchmark::DoNotOptimize(bxyz);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK_TEMPLATE(getBVecT, false, false)
+  ->RangeMultiplier(2)
+  ->Range(1024, 8192);
+BENCHMARK_TEMPLATE(getBVecT, false, true)
+  ->RangeMultiplier(2)
+  ->Range(1024, 8192);
+BENCHMARK_TEMPLATE(getBVecT, true, false)
+  ->RangeMultiplier(2)
+  ->Range(1024, 8192);
+BENCHMARK_TEMPLATE(getBVecT, true, true)
+  ->RangeMultiplier(2)
+  ->Range(1024, 8192);
+
+void
+getBVecF(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  double z0 = z;
+  double r0 = 1200;
+  double phi0 = phi;
+  double xyz[3] = { 0, 0, 0 };
+  double bxyz[3] = { 0, 0, 0 };
+
+  double r1 = r0 + 5;
+  xyz[0] = r1 * cos(phi0);
+  xyz[1] = r1 * sin(phi0);
+  xyz[2] = z0;
+  // fill the single precision cache, pass in current scale factor
+  BFieldCacheF cache3d;
+  data.zone.getCacheVec(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      cache3d.getBVec(xyz, r1, phi, bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(getBVecF)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getBVecFDeriv(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  double z0 = z;
+  double r0 = 1200;
+  double phi0 = phi;
+  double xyz[3] = { 0, 0, 0 };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+
+  double r1 = r0 + 5;
+  xyz[0] = r1 * cos(phi0);
+  xyz[1] = r1 * sin(phi0);
+  xyz[2] = z0;
+  // fill the single precision cache, pass in current scale factor
+  BFieldCacheF cache3d;
+  data.zone.getCacheVec(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      cache3d.getBVec(xyz, r1, phi, bxyz, derivatives);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBVecFDeriv)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getBBatch(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  const int n = state.range(0);
+  // n points spread over the bin, in SoA form
+  std::vector<double> x(n);
+  std::vector<double> y(n);
+  std::vector<double> zv(n);
+  std::vector<double> rv(n);
+  std::vector<double> phiv(n);
+  std::vector<double> bx(n);
+  std::vector<double> by(n);
+  std::vector<double> bz(n);
+  for (int i = 0; i < n; ++i) {
+    rv[i] = 1230. + (40. * i) / n;
+    phiv[i] = phi + (0.5 * i) / n;
+    zv[i] = z + (100. * i) / n;
+    x[i] = rv[i] * cos(phiv[i]);
+    y[i] = rv[i] * sin(phiv[i]);
+  }
+  // fill the cache, pass in current scale factor
+  BFieldCache cache3d;
+  data.zone.getCache(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    cache3d.getBBatch(x.data(),
+                      y.data(),
+                      zv.data(),
+                      rv.data(),
+                      phiv.data(),
+                      n,
+                      bx.data(),
+                      by.data(),
+                      bz.data(),
+                      nullptr);
+    benchmark::DoNotOptimize(bx.data());
+  }
+}
+
+BENCHMARK(getBBatch)->RangeMultiplier(2)->Range(1024, 8192);
+
+// the solenoid: interpolation in a 3d BFieldMesh<double> bin
+// (BFieldCache::getBVec) or in the 2d (z, r) bin (BFieldCacheZR::getB).
+// Arg(1) also computes the derivatives.
+void
+getBSolenoid(benchmark::State& state)
+{
+  const BFieldMesh<double> mesh =
+    generateSolenoid(-3000., 3000., 121, 0., 1200., 25, 9);
+  const double z{ 100 }, r{ 500 }, phi{ 1.6 };
+  const double xyz[3] = { r * cos(phi), r * sin(phi), z };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+  double* deriv = state.range(0) ? derivatives : nullptr;
+  BFieldCache cache3d;
+  mesh.getCacheVec(z, r, phi, cache3d, 1);
+
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      cache3d.getBVec(xyz, r, phi, bxyz, deriv);
+      benchmark::DoNotOptimize(bxyz);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBSolenoid)->Arg(0)->Arg(1);
+
+void
+getBSolenoidZR(benchmark::State& state)
+{
+  const BFieldMeshZR mesh =
+    generateSolenoidZR(-3000., 3000., 121, 0., 1200., 25);
+  const double z{ 100 }, r{ 500 }, phi{ 1.6 };
+  const double xyz[3] = { r * cos(phi), r * sin(phi), z };
+  double bxyz[3] = { 0, 0, 0 };
+  double derivatives[9] = { 0 };
+  double* deriv = state.range(0) ? derivatives : nullptr;
+  BFieldCacheZR cacheZR;
+  mesh.getCache(z, r, cacheZR, 1);
+
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      cacheZR.getB(xyz, r, bxyz, deriv);
+      benchmark::DoNotOptimize(bxyz);
+      benchmark::DoNotOptimize(derivatives);
+    }
+  }
+}
+
+BENCHMARK(getBSolenoidZR)->Arg(0)->Arg(1);
+
+// main, adding the instruction set of the kernels to the context
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::AddCustomContext("isa", BFieldActiveISA());
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
 
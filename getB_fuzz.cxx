@@ -0,0 +1,607 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// getB_fuzz.cxx
+//
+// Randomized regression test of the field look-ups: every fast path is
+// compared, point by point, with the scalar reference,
+// BFieldMesh::getCache followed by BFieldCache::getB,
+//  - vec   : BFieldMesh::getCacheVec and BFieldCache::getBVec
+//  - fused : BFieldMap::getB, through BFieldMesh::getB
+//  - batch : BFieldMap::getBBinned, through BFieldCache::getBBatch
+//  - float : BFieldMesh::getCacheVec and BFieldCacheF::getBVec
+//  - flat  : bfieldFlatGetBBatch on the export of the map
+// The differences are in ulps of the field scale of the point: the
+// largest component of B, and for the derivatives the largest of them
+// and of |B| / r, which the derivatives of the components along phi
+// contain. The float path is held to the bound of BFieldCacheF.h.
+// Outside the map, the paths returning zero must do so exactly.
+//
+// The points are uniform over a toroid-like map and around it, on and
+// next to the mesh edges of its zones, around the phi wrap-around at
+// phi = +-pi, and on a map reaching the axis, some at r = 0.
+//
+// Usage:
+//   getB_fuzz [npoints]
+//     the comparisons, on 2^20 points by default. The exit status is 1
+//     if any path is off.
+//   getB_fuzz --perf baseline [threshold]
+//     the ns per call of each path, on random points of the toroid-like
+//     map, compared with the baseline file ("path ns" lines): the exit
+//     status is 1 if any is slower than the baseline by more than the
+//     fraction threshold, 0.2 by default. A missing baseline is written.
+//   getB_fuzz --perf-update baseline
+//     (re)write the baseline file.
+//
+#include "BFieldCache.h"
+#include "BFieldCacheF.h"
+#include "BFieldFlatBuffers.h"
+#include "BFieldGenerator.h"
+#include "BFieldMap.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// tolerated differences to the reference, in ulps of the field scale
+constexpr double vecUlps = 16;
+constexpr double fusedUlps = 16;
+constexpr double batchUlps = 16;
+constexpr double flatUlps = 0;
+
+constexpr double eps = std::numeric_limits<double>::epsilon();
+// the field scale of a zero field
+constexpr double minScale = std::numeric_limits<double>::min();
+
+// a 4 x 2 x 8 zone toroid-like map, sector 0 crossing phi = 0
+BFieldMap
+toroidMap()
+{
+  return generateMap(4, 2, 8, 10, 6, 8, 12000., 4000., 10000.);
+}
+
+// 4 phi sectors from the axis, r = 0, to r = 3000
+BFieldMap
+axisMap()
+{
+  BFieldMap map;
+  for (int iphi = 0; iphi < 4; ++iphi) {
+    BFieldZone zone(iphi,
+                    -2000.,
+                    2000.,
+                    500.,
+                    3000.,
+                    (iphi - 0.5) * M_PI / 2,
+                    (iphi + 0.5) * M_PI / 2,
+                    1e-07);
+    generateZoneField(zone, 9, 7, 6);
+    // the field generated from r = 500, the first plane moved to the axis
+    zone.adjustMin(1, 0.);
+    zone.buildLUT();
+    map.appendZone(std::move(zone));
+  }
+  map.buildLUT();
+  return map;
+}
+
+// the points to check, x, y, z each
+struct Points
+{
+  std::vector<double> xyz;
+  void add(double x, double y, double z) { xyz.insert(xyz.end(), { x, y, z }); }
+  void addPolar(double r, double phi, double z)
+  {
+    add(r * std::cos(phi), r * std::sin(phi), z);
+  }
+  size_t size() const { return xyz.size() / 3; }
+};
+
+// uniform over the region of the map, and 10% beyond it in z and r
+void
+addUniform(const BFieldMap& map, size_t n, std::mt19937_64& gen, Points& p)
+{
+  double lo[2] = { map.zone(0).zmin(), map.zone(0).rmin() };
+  double hi[2] = { map.zone(0).zmax(), map.zone(0).rmax() };
+  for (unsigned k = 1; k < map.nzones(); ++k) {
+    for (int j = 0; j < 2; ++j) {
+      lo[j] = std::min(lo[j], map.zone(k).min(j));
+      hi[j] = std::max(hi[j], map.zone(k).max(j));
+    }
+  }
+  std::uniform_real_distribution<double> zdist(lo[0] - 0.1 * (hi[0] - lo[0]),
+                                               hi[0] + 0.1 * (hi[0] - lo[0]));
+  std::uniform_real_distribution<double> rdist(
+    std::max(0., lo[1] - 0.1 * (hi[1] - lo[1])), hi[1] + 0.1 * (hi[1] - lo[1]));
+  std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+  for (size_t i = 0; i < n; ++i) {
+    p.addPolar(rdist(gen), phidist(gen), zdist(gen));
+  }
+}
+
+// on the mesh edges of random zones, one ulp either side, or inside
+// the bin, independently along z, r and phi
+void
+addEdges(const BFieldMap& map, size_t n, std::mt19937_64& gen, Points& p)
+{
+  std::uniform_int_distribution<unsigned> zonedist(0, map.nzones() - 1);
+  std::uniform_int_distribution<int> modedist(0, 3);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  for (size_t i = 0; i < n; ++i) {
+    const BFieldZone& zone = map.zone(zonedist(gen));
+    double pos[3];
+    for (int j = 0; j < 3; ++j) {
+      std::uniform_int_distribution<unsigned> edgedist(0, zone.nmesh(j) - 1);
+      const unsigned e = edgedist(gen);
+      const double edge = zone.mesh(j, e);
+      switch (modedist(gen)) {
+        case 0:
+          pos[j] = edge;
+          break;
+        case 1:
+          pos[j] = std::nextafter(edge, -1e300);
+          break;
+        case 2:
+          pos[j] = std::nextafter(edge, 1e300);
+          break;
+        default:
+          const unsigned b = std::min(e, zone.nmesh(j) - 2);
+          pos[j] = zone.mesh(j, b) +
+                   unit(gen) * (zone.mesh(j, b + 1) - zone.mesh(j, b));
+      }
+    }
+    p.addPolar(pos[1], pos[2], pos[0]);
+  }
+}
+
+// around phi = +-pi, where atan2 jumps, and phi = 0, inside the zone
+// crossing it
+void
+addWrap(const BFieldMap& map, size_t n, std::mt19937_64& gen, Points& p)
+{
+  const BFieldZone& zone = map.zone(0);
+  std::uniform_real_distribution<double> zdist(zone.zmin(), zone.zmax());
+  std::uniform_real_distribution<double> rdist(zone.rmin(), zone.rmax());
+  std::uniform_int_distribution<int> modedist(0, 5);
+  std::uniform_real_distribution<double> tiny(-1e-12, 1e-12);
+  for (size_t i = 0; i < n; ++i) {
+    const double r = rdist(gen);
+    const double z = zdist(gen);
+    switch (modedist(gen)) {
+      case 0:
+        p.add(-r, 0., z); // phi = pi
+        break;
+      case 1:
+        p.add(-r, -0., z); // phi = -pi
+        break;
+      case 2:
+        p.add(-r, r * tiny(gen), z);
+        break;
+      case 3:
+        p.add(r, 0., z);
+        break;
+      case 4:
+        p.add(r, -0., z);
+        break;
+      default:
+        p.add(r, r * tiny(gen), z);
+    }
+  }
+}
+
+// on the axis, with both signs of zero, at tiny r, and uniform
+void
+addAxis(const BFieldMap& map, size_t n, std::mt19937_64& gen, Points& p)
+{
+  const double zmin = map.zone(0).zmin();
+  const double zmax = map.zone(0).zmax();
+  std::uniform_real_distribution<double> zdist(zmin, zmax);
+  std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+  std::uniform_int_distribution<int> modedist(0, 3);
+  for (size_t i = 0; i < n / 2; ++i) {
+    const double z = zdist(gen);
+    switch (modedist(gen)) {
+      case 0:
+        p.add(0., 0., z);
+        break;
+      case 1:
+        p.add(-0., 0., z);
+        break;
+      case 2:
+        p.add(0., -0., z);
+        break;
+      default:
+        p.addPolar(1e-300, phidist(gen), z);
+    }
+  }
+  addUniform(map, n - n / 2, gen, p);
+}
+
+// the largest differences of one path, in ulps of the field scale
+struct PathStats
+{
+  const char* name;
+  double tolerance;
+  size_t npoints = 0;
+  size_t nfailed = 0;
+  double maxB = 0;
+  double maxDeriv = 0;
+  // compare B[3] and deriv[9] with the reference
+  void check(const double* refB,
+             const double* refDeriv,
+             double scaleB,
+             double scaleDeriv,
+             const double* B,
+             const double* deriv)
+  {
+    ++npoints;
+    double diffB = 0;
+    double diffDeriv = 0;
+    for (int j = 0; j < 3; ++j) {
+      diffB = std::max(diffB, std::fabs(B[j] - refB[j]) / scaleB);
+    }
+    for (int j = 0; j < 9; ++j) {
+      diffDeriv =
+        std::max(diffDeriv, std::fabs(deriv[j] - refDeriv[j]) / scaleDeriv);
+    }
+    // NaN compares false
+    if (!(diffB <= tolerance && diffDeriv <= tolerance)) {
+      ++nfailed;
+    }
+    maxB = std::max(maxB, diffB);
+    maxDeriv = std::max(maxDeriv, diffDeriv);
+  }
+  void print() const
+  {
+    std::cout << "  " << name << ": " << npoints << " points, max "
+              << maxB << " (B) and " << maxDeriv
+              << " (derivatives), tolerance " << tolerance;
+    if (nfailed) {
+      std::cout << ", " << nfailed << " points differ";
+    }
+    std::cout << '\n';
+  }
+};
+
+// the bound of BFieldCacheF.h, per zone
+struct FloatBound
+{
+  double field;       // 1e-6 * bscale * the largest field value
+  double invWidth[3]; // 1 / the smallest bin size along z, r, phi
+};
+
+FloatBound
+floatBound(const BFieldZone& zone)
+{
+  FloatBound bound;
+  double maxField = 0;
+  for (unsigned i = 0; i < zone.nfield(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      maxField = std::max(maxField, std::fabs(double(zone.field(i)[j])));
+    }
+  }
+  bound.field = 1e-6 * zone.bscale() * maxField;
+  for (int j = 0; j < 3; ++j) {
+    double width = std::numeric_limits<double>::max();
+    for (unsigned i = 0; i + 1 < zone.nmesh(j); ++i) {
+      width = std::min(width, zone.mesh(j, i + 1) - zone.mesh(j, i));
+    }
+    bound.invWidth[j] = 1. / width;
+  }
+  return bound;
+}
+
+// all the paths on the points p of map; returns the number of failed
+// points
+size_t
+checkMap(const char* title, const BFieldMap& map, const Points& p)
+{
+  const size_t n = p.size();
+  const BFieldFlatBuffers flatBuffers(map);
+  std::vector<double> batchB(3 * n);
+  std::vector<double> batchDeriv(9 * n);
+  std::vector<double> flatB(3 * n);
+  std::vector<double> flatDeriv(9 * n);
+  map.getBBinned(p.xyz.data(), n, batchB.data(), batchDeriv.data());
+  bfieldFlatGetBBatch(
+    flatBuffers.view(), p.xyz.data(), n, flatB.data(), flatDeriv.data());
+  std::vector<FloatBound> bounds;
+  for (unsigned k = 0; k < map.nzones(); ++k) {
+    bounds.push_back(floatBound(map.zone(k)));
+  }
+
+  PathStats vec{ "vec", vecUlps };
+  PathStats fused{ "fused", fusedUlps };
+  PathStats batch{ "batch", batchUlps };
+  PathStats flat{ "flat", flatUlps };
+  // in units of the bound
+  PathStats single{ "float", 1. };
+  size_t ninside = 0;
+  size_t noutside = 0;
+  size_t nzeroFailed = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const double* xyz = &p.xyz[3 * i];
+    const double r = std::sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1]);
+    const double phi = std::atan2(xyz[1], xyz[0]);
+    double fusedB[3];
+    double fusedDeriv[9];
+    map.getB(xyz, fusedB, fusedDeriv);
+    const BFieldZone* zone = map.findZone(xyz[2], r, phi);
+    if (!zone) {
+      ++noutside;
+      for (int j = 0; j < 3; ++j) {
+        nzeroFailed += (fusedB[j] != 0 || batchB[3 * i + j] != 0 ||
+                        flatB[3 * i + j] != 0);
+      }
+      for (int j = 0; j < 9; ++j) {
+        nzeroFailed += (fusedDeriv[j] != 0 || batchDeriv[9 * i + j] != 0 ||
+                        flatDeriv[9 * i + j] != 0);
+      }
+      continue;
+    }
+    ++ninside;
+    BFieldCache cache;
+    double refB[3];
+    double refDeriv[9];
+    zone->getCache(xyz[2], r, phi, cache);
+    cache.getB(xyz, r, phi, refB, refDeriv);
+    const double invr = r > 0 ? 1. / r : 0.;
+    double maxB = 0;
+    double maxDeriv = 0;
+    for (int j = 0; j < 3; ++j) {
+      maxB = std::max(maxB, std::fabs(refB[j]));
+    }
+    for (int j = 0; j < 9; ++j) {
+      maxDeriv = std::max(maxDeriv, std::fabs(refDeriv[j]));
+    }
+    const double scaleB = eps * std::max(maxB, minScale);
+    const double scaleDeriv =
+      eps * std::max({ maxDeriv, maxB * invr, minScale });
+
+    BFieldCache vecCache;
+    double B[3];
+    double deriv[9];
+    zone->getCacheVec(xyz[2], r, phi, vecCache);
+    vecCache.getBVec(xyz, r, phi, B, deriv);
+    vec.check(refB, refDeriv, scaleB, scaleDeriv, B, deriv);
+    fused.check(refB, refDeriv, scaleB, scaleDeriv, fusedB, fusedDeriv);
+    batch.check(refB,
+                refDeriv,
+                scaleB,
+                scaleDeriv,
+                &batchB[3 * i],
+                &batchDeriv[9 * i]);
+    flat.check(
+      refB, refDeriv, scaleB, scaleDeriv, &flatB[3 * i], &flatDeriv[9 * i]);
+
+    BFieldCacheF floatCache;
+    zone->getCacheVec(xyz[2], r, phi, floatCache);
+    floatCache.getBVec(xyz, r, phi, B, deriv);
+    const FloatBound& bound = bounds[zone - &map.zone(0)];
+    // at r = 0 the derivative bound is infinite
+    const double boundDeriv =
+      bound.field * (bound.invWidth[0] + bound.invWidth[1] +
+                     (bound.invWidth[2] + 1.) / r);
+    single.check(refB, refDeriv, bound.field, boundDeriv, B, deriv);
+  }
+
+  std::cout << ' ' << title << ": " << ninside << " points inside, "
+            << noutside << " outside" << '\n';
+  if (nzeroFailed) {
+    std::cout << "  " << nzeroFailed << " values outside the map differ from 0"
+              << '\n';
+  }
+  size_t nfailed = nzeroFailed;
+  for (const PathStats* path : { &vec, &fused, &batch, &single, &flat }) {
+    path->print();
+    nfailed += path->nfailed;
+  }
+  return nfailed;
+}
+
+// the comparisons on npoints points
+int
+fuzz(size_t npoints)
+{
+  std::mt19937_64 gen(20201001);
+  const BFieldMap toroid = toroidMap();
+  const BFieldMap axis = axisMap();
+  Points uniform;
+  Points edges;
+  Points wrap;
+  Points onAxis;
+  addUniform(toroid, npoints / 2, gen, uniform);
+  addEdges(toroid, npoints / 4, gen, edges);
+  addWrap(toroid, npoints / 8, gen, wrap);
+  addAxis(axis, npoints - npoints / 2 - npoints / 4 - npoints / 8, gen, onAxis);
+  std::cout << " vectorized kernels: " << BFieldActiveISA() << " variant"
+            << '\n';
+  std::cout << " differences to getCache + getB, in ulps of the field scale"
+            << '\n';
+  size_t nfailed = 0;
+  nfailed += checkMap("uniform", toroid, uniform);
+  nfailed += checkMap("mesh edges", toroid, edges);
+  nfailed += checkMap("phi wrap-around", toroid, wrap);
+  nfailed += checkMap("axis", axis, onAxis);
+  std::cout << ' ' << nfailed << " failed points" << '\n';
+  return nfailed ? 1 : 0;
+}
+
+// the best of 5 timings of f over n points, in ns per point
+template<class F>
+double
+nsPerCall(size_t n, F f)
+{
+  double best = std::numeric_limits<double>::max();
+  for (int rep = 0; rep < 5; ++rep) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / n);
+  }
+  return best;
+}
+
+// the ns per call of each path, for the field only
+std::map<std::string, double>
+timePaths()
+{
+  std::mt19937_64 gen(20201001);
+  const BFieldMap map = toroidMap();
+  const BFieldFlatBuffers flatBuffers(map);
+  const BFieldFlatMap flatMap = flatBuffers.view();
+  Points p;
+  addUniform(map, 1 << 16, gen, p);
+  const size_t n = p.size();
+  std::vector<double> r(n);
+  std::vector<double> phi(n);
+  std::vector<const BFieldZone*> zones(n);
+  for (size_t i = 0; i < n; ++i) {
+    const double* xyz = &p.xyz[3 * i];
+    r[i] = std::sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1]);
+    phi[i] = std::atan2(xyz[1], xyz[0]);
+    zones[i] = map.findZone(xyz[2], r[i], phi[i]);
+  }
+  std::vector<double> B(3 * n);
+  // the looked up bin, without the zone search
+  auto perBin = [&](auto fill) {
+    return [&, fill]() {
+      for (size_t i = 0; i < n; ++i) {
+        if (zones[i]) {
+          fill(*zones[i], &p.xyz[3 * i], r[i], phi[i], &B[3 * i]);
+        }
+      }
+    };
+  };
+  std::map<std::string, double> ns;
+  ns["scalar"] = nsPerCall(
+    n,
+    perBin([](const BFieldZone& zone,
+              const double* xyz,
+              double r,
+              double phi,
+              double* B) {
+      BFieldCache cache;
+      zone.getCache(xyz[2], r, phi, cache);
+      cache.getB(xyz, r, phi, B);
+    }));
+  ns["vec"] = nsPerCall(
+    n,
+    perBin([](const BFieldZone& zone,
+              const double* xyz,
+              double r,
+              double phi,
+              double* B) {
+      BFieldCache cache;
+      zone.getCacheVec(xyz[2], r, phi, cache);
+      cache.getBVec(xyz, r, phi, B);
+    }));
+  ns["float"] = nsPerCall(
+    n,
+    perBin([](const BFieldZone& zone,
+              const double* xyz,
+              double r,
+              double phi,
+              double* B) {
+      BFieldCacheF cache;
+      zone.getCacheVec(xyz[2], r, phi, cache);
+      cache.getBVec(xyz, r, phi, B);
+    }));
+  ns["fused"] = nsPerCall(n, [&]() {
+    for (size_t i = 0; i < n; ++i) {
+      map.getB(&p.xyz[3 * i], &B[3 * i]);
+    }
+  });
+  ns["batch"] =
+    nsPerCall(n, [&]() { map.getBBinned(p.xyz.data(), n, B.data()); });
+  ns["flat"] = nsPerCall(n, [&]() {
+    bfieldFlatGetBBatch(flatMap, p.xyz.data(), n, B.data());
+  });
+  return ns;
+}
+
+bool
+writeBaseline(const std::string& path, const std::map<std::string, double>& ns)
+{
+  std::ofstream out(path);
+  for (const auto& entry : ns) {
+    out << entry.first << ' ' << entry.second << '\n';
+  }
+  return bool(out.flush());
+}
+
+// the timings against the baseline at path, written if missing or update
+int
+perf(const std::string& path, double threshold, bool update)
+{
+  const std::map<std::string, double> ns = timePaths();
+  std::map<std::string, double> baseline;
+  std::ifstream in(path);
+  std::string name;
+  double value;
+  while (in >> name >> value) {
+    baseline[name] = value;
+  }
+  if (update || baseline.empty()) {
+    if (!writeBaseline(path, ns)) {
+      std::cout << " cannot write the baseline " << path << '\n';
+      return 1;
+    }
+    for (const auto& entry : ns) {
+      std::cout << "  " << entry.first << ": " << entry.second << " ns"
+                << '\n';
+    }
+    std::cout << " baseline written to " << path << '\n';
+    return 0;
+  }
+  int nslower = 0;
+  for (const auto& entry : ns) {
+    std::cout << "  " << entry.first << ": " << entry.second << " ns";
+    const auto base = baseline.find(entry.first);
+    if (base == baseline.end()) {
+      std::cout << ", not in the baseline" << '\n';
+      continue;
+    }
+    const double ratio = entry.second / base->second;
+    std::cout << ", " << ratio << " x the baseline " << base->second << " ns";
+    if (ratio > 1. + threshold) {
+      std::cout << ", slower than " << 1. + threshold << " x";
+      ++nslower;
+    }
+    std::cout << '\n';
+  }
+  std::cout << ' ' << nslower << " paths slower than the baseline" << '\n';
+  return nslower ? 1 : 0;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  if (argc >= 3 && std::strcmp(argv[1], "--perf") == 0) {
+    return perf(argv[2], argc >= 4 ? std::atof(argv[3]) : 0.2, false);
+  }
+  if (argc >= 3 && std::strcmp(argv[1], "--perf-update") == 0) {
+    return perf(argv[2], 0., true);
+  }
+  if (argc >= 2 && argv[1][0] == '-') {
+    std::cout << "usage: " << argv[0] << " [npoints]" << '\n'
+              << "       " << argv[0] << " --perf baseline [threshold]" << '\n'
+              << "       " << argv[0] << " --perf-update baseline" << '\n';
+    return 2;
+  }
+  return fuzz(argc >= 2 ? std::strtoull(argv[1], nullptr, 10) : 1 << 20);
+}
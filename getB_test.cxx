@@ -3,8 +3,22 @@
 */
 
 #include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldFlatBuffers.h"
+#include "BFieldGenerator.h"
+#include "BFieldMapCache.h"
+#include "BFieldMapFile.h"
+#include "BFieldMultiCache.h"
+#include "BFieldStats.h"
 #include "BFieldZone.h"
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
 
 constexpr int nmeshz{ 4 };
 constexpr int nmeshr{ 5 };
@@ -94,12 +108,35 @@ struct BFieldData
   }
 };
 
+// fills the zones of a map from those of source, failing on zone skip
+struct SkipZoneLoader : public BFieldZoneLoader
+{
+  SkipZoneLoader(const BFieldMap& source, size_t skip)
+    : source(source)
+    , skip(skip)
+  {}
+  bool load(size_t i, BFieldZone& zone) const override
+  {
+    if (i == skip || !source.loadZone(i)) {
+      return false;
+    }
+    zone = source.zone(i);
+    return true;
+  }
+  const BFieldMap& source;
+  size_t skip;
+};
+
 int
 main()
 {
 
+  std::cout << " vectorized kernels: " << BFieldActiveISA() << " variant"
+            << '\n';
   BFieldData data{};
   double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  // the checks that failed, each printed with "differs"
+  int nfailures = 0;
 
   double z0 = z;
   double r0 = 1200;
@@ -132,6 +169,7 @@ main()
 
     for (int j = 0; j < 3; ++j) {
       if (fabs(bxyz[j] - bxyzvec[j]) > 1e-14) {
+        ++nfailures;
         std::cout << " bxyz[" << j << "] differs " << fabs(bxyz[j] - bxyzvec[j])
                   << '\n';
       } else {
@@ -141,6 +179,7 @@ main()
     }
     for (int j = 0; j < 9; ++j) {
       if (fabs(derivatives[j] - derivativesvec[j]) > 1e-14) {
+        ++nfailures;
         std::cout << " derivatives[" << j << "] differs " << fabs(derivatives[j] - derivativesvec[j])  <<'\n';
       } else {
         std::cout << " derivatives[" << j << "] diff "
@@ -148,6 +187,1506 @@ main()
       }
     }
   }
-  return 0;
-}
 
+  // batched interpolation, compared against the scalar getB
+  std::cout << '\n' << " ----  getBBatch ----" << '\n';
+  constexpr size_t nbatch = 11;
+  double bx[nbatch];
+  double by[nbatch];
+  double bz[nbatch];
+  double px[nbatch];
+  double py[nbatch];
+  double pz[nbatch];
+  double pr[nbatch];
+  double pphi[nbatch];
+  double derivbatch[9 * nbatch];
+  BFieldCache cacheBatch;
+  data.zone.getCacheVec(z, r, phi, cacheBatch, 1);
+  for (size_t i = 0; i < nbatch; ++i) {
+    // points at r = 0 in a vector lane and in the scalar tail,
+    // one point needing the phi wrap-around
+    pr[i] = (i == 5 || i == nbatch - 1) ? 0 : 1230. + i * 2.;
+    pphi[i] = (i == 3) ? phi - 2 * M_PI : phi + 0.01 * i;
+    pz[i] = z0 + 10. * i;
+    px[i] = pr[i] * cos(pphi[i]);
+    py[i] = pr[i] * sin(pphi[i]);
+  }
+  cacheBatch.getBBatch(px, py, pz, pr, pphi, nbatch, bx, by, bz, derivbatch);
+  for (size_t i = 0; i < nbatch; ++i) {
+    const double pxyz[3] = { px[i], py[i], pz[i] };
+    cacheBatch.getB(pxyz, pr[i], pphi[i], bxyz, derivatives);
+    const double bbatch[3] = { bx[i], by[i], bz[i] };
+    for (int j = 0; j < 3; ++j) {
+      if (fabs(bxyz[j] - bbatch[j]) > 1e-14) {
+        ++nfailures;
+        std::cout << " point " << i << " bxyz[" << j << "] differs "
+                  << fabs(bxyz[j] - bbatch[j]) << '\n';
+      }
+    }
+    for (int j = 0; j < 9; ++j) {
+      const double dbatch = derivbatch[j * nbatch + i];
+      if (fabs(derivatives[j] - dbatch) > 1e-14) {
+        ++nfailures;
+        std::cout << " point " << i << " derivatives[" << j << "] differs "
+                  << fabs(derivatives[j] - dbatch) << '\n';
+      }
+    }
+  }
+  std::cout << " getBBatch checked " << nbatch << " points" << '\n';
+
+  // fused locate and interpolate, compared against getCacheVec + getBVec
+  std::cout << '\n' << " ----  BFieldMesh::getB ----" << '\n';
+  constexpr int nfused = 20;
+  for (int i = 0; i < nfused; ++i) {
+    // points spread over all the bins of the zone
+    const double fz = -1390. + i * 2780. / (nfused - 1);
+    const double fr = 1201. + i * 98. / (nfused - 1);
+    const double fphi = -3.1 + i * 6.2 / (nfused - 1);
+    const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), fz };
+    BFieldCache cacheFused;
+    data.zone.getCacheVec(fz, fr, fphi, cacheFused, 1);
+    cacheFused.getBVec(fxyz, fr, fphi, bxyz, derivatives);
+    data.zone.getB(fxyz, fr, fphi, bxyzvec, derivativesvec, 1);
+    for (int j = 0; j < 3; ++j) {
+      if (bxyz[j] != bxyzvec[j]) {
+        ++nfailures;
+        std::cout << " point " << i << " bxyz[" << j << "] differs "
+                  << fabs(bxyz[j] - bxyzvec[j]) << '\n';
+      }
+    }
+    for (int j = 0; j < 9; ++j) {
+      if (derivatives[j] != derivativesvec[j]) {
+        ++nfailures;
+        std::cout << " point " << i << " derivatives[" << j << "] differs "
+                  << fabs(derivatives[j] - derivativesvec[j]) << '\n';
+      }
+    }
+  }
+  std::cout << " BFieldMesh::getB checked " << nfused << " points" << '\n';
+
+  // single precision cache, compared against the double precision one
+  // within the bound documented in BFieldCacheF.h
+  std::cout << '\n' << " ----  BFieldCacheF::getBVec ----" << '\n';
+  double maxField = 0;
+  for (int j = 0; j < nfield; ++j) {
+    maxField = std::max({ maxField,
+                          fabs(data.fieldz[j]),
+                          fabs(data.fieldr[j]),
+                          fabs(data.fieldphi[j]) });
+  }
+  const double tolB = 1e-6 * data.bscale * maxField;
+  // smallest bin sizes of the mesh
+  double minWidth[3] = { dbl::max(), dbl::max(), dbl::max() };
+  for (int i = 0; i < 3; ++i) {
+    for (unsigned j = 0; j + 1 < data.zone.nmesh(i); ++j) {
+      minWidth[i] =
+        std::min(minWidth[i], data.zone.mesh(i, j + 1) - data.zone.mesh(i, j));
+    }
+  }
+  constexpr int nfloat = 50;
+  double maxDiffB = 0;
+  double maxDiffDeriv = 0;
+  for (int i = 0; i < nfloat; ++i) {
+    const double fz = -1390. + ((i * 7) % nfloat) * 2780. / nfloat;
+    const double fr = 1201. + ((i * 13) % nfloat) * 98. / nfloat;
+    const double fphi = -3.1 + ((i * 29) % nfloat) * 6.2 / nfloat;
+    const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), fz };
+    BFieldCache cacheDouble;
+    BFieldCacheF cacheFloat;
+    data.zone.getCacheVec(fz, fr, fphi, cacheDouble, 1);
+    data.zone.getCacheVec(fz, fr, fphi, cacheFloat, 1);
+    cacheDouble.getBVec(fxyz, fr, fphi, bxyz, derivatives);
+    cacheFloat.getBVec(fxyz, fr, fphi, bxyzvec, derivativesvec);
+    const double tolDeriv =
+      tolB * (1. / minWidth[0] + 1. / minWidth[1] +
+              1. / (fr * minWidth[2]) + 1. / fr);
+    for (int j = 0; j < 3; ++j) {
+      const double diff = fabs(bxyz[j] - bxyzvec[j]);
+      maxDiffB = std::max(maxDiffB, diff);
+      if (diff > tolB) {
+        ++nfailures;
+        std::cout << " point " << i << " bxyz[" << j << "] differs " << diff
+                  << " > " << tolB << '\n';
+      }
+    }
+    for (int j = 0; j < 9; ++j) {
+      const double diff = fabs(derivatives[j] - derivativesvec[j]);
+      maxDiffDeriv = std::max(maxDiffDeriv, diff / tolDeriv);
+      if (diff > tolDeriv) {
+        ++nfailures;
+        std::cout << " point " << i << " derivatives[" << j << "] differs "
+                  << diff << " > " << tolDeriv << '\n';
+      }
+    }
+  }
+  std::cout << " BFieldCacheF::getBVec checked " << nfloat << " points"
+            << ", max |dB| " << maxDiffB << " (bound " << tolB << ")"
+            << ", max |dDeriv|/bound " << maxDiffDeriv << '\n';
+
+  // bin-major storage, compared against the node storage
+  std::cout << '\n' << " ----  bin-major storage ----" << '\n';
+  BFieldZone binZone = data.zone;
+  binZone.buildLUT(true);
+  int nbinDiffs = 0;
+  for (int i = 0; i < nfloat; ++i) {
+    const double fz = -1390. + ((i * 7) % nfloat) * 2780. / nfloat;
+    const double fr = 1201. + ((i * 13) % nfloat) * 98. / nfloat;
+    const double fphi = -3.1 + ((i * 29) % nfloat) * 6.2 / nfloat;
+    const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), fz };
+    BFieldCache cacheNode;
+    BFieldCache cacheBin;
+    data.zone.getCacheVec(fz, fr, fphi, cacheNode, 1);
+    binZone.getCacheVec(fz, fr, fphi, cacheBin, 1);
+    cacheNode.getBVec(fxyz, fr, fphi, bxyz, derivatives);
+    cacheBin.getBVec(fxyz, fr, fphi, bxyzvec, derivativesvec);
+    double bfused[3];
+    double derivfused[9];
+    binZone.getB(fxyz, fr, fphi, bfused, derivfused, 1);
+    for (int j = 0; j < 3; ++j) {
+      nbinDiffs += (bxyz[j] != bxyzvec[j]) + (bxyz[j] != bfused[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nbinDiffs += (derivatives[j] != derivativesvec[j]) +
+                   (derivatives[j] != derivfused[j]);
+    }
+  }
+  if (nbinDiffs) {
+    ++nfailures;
+    std::cout << " bin-major storage differs in " << nbinDiffs << " values"
+              << '\n';
+  }
+  std::cout << " bin-major storage checked " << nfloat << " points"
+            << ", memSize " << data.zone.memSize() << " -> "
+            << binZone.memSize() << '\n';
+
+  // the shorts widened in registers, compared against the element-wise
+  // conversion, and the fill of every bin (the last one reaching the
+  // last node) against getCache
+  std::cout << '\n' << " ----  vconvert ----" << '\n';
+  const CxxUtils::vec<short, 8> shorts = { -32768, -1561, -1, 0,
+                                           1,      7,     19487, 32767 };
+  CxxUtils::vec<double, 8> widened;
+  CxxUtils::vconvert(widened, shorts);
+  int nconvertDiffs = 0;
+  for (int k = 0; k < 8; ++k) {
+    nconvertDiffs += widened[k] != static_cast<double>(shorts[k]);
+  }
+  int nconvertBins = 0;
+  for (int iz = 0; iz < nmeshz - 1; ++iz) {
+    for (int ir = 0; ir < nmeshr - 1; ++ir) {
+      for (int iphi = 0; iphi < nmeshphi - 1; ++iphi) {
+        const double cz = 0.5 * (data.meshz[iz] + data.meshz[iz + 1]);
+        const double cr = 0.5 * (data.meshr[ir] + data.meshr[ir + 1]);
+        const double cphi = 0.5 * (data.meshphi[iphi] + data.meshphi[iphi + 1]);
+        const double cxyz[3] = { cr * cos(cphi), cr * sin(cphi), cz };
+        BFieldCache cacheScalar;
+        BFieldCache cacheWidened;
+        data.zone.getCache(cz, cr, cphi, cacheScalar, 0.9);
+        data.zone.getCacheVec(cz, cr, cphi, cacheWidened, 0.9);
+        cacheScalar.getBVec(cxyz, cr, cphi, bxyz, derivatives);
+        cacheWidened.getBVec(cxyz, cr, cphi, bxyzvec, derivativesvec);
+        for (int j = 0; j < 3; ++j) {
+          nconvertDiffs += bxyz[j] != bxyzvec[j];
+        }
+        for (int j = 0; j < 9; ++j) {
+          nconvertDiffs += derivatives[j] != derivativesvec[j];
+        }
+        ++nconvertBins;
+      }
+    }
+  }
+  if (nconvertDiffs) {
+    ++nfailures;
+    std::cout << " vconvert or getCacheVec differs in " << nconvertDiffs
+              << " values" << '\n';
+  }
+  std::cout << " vconvert checked, getCacheVec checked " << nconvertBins
+            << " bins" << '\n';
+
+  // zone look-up of the whole map, compared against a linear scan
+  std::cout << '\n' << " ----  BFieldMap ----" << '\n';
+  const BFieldMap map = generateMap(4, 2, 8, 6, 5, 4);
+  std::mt19937 gen(12345);
+  std::uniform_real_distribution<double> zdist(-13000, 13000);
+  std::uniform_real_distribution<double> rdist(3000, 11000);
+  std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+  constexpr int nmap = 10000;
+  int nmapDiffs = 0;
+  int noutside = 0;
+  for (int i = 0; i < nmap; ++i) {
+    const double mz = zdist(gen);
+    const double mr = rdist(gen);
+    const double mphi = phidist(gen);
+    const BFieldZone* scanZone = nullptr;
+    for (unsigned k = 0; k < map.nzones(); ++k) {
+      if (map.zone(k).inside(mz, mr, mphi)) {
+        scanZone = &map.zone(k);
+        break;
+      }
+    }
+    const BFieldZone* lutZone = map.findZone(mz, mr, mphi);
+    if (scanZone != lutZone) {
+      ++nmapDiffs;
+      continue;
+    }
+    const double mxyz[3] = { mr * cos(mphi), mr * sin(mphi), mz };
+    map.getB(mxyz, bxyz, derivatives);
+    if (!scanZone) {
+      ++noutside;
+      for (int j = 0; j < 3; ++j) {
+        nmapDiffs += (bxyz[j] != 0);
+      }
+      continue;
+    }
+    scanZone->getB(mxyz, mr, mphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nmapDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-14);
+    }
+  }
+  if (nmapDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMap differs from the linear zone scan for "
+              << nmapDiffs << " points" << '\n';
+  }
+  std::cout << " BFieldMap checked " << nmap << " points (" << noutside
+            << " outside) over " << map.nzones() << " zones" << '\n';
+
+  // cached look-ups along a track, compared against the map
+  std::cout << '\n' << " ----  BFieldMapCache ----" << '\n';
+  BFieldMapCache mapCache(&map, true);
+  int nmapCacheDiffs = 0;
+  constexpr int nsteps = 2000;
+  for (int i = 0; i < nsteps; ++i) {
+    // from inside the map out through its outer r edge
+    const double s = 5. * i;
+    const double tr = 4000. + 0.7 * s;
+    const double tphi = -3. + 5e-4 * s;
+    const double txyz[3] = { tr * cos(tphi), tr * sin(tphi), -11000. + 2. * s };
+    map.getB(txyz, bxyz, derivatives);
+    mapCache.getField(txyz, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nmapCacheDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nmapCacheDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+  }
+  if (nmapCacheDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMapCache differs from BFieldMap for "
+              << nmapCacheDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldMapCache " << mapCache.hits() << " hits, "
+            << mapCache.misses() << " misses over " << nsteps << " steps"
+            << '\n';
+
+  // the 4 stage points of a step, compared against the map at each point.
+  // Off the bin edges, where the derivatives depend on the bin used.
+  std::cout << '\n' << " ----  BFieldMapCache::getFieldStages ----" << '\n';
+  BFieldMapCache stageCache(&map, true);
+  int nstageDiffs = 0;
+  for (int i = 0; i < nsteps; ++i) {
+    const double s = 5. * i;
+    const double tr = 4000.3 + 0.7 * s;
+    const double tphi = -3. + 5e-4 * s;
+    const double tnorm = std::sqrt(0.7 * 0.7 + 2. * 2. + tr * tr * 25e-8);
+    const double state[6] = { tr * cos(tphi),
+                              tr * sin(tphi),
+                              -10999.5 + 2. * s,
+                              (0.7 * cos(tphi) - tr * 5e-4 * sin(tphi)) / tnorm,
+                              (0.7 * sin(tphi) + tr * 5e-4 * cos(tphi)) / tnorm,
+                              2. / tnorm };
+    const double qop = (i % 2) ? 0.5 : -1.;
+    const double h = 10. + (i % 7) * 40.;
+    double Bstart[3];
+    map.getB(state, Bstart);
+    double Bstages[12];
+    double derivStages[36];
+    stageCache.getFieldStages(state, qop, h, Bstart, Bstages, derivStages);
+    const double k = 0.299792458 * qop;
+    const double* t = state + 3;
+    const double A[3] = { k * (t[1] * Bstart[2] - t[2] * Bstart[1]),
+                          k * (t[2] * Bstart[0] - t[0] * Bstart[2]),
+                          k * (t[0] * Bstart[1] - t[1] * Bstart[0]) };
+    const double step[4] = { 0., 0.5 * h, 0.5 * h, h };
+    for (int j = 0; j < 4; ++j) {
+      double sxyz[3];
+      for (int l = 0; l < 3; ++l) {
+        sxyz[l] = state[l] + step[j] * t[l] + 0.5 * step[j] * step[j] * A[l];
+      }
+      map.getB(sxyz, bxyz, derivatives);
+      for (int l = 0; l < 3; ++l) {
+        nstageDiffs += (fabs(bxyz[l] - Bstages[3 * j + l]) > 1e-14);
+      }
+      for (int l = 0; l < 9; ++l) {
+        nstageDiffs += (fabs(derivatives[l] - derivStages[9 * j + l]) > 1e-14);
+      }
+    }
+  }
+  if (nstageDiffs) {
+    ++nfailures;
+    std::cout << " getFieldStages differs from BFieldMap for " << nstageDiffs
+              << " values" << '\n';
+  }
+  std::cout << " getFieldStages checked " << nsteps << " steps, "
+            << stageCache.hits() << " hits, " << stageCache.misses()
+            << " misses" << '\n';
+
+  // two tracks stepped in turn, which thrash a single cache.
+  // Off the bin edges, where the derivatives depend on the bin used.
+  std::cout << '\n' << " ----  BFieldMultiCache ----" << '\n';
+  BFieldMapCache singleCache(&map, true);
+  BFieldMultiCache<4> multiCache(&map, true);
+  BFieldMultiCache<4> zoneCache;
+  int nmultiCacheDiffs = 0;
+  for (int i = 0; i < 2 * nsteps; ++i) {
+    const double s = 5. * (i / 2);
+    const double side = (i % 2) ? -1. : 1.;
+    const double tr = 4000. + 0.7 * s;
+    const double tphi = side * (-3. + 5e-4 * s);
+    const double txyz[3] = { tr * cos(tphi),
+                             tr * sin(tphi),
+                             side * (-10999.5 + 2. * s) };
+    map.getB(txyz, bxyz, derivatives);
+    singleCache.getField(txyz, bxyzvec, derivativesvec);
+    multiCache.getField(txyz, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nmultiCacheDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nmultiCacheDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+    // and filled from the zones directly, at the r and phi of getField
+    const double zr = std::sqrt(txyz[0] * txyz[0] + txyz[1] * txyz[1]);
+    const double zphi = std::atan2(txyz[1], txyz[0]);
+    const BFieldZone* tzone = map.findZone(txyz[2], zr, zphi);
+    if (tzone) {
+      zoneCache.getCache(*tzone, txyz[2], zr, zphi)
+        .getBVec(txyz, zr, zphi, bxyzvec, derivativesvec);
+      for (int j = 0; j < 3; ++j) {
+        nmultiCacheDiffs += (bxyz[j] != bxyzvec[j]);
+      }
+    }
+  }
+  if (nmultiCacheDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMultiCache differs from BFieldMap for "
+              << nmultiCacheDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldMultiCache<4> " << multiCache.hits() << " hits, "
+            << multiCache.misses() << " misses, BFieldMapCache "
+            << singleCache.hits() << " hits over " << 2 * nsteps << " steps"
+            << '\n';
+
+  // a point inside the map and one outside in turn: the outside one
+  // zeroes the field without evicting the entry of the inside one
+  BFieldMultiCache<2> outsideCache(&map, true);
+  int noutsideDiffs = 0;
+  const double insideXYZ[3] = { 4000., 100., 500. };
+  const double outsideXYZ[3] = { 4000., 100., 1e6 };
+  constexpr int nturns = 10;
+  for (int i = 0; i < nturns; ++i) {
+    map.getB(insideXYZ, bxyz, derivatives);
+    outsideCache.getField(insideXYZ, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      noutsideDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    outsideCache.getField(outsideXYZ, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      noutsideDiffs += (bxyzvec[j] != 0.);
+    }
+    for (int j = 0; j < 9; ++j) {
+      noutsideDiffs += (derivativesvec[j] != 0.);
+    }
+  }
+  noutsideDiffs += (outsideCache.hits() != nturns - 1);
+  if (noutsideDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMultiCache with points outside the map differs for "
+              << noutsideDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldMultiCache<2> " << outsideCache.hits()
+            << " hits for " << nturns << " steps inside, alternated with "
+            << nturns << " outside" << '\n';
+
+  // a batch spread over threads, compared against the map point by point,
+  // within the tolerance of getBBatch
+  std::cout << '\n' << " ----  getBParallel ----" << '\n';
+  constexpr size_t nparallel = 20000;
+  std::vector<double> pxyz(3 * nparallel);
+  for (size_t i = 0; i < nparallel; ++i) {
+    const double pr = rdist(gen);
+    const double pphi = phidist(gen);
+    pxyz[3 * i] = pr * cos(pphi);
+    pxyz[3 * i + 1] = pr * sin(pphi);
+    pxyz[3 * i + 2] = zdist(gen);
+  }
+  std::vector<double> pB(3 * nparallel);
+  std::vector<double> pderiv(9 * nparallel);
+  map.getBParallel(pxyz.data(), nparallel, pB.data(), 3, pderiv.data());
+  int nparallelDiffs = 0;
+  for (size_t i = 0; i < nparallel; ++i) {
+    map.getB(&pxyz[3 * i], bxyz, derivatives);
+    for (int j = 0; j < 3; ++j) {
+      nparallelDiffs += (fabs(bxyz[j] - pB[3 * i + j]) > 1e-14);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nparallelDiffs += (fabs(derivatives[j] - pderiv[9 * i + j]) > 1e-14);
+    }
+  }
+  if (nparallelDiffs) {
+    ++nfailures;
+    std::cout << " getBParallel differs from BFieldMap for " << nparallelDiffs
+              << " values" << '\n';
+  }
+  std::cout << " getBParallel checked " << nparallel << " points on 3 threads"
+            << '\n';
+
+  // a shuffled grid scan of a small region, so that bins hold many points
+  std::cout << '\n' << " ----  getBBinned ----" << '\n';
+  std::vector<double> gxyz;
+  for (int iz = 0; iz < 20; ++iz) {
+    for (int ir = 0; ir < 20; ++ir) {
+      for (int iphi = 0; iphi < 20; ++iphi) {
+        const double gr = 5000. + 101. * ir;
+        const double gphi = -0.2 + 0.0203 * iphi;
+        gxyz.insert(gxyz.end(),
+                    { gr * cos(gphi), gr * sin(gphi), -5900. + 397. * iz });
+      }
+    }
+  }
+  const size_t ngrid = gxyz.size() / 3;
+  std::vector<size_t> order(ngrid);
+  for (size_t i = 0; i < ngrid; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), gen);
+  std::vector<double> sxyz(3 * ngrid);
+  for (size_t i = 0; i < ngrid; ++i) {
+    std::copy(&gxyz[3 * order[i]], &gxyz[3 * order[i]] + 3, &sxyz[3 * i]);
+  }
+  std::vector<double> gB(3 * ngrid);
+  std::vector<double> gderiv(9 * ngrid);
+  map.getBBinned(sxyz.data(), ngrid, gB.data(), gderiv.data());
+  int nbinnedDiffs = 0;
+  for (size_t i = 0; i < ngrid; ++i) {
+    map.getB(&sxyz[3 * i], bxyz, derivatives);
+    for (int j = 0; j < 3; ++j) {
+      nbinnedDiffs += (fabs(bxyz[j] - gB[3 * i + j]) > 1e-14);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nbinnedDiffs += (fabs(derivatives[j] - gderiv[9 * i + j]) > 1e-14);
+    }
+  }
+  if (nbinnedDiffs) {
+    ++nfailures;
+    std::cout << " getBBinned differs from BFieldMap for " << nbinnedDiffs
+              << " values" << '\n';
+  }
+  std::cout << " getBBinned checked " << ngrid << " shuffled grid points"
+            << '\n';
+
+  // vectorized inside tests, for a zone crossing phi = 0 and one of its bins
+  std::cout << '\n' << " ----  insideVec/insideMask ----" << '\n';
+  const BFieldZone& izone = map.zone(0);
+  BFieldCache icache;
+  izone.getCacheVec(
+    izone.mesh(0, 1), izone.mesh(1, 1), izone.mesh(2, 1), icache, 1);
+  std::uniform_real_distribution<double> udist(0, 1);
+  constexpr int ninside = 1001;
+  double iz[ninside];
+  double ir[ninside];
+  double iphi[ninside];
+  for (int i = 0; i < ninside; ++i) {
+    iz[i] = izone.zmin() - 500 +
+            udist(gen) * (izone.zmax() - izone.zmin() + 1000);
+    ir[i] = izone.rmin() - 500 +
+            udist(gen) * (izone.rmax() - izone.rmin() + 1000);
+    iphi[i] = phidist(gen);
+    // a third of the points with one coordinate exactly on an edge
+    if (i % 3 == 0) {
+      const int axis = (i / 3) % 3;
+      const unsigned edge = int(udist(gen) * izone.nmesh(axis));
+      double* coord = axis == 0 ? iz : axis == 1 ? ir : iphi;
+      coord[i] = izone.mesh(axis, edge);
+    }
+  }
+  uint64_t zoneMask[(ninside + 63) / 64];
+  uint64_t cacheMask[(ninside + 63) / 64];
+  izone.insideMask(iz, ir, iphi, ninside, zoneMask);
+  icache.insideMask(iz, ir, iphi, ninside, cacheMask);
+  int ninsideDiffs = 0;
+  int nzoneInside = 0;
+  int ncacheInside = 0;
+  for (int i = 0; i < ninside; ++i) {
+    const bool inZone = izone.inside(iz[i], ir[i], iphi[i]);
+    const bool inCache = icache.inside(iz[i], ir[i], iphi[i]);
+    nzoneInside += inZone;
+    ncacheInside += inCache;
+    ninsideDiffs += (izone.insideVec(iz[i], ir[i], iphi[i]) != inZone);
+    ninsideDiffs += (icache.insideVec(iz[i], ir[i], iphi[i]) != inCache);
+    ninsideDiffs += (((zoneMask[i / 64] >> (i % 64)) & 1) != inZone);
+    ninsideDiffs += (((cacheMask[i / 64] >> (i % 64)) & 1) != inCache);
+  }
+  if (ninsideDiffs) {
+    ++nfailures;
+    std::cout << " insideVec/insideMask differs from inside for "
+              << ninsideDiffs << " tests" << '\n';
+  }
+  std::cout << " insideVec/insideMask checked " << ninside << " points ("
+            << nzoneInside << " inside the zone, " << ncacheInside
+            << " inside the bin)" << '\n';
+
+  // binary file of the map, read back as views of the mapped file
+  std::cout << '\n' << " ----  BFieldMapFile ----" << '\n';
+  int nfileDiffs = 0;
+  for (int binMajor = 0; binMajor < 2; ++binMajor) {
+    char path[] = "/tmp/getB_test_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+      ++nfailures;
+      std::cout << " BFieldMapFile cannot create a temporary file" << '\n';
+      break;
+    }
+    close(fd);
+    const BFieldMap fileSource =
+      generateMap(4, 2, 8, 6, 5, 4, 12000., 4000., 10000., binMajor);
+    BFieldMap fileMap;
+    if (!writeBFieldMap(fileSource, path) || !mapBFieldMap(path, fileMap)) {
+      ++nfailures;
+      std::cout << " BFieldMapFile differs, cannot write or map " << path
+                << '\n';
+      ++nfileDiffs;
+    }
+    // the file may go, the mapping stays
+    unlink(path);
+    // a copy shares the mapping and outlives the original
+    BFieldMap fileCopy(fileMap);
+    fileMap = BFieldMap();
+    nfileDiffs += (fileCopy.nzones() != fileSource.nzones());
+    for (unsigned k = 0; k < fileCopy.nzones(); ++k) {
+      nfileDiffs += !fileCopy.zone(k).isView();
+      nfileDiffs += (fileCopy.zone(k).binMajor() != bool(binMajor));
+    }
+    for (int i = 0; i < 1000; ++i) {
+      const double fr = rdist(gen);
+      const double fphi = phidist(gen);
+      const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), zdist(gen) };
+      fileSource.getB(fxyz, bxyz, derivatives);
+      fileCopy.getB(fxyz, bxyzvec, derivativesvec);
+      for (int j = 0; j < 3; ++j) {
+        nfileDiffs += (bxyz[j] != bxyzvec[j]);
+      }
+      for (int j = 0; j < 9; ++j) {
+        nfileDiffs += (derivatives[j] != derivativesvec[j]);
+      }
+    }
+    // a truncated file is rejected
+    if (writeBFieldMap(fileSource, path)) {
+      truncate(path, 4096);
+      nfileDiffs += mapBFieldMap(path, fileMap);
+      unlink(path);
+    }
+  }
+  if (nfileDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMapFile differs from the original map for "
+              << nfileDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldMapFile checked 1000 points, node and bin-major"
+            << '\n';
+
+  // the zones of the file filled on first look-up, by threads racing for
+  // them, bit-exact against the original map
+  std::cout << '\n' << " ----  openBFieldMap ----" << '\n';
+  int nlazyDiffs = 0;
+  {
+    char path[] = "/tmp/getB_test_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+      ++nfailures;
+      std::cout << " openBFieldMap cannot create a temporary file" << '\n';
+    } else {
+      close(fd);
+    }
+    const BFieldMap lazySource =
+      generateMap(4, 2, 8, 6, 5, 4, 12000., 4000., 10000., false);
+    BFieldMap lazyMap;
+    if (fd >= 0 && !(writeBFieldMap(lazySource, path) &&
+                     openBFieldMap(path, lazyMap))) {
+      ++nfailures;
+      std::cout << " openBFieldMap differs, cannot write or open " << path
+                << '\n';
+    }
+    nlazyDiffs += (lazyMap.nzones() != lazySource.nzones());
+    nlazyDiffs += (lazyMap.nloaded() != 0);
+    // one point fills one zone
+    const BFieldZone& first = lazySource.zone(0);
+    const double fz = 0.5 * (first.zmin() + first.zmax());
+    const double fr = 0.5 * (first.rmin() + first.rmax());
+    const double fphi = 0.5 * (first.phimin() + first.phimax());
+    const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), fz };
+    lazySource.getB(fxyz, bxyz, derivatives);
+    lazyMap.getB(fxyz, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nlazyDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    nlazyDiffs += (lazyMap.nloaded() != 1);
+    const unsigned nfirst = lazyMap.nloaded();
+
+    // 4 threads over the z > 0 half of the map, from the same points in
+    // turn, which fill the zones of that half only
+    constexpr int nlazy = 2000;
+    std::vector<double> lxyz(3 * nlazy);
+    for (int i = 0; i < nlazy; ++i) {
+      const double lr = rdist(gen);
+      const double lphi = phidist(gen);
+      lxyz[3 * i] = lr * cos(lphi);
+      lxyz[3 * i + 1] = lr * sin(lphi);
+      lxyz[3 * i + 2] = fabs(zdist(gen));
+    }
+    std::atomic<int> nthreadDiffs(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&lazySource, &lazyMap, &lxyz, &nthreadDiffs]() {
+        double tB[3];
+        double tBlazy[3];
+        for (int i = 0; i < nlazy; ++i) {
+          lazySource.getB(&lxyz[3 * i], tB);
+          lazyMap.getB(&lxyz[3 * i], tBlazy);
+          for (int j = 0; j < 3; ++j) {
+            nthreadDiffs += (tB[j] != tBlazy[j]);
+          }
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    nlazyDiffs += nthreadDiffs;
+    nlazyDiffs += (lazyMap.nfailed() != 0);
+    const unsigned nthreadLoaded = lazyMap.nloaded();
+    nlazyDiffs += (nthreadLoaded >= lazySource.nzones());
+
+    // a copy has the zones filled so far, and fills the others itself
+    BFieldMap lazyCopy(lazyMap);
+    nlazyDiffs += (lazyCopy.nloaded() != lazyMap.nloaded());
+    for (unsigned k = 0; k < lazySource.nzones(); ++k) {
+      const BFieldZone& zone = lazySource.zone(k);
+      const double kz = 0.5 * (zone.zmin() + zone.zmax());
+      const double kr = 0.5 * (zone.rmin() + zone.rmax());
+      const double kphi = 0.5 * (zone.phimin() + zone.phimax());
+      const double kxyz[3] = { kr * cos(kphi), kr * sin(kphi), kz };
+      lazySource.getB(kxyz, bxyz);
+      lazyCopy.getB(kxyz, bxyzvec);
+      for (int j = 0; j < 3; ++j) {
+        nlazyDiffs += (bxyz[j] != bxyzvec[j]);
+      }
+    }
+    nlazyDiffs += (lazyCopy.nloaded() != lazySource.nzones());
+    nlazyDiffs += (lazyMap.nloaded() != nthreadLoaded);
+
+    // a zone that cannot be read any more is outside the map, and a
+    // truncated file is rejected at once
+    BFieldMap lazyTruncated;
+    if (fd >= 0 && openBFieldMap(path, lazyTruncated)) {
+      truncate(path, 4096);
+      lazyTruncated.getB(fxyz, bxyzvec);
+      for (int j = 0; j < 3; ++j) {
+        nlazyDiffs += (bxyzvec[j] != 0);
+      }
+      nlazyDiffs += (lazyTruncated.nfailed() != 1);
+      nlazyDiffs += openBFieldMap(path, lazyTruncated);
+    } else {
+      ++nlazyDiffs;
+    }
+    if (fd >= 0) {
+      unlink(path);
+    }
+    std::cout << " openBFieldMap filled " << nfirst << " zone for 1 point, "
+              << nthreadLoaded << " of " << lazySource.nzones()
+              << " zones for " << nlazy << " points on 4 threads" << '\n';
+  }
+  if (nlazyDiffs) {
+    ++nfailures;
+    std::cout << " openBFieldMap differs from the original map for "
+              << nlazyDiffs << " values" << '\n';
+  }
+  std::cout << " openBFieldMap checked 1 + 4 x 2000 points, and a copy"
+            << '\n';
+
+  // the zones packed in one arena block, the bin-major map on huge pages,
+  // against the map on its vectors
+  std::cout << '\n' << " ----  BFieldArena ----" << '\n';
+  int narenaDiffs = 0;
+  for (int binMajor = 0; binMajor < 2; ++binMajor) {
+    const BFieldMap arenaSource =
+      generateMap(4, 2, 8, 6, 5, 4, 12000., 4000., 10000., binMajor);
+    BFieldArenaOptions options;
+    options.hugePages = binMajor;
+    BFieldMap arenaMap(arenaSource);
+    if (!arenaMap.packArena(options)) {
+      ++nfailures;
+      std::cout << " BFieldArena differs, cannot map the arena" << '\n';
+      ++narenaDiffs;
+    }
+    // a copy shares the block and outlives the original
+    BFieldMap arenaCopy(arenaMap);
+    arenaMap = BFieldMap();
+    for (unsigned k = 0; k < arenaCopy.nzones(); ++k) {
+      const BFieldZone::View& view = arenaCopy.zone(k).view();
+      narenaDiffs += !arenaCopy.zone(k).isView();
+      narenaDiffs += (arenaCopy.zone(k).binMajor() != bool(binMajor));
+      for (int j = 0; j < 3; ++j) {
+        narenaDiffs += (reinterpret_cast<uintptr_t>(view.mesh[j]) |
+                        reinterpret_cast<uintptr_t>(view.LUT[j]) |
+                        reinterpret_cast<uintptr_t>(view.invMesh[j])) %
+                       BFieldArena::alignment;
+      }
+      narenaDiffs +=
+        reinterpret_cast<uintptr_t>(view.field) % BFieldArena::alignment;
+      // the zones follow each other in the block
+      if (k > 0) {
+        narenaDiffs += (reinterpret_cast<const char*>(view.mesh[0]) !=
+                        reinterpret_cast<const char*>(
+                          arenaCopy.zone(k - 1).view().mesh[0]) +
+                          arenaCopy.zone(k - 1).arenaSize());
+      }
+    }
+    for (int i = 0; i < 1000; ++i) {
+      const double fr = rdist(gen);
+      const double fphi = phidist(gen);
+      const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), zdist(gen) };
+      arenaSource.getB(fxyz, bxyz, derivatives);
+      arenaCopy.getB(fxyz, bxyzvec, derivativesvec);
+      for (int j = 0; j < 3; ++j) {
+        narenaDiffs += (bxyz[j] != bxyzvec[j]);
+      }
+      for (int j = 0; j < 9; ++j) {
+        narenaDiffs += (derivatives[j] != derivativesvec[j]);
+      }
+    }
+  }
+  // one zone in an arena of its own, built by buildLUT, and its copy
+  // viewing the same block
+  BFieldZone ownZone = generateZone(1, -6000, 6000, 12, 4000, 9000, 5, 10);
+  BFieldZone arenaZone(ownZone);
+  ownZone.buildLUT(true);
+  if (!arenaZone.buildLUT(true, BFieldArenaOptions())) {
+    ++nfailures;
+    std::cout << " BFieldArena differs, cannot map the zone arena" << '\n';
+    ++narenaDiffs;
+  }
+  const BFieldZone arenaZoneCopy(arenaZone);
+  narenaDiffs += (arenaZoneCopy.view().field != arenaZone.view().field);
+  narenaDiffs += (arenaZoneCopy.view().binField != arenaZone.view().binField);
+  for (int i = 0; i < 100; ++i) {
+    const double fz = -6000 + 120 * i;
+    const double fr = 4000 + 50 * i;
+    const double fphi = 0.0628 * i;
+    BFieldCache ownCache;
+    BFieldCache arenaCache;
+    ownZone.getCacheVec(fz, fr, fphi, ownCache);
+    arenaZoneCopy.getCacheVec(fz, fr, fphi, arenaCache);
+    const double fxyz[3] = { fr * cos(fphi), fr * sin(fphi), fz };
+    ownCache.getBVec(fxyz, fr, fphi, bxyz, derivatives);
+    arenaCache.getBVec(fxyz, fr, fphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      narenaDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      narenaDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+  }
+  if (narenaDiffs) {
+    ++nfailures;
+    std::cout << " BFieldArena differs from the vector-backed map for "
+              << narenaDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldArena checked 2 x 1000 map points and 100 zone points"
+            << '\n';
+
+  // the flat export and its kernel, bit-exact against BFieldMap::getCache
+  // and BFieldCache::getB, also with a scale factor and outside the map
+  std::cout << '\n' << " ----  BFieldFlat ----" << '\n';
+  int nflatDiffs = 0;
+  int nflatInside = 0;
+  BFieldMap flatSource =
+    generateMap(4, 2, 8, 6, 5, 4, 12000., 4000., 10000., true);
+  flatSource.setScale(0.75);
+  const BFieldFlatBuffers flatBuffers(flatSource);
+  const BFieldFlatMap flatMap = flatBuffers.view();
+  constexpr int nflat = 1000;
+  std::vector<double> flatXYZ(3 * nflat);
+  std::vector<double> flatB(3 * nflat);
+  std::vector<double> flatDeriv(9 * nflat);
+  for (int i = 0; i < nflat; ++i) {
+    const double fr = rdist(gen);
+    const double fphi = phidist(gen);
+    flatXYZ[3 * i] = fr * cos(fphi);
+    flatXYZ[3 * i + 1] = fr * sin(fphi);
+    flatXYZ[3 * i + 2] = zdist(gen);
+  }
+  bfieldFlatGetBBatch(
+    flatMap, flatXYZ.data(), nflat, flatB.data(), flatDeriv.data());
+  for (int i = 0; i < nflat; ++i) {
+    const double* fxyz = &flatXYZ[3 * i];
+    const double fr = std::sqrt(fxyz[0] * fxyz[0] + fxyz[1] * fxyz[1]);
+    const double fphi = std::atan2(fxyz[1], fxyz[0]);
+    BFieldCache flatCache;
+    if (flatSource.getCache(fxyz[2], fr, fphi, flatCache)) {
+      ++nflatInside;
+      flatCache.getB(fxyz, fr, fphi, bxyz, derivatives);
+    } else {
+      std::fill(bxyz, bxyz + 3, 0.);
+      std::fill(derivatives, derivatives + 9, 0.);
+    }
+    const BFieldZone* flatZone = flatSource.findZone(fxyz[2], fr, fphi);
+    nflatDiffs += (bfieldFlatFindZone(flatMap, fxyz[2], fr, fphi) !=
+                   (flatZone ? int(flatZone - &flatSource.zone(0)) : -1));
+    for (int j = 0; j < 3; ++j) {
+      nflatDiffs += (bxyz[j] != flatB[3 * i + j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nflatDiffs += (derivatives[j] != flatDeriv[9 * i + j]);
+    }
+  }
+  if (nflatDiffs) {
+    ++nfailures;
+    std::cout << " BFieldFlat differs from getCache + getB for " << nflatDiffs
+              << " values" << '\n';
+  }
+  std::cout << " BFieldFlat checked " << nflat << " points (" << nflatInside
+            << " inside the map)" << '\n';
+
+  // a map filled on demand with a zone that cannot be filled: its cells
+  // are outside the flat map, as for BFieldMap::findZone
+  constexpr size_t flatSkip = 1;
+  int nflatSkipped = 0;
+  int nflatLazyDiffs = 0;
+  BFieldMap flatLazy;
+  for (unsigned k = 0; k < flatSource.nzones(); ++k) {
+    const BFieldZone& zone = flatSource.zone(k);
+    flatLazy.appendZone(BFieldZone(zone.id(),
+                                   zone.zmin(),
+                                   zone.zmax(),
+                                   zone.rmin(),
+                                   zone.rmax(),
+                                   zone.phimin(),
+                                   zone.phimax(),
+                                   zone.bscale()));
+  }
+  flatLazy.buildLUT();
+  flatLazy.setLoader(
+    std::make_shared<const SkipZoneLoader>(flatSource, flatSkip));
+  flatLazy.setScale(0.75);
+  const BFieldFlatBuffers lazyBuffers(flatLazy);
+  nflatLazyDiffs += (flatLazy.nfailed() != 1);
+  bfieldFlatGetBBatch(
+    lazyBuffers.view(), flatXYZ.data(), nflat, flatB.data(), flatDeriv.data());
+  for (int i = 0; i < nflat; ++i) {
+    const double* fxyz = &flatXYZ[3 * i];
+    const double fr = std::sqrt(fxyz[0] * fxyz[0] + fxyz[1] * fxyz[1]);
+    const double fphi = std::atan2(fxyz[1], fxyz[0]);
+    const BFieldZone* sourceZone = flatSource.findZone(fxyz[2], fr, fphi);
+    nflatSkipped += (sourceZone && sourceZone->id() == int(flatSkip));
+    BFieldCache flatCache;
+    if (flatLazy.getCache(fxyz[2], fr, fphi, flatCache)) {
+      flatCache.getB(fxyz, fr, fphi, bxyz, derivatives);
+    } else {
+      std::fill(bxyz, bxyz + 3, 0.);
+      std::fill(derivatives, derivatives + 9, 0.);
+    }
+    const BFieldZone* flatZone = flatLazy.findZone(fxyz[2], fr, fphi);
+    nflatLazyDiffs +=
+      (bfieldFlatFindZone(lazyBuffers.view(), fxyz[2], fr, fphi) !=
+       (flatZone ? int(flatZone - &flatLazy.zone(0)) : -1));
+    for (int j = 0; j < 3; ++j) {
+      nflatLazyDiffs += (bxyz[j] != flatB[3 * i + j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nflatLazyDiffs += (derivatives[j] != flatDeriv[9 * i + j]);
+    }
+  }
+  nflatLazyDiffs += (nflatSkipped == 0);
+  // nor can the map be written to a file
+  const std::string failedPath =
+    "/tmp/getB_test_failed_" + std::to_string(getpid());
+  nflatLazyDiffs += writeBFieldMap(flatLazy, failedPath);
+  nflatLazyDiffs += (access(failedPath.c_str(), F_OK) == 0);
+  unlink(failedPath.c_str());
+  if (nflatLazyDiffs) {
+    ++nfailures;
+    std::cout << " BFieldFlat differs for the map with a failed zone for "
+              << nflatLazyDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldFlat checked " << nflat << " points with zone "
+            << flatSkip << " failed (" << nflatSkipped << " in it)" << '\n';
+
+  // bulk filling, compared against the zone filled element by element
+  std::cout << '\n' << " ----  setMesh/setField ----" << '\n';
+  BFieldZone bulkZone(data.id,
+                      data.zmin,
+                      data.zmax,
+                      data.rmin,
+                      data.rmax,
+                      data.phimin,
+                      data.phimax,
+                      data.bscale);
+  short bulkz[nfield];
+  short bulkr[nfield];
+  short bulkphi[nfield];
+  for (int j = 0; j < nfield; ++j) {
+    bulkz[j] = data.fieldz[j];
+    bulkr[j] = data.fieldr[j];
+    bulkphi[j] = data.fieldphi[j];
+  }
+  bulkZone.setMesh(0, data.meshz, nmeshz);
+  bulkZone.setMesh(1, std::vector<double>(data.meshr, data.meshr + nmeshr));
+  bulkZone.setMesh(2, data.meshphi, nmeshphi);
+  bulkZone.setField(bulkz, bulkr, bulkphi, nfield);
+  bulkZone.buildLUT();
+  int nbulkDiffs = (bulkZone.nfield() != data.zone.nfield());
+  for (int i = 0; i < 100; ++i) {
+    const double br = 1200. + i;
+    const double bphi = -3.1 + 0.062 * i;
+    const double bxyz0[3] = { br * cos(bphi),
+                              br * sin(bphi),
+                              -1390 + 27.8 * i };
+    data.zone.getB(bxyz0, br, bphi, bxyz, derivatives);
+    bulkZone.getB(bxyz0, br, bphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nbulkDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nbulkDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+  }
+  if (nbulkDiffs) {
+    ++nfailures;
+    std::cout << " setMesh/setField differs from appendMesh/appendField for "
+              << nbulkDiffs << " values" << '\n';
+  }
+  std::cout << " setMesh/setField checked 100 points" << '\n';
+
+  // compile-time variants against the run-time ones: the same kernel,
+  // bit-exact, except for the scale folded into the cache
+  std::cout << '\n' << " ----  getBVec<withDeriv, unitScale> ----" << '\n';
+  int nvariantDiffs = 0;
+  int nfoldDiffs = 0;
+  for (int i = 0; i < 100; ++i) {
+    const double vr = 1200. + i;
+    const double vphi = -3.1 + 0.062 * i;
+    const double vxyz[3] = { vr * cos(vphi), vr * sin(vphi), -1390 + 27.8 * i };
+    double vB[3];
+    double vderiv[9];
+    BFieldCache runCache;
+    BFieldCache foldCache;
+    data.zone.getCacheVec(vxyz[2], vr, vphi, runCache, 0.9);
+    data.zone.getCacheVec<true>(vxyz[2], vr, vphi, foldCache, 0.9);
+    runCache.getBVec(vxyz, vr, vphi, bxyz, derivatives);
+    runCache.getBVec<true>(vxyz, vr, vphi, vB, vderiv);
+    for (int j = 0; j < 3; ++j) {
+      nvariantDiffs += (bxyz[j] != vB[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nvariantDiffs += (derivatives[j] != vderiv[j]);
+    }
+    // without derivatives, against the run-time call without them
+    double nB[3];
+    runCache.getBVec(vxyz, vr, vphi, nB, nullptr);
+    runCache.getBVec<false>(vxyz, vr, vphi, vB);
+    for (int j = 0; j < 3; ++j) {
+      nvariantDiffs += (nB[j] != vB[j]);
+    }
+    foldCache.getBVec<true, true>(vxyz, vr, vphi, vB, vderiv);
+    for (int j = 0; j < 3; ++j) {
+      nfoldDiffs += (fabs(bxyz[j] - vB[j]) > 1e-14);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nfoldDiffs += (fabs(derivatives[j] - vderiv[j]) > 1e-14);
+    }
+    data.zone.getB(vxyz, vr, vphi, bxyz, derivatives, 0.9);
+    data.zone.getB<true>(vxyz, vr, vphi, vB, vderiv, 0.9);
+    for (int j = 0; j < 3; ++j) {
+      nvariantDiffs += (bxyz[j] != vB[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nvariantDiffs += (derivatives[j] != vderiv[j]);
+    }
+    data.zone.getB(vxyz, vr, vphi, nB, nullptr, 0.9);
+    data.zone.getB<false>(vxyz, vr, vphi, vB, nullptr, 0.9);
+    for (int j = 0; j < 3; ++j) {
+      nvariantDiffs += (nB[j] != vB[j]);
+    }
+  }
+  if (nvariantDiffs) {
+    ++nfailures;
+    std::cout << " compile-time variants differ for " << nvariantDiffs
+              << " values" << '\n';
+  }
+  if (nfoldDiffs) {
+    ++nfailures;
+    std::cout << " folded scale differs for " << nfoldDiffs << " values"
+              << '\n';
+  }
+  std::cout << " getBVec<withDeriv, unitScale> checked 100 points" << '\n';
+
+  // prefetching the next step must not change the cache
+  std::cout << '\n' << " ----  prefetch ----" << '\n';
+  int nprefetchDiffs = 0;
+  for (int i = 0; i < 100; ++i) {
+    const double pr = 1200. + i;
+    const double pphi = -3.1 + 0.062 * i;
+    const double pxyz[3] = { pr * cos(pphi), pr * sin(pphi), -1390 + 27.8 * i };
+    // every tenth next point is outside the zone
+    const double znext = (i % 10 == 0) ? 1.e5 : pxyz[2] + 27.8;
+    BFieldCache plainCache;
+    BFieldCache stepCache;
+    data.zone.getCacheVec(pxyz[2], pr, pphi, plainCache, 1);
+    data.zone.getCacheVec(
+      pxyz[2], pr, pphi, znext, pr + 1, pphi + 0.062, stepCache, 1);
+    map.prefetch(znext, pr + 1, pphi + 0.062);
+    plainCache.getBVec(pxyz, pr, pphi, bxyz, derivatives);
+    stepCache.getBVec(pxyz, pr, pphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nprefetchDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nprefetchDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+  }
+  if (nprefetchDiffs) {
+    ++nfailures;
+    std::cout << " getCacheVec with prefetch differs for " << nprefetchDiffs
+              << " values" << '\n';
+  }
+  std::cout << " prefetch checked 100 points" << '\n';
+
+  // the precomputed 1/r, and the r = 0 direction (cos, sin of phimin)
+  // stored at fill time, against 1.0 / r and cos/sin called here
+  std::cout << '\n' << " ----  invr and r = 0 ----" << '\n';
+  int ninvrDiffs = 0;
+  for (int i = 0; i < 100; ++i) {
+    const double ir = 1200. + i;
+    const double iphi = -3.1 + 0.062 * i;
+    const double ixyz[3] = { ir * cos(iphi), ir * sin(iphi), -1390 + 27.8 * i };
+    BFieldCache icache;
+    data.zone.getCacheVec(ixyz[2], ir, iphi, icache, 1);
+    icache.getBVec(ixyz, ir, iphi, bxyz, derivatives);
+    icache.getBVec(ixyz, ir, 1.0 / ir, iphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      ninvrDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      ninvrDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+    data.zone.getB(ixyz, ir, iphi, bxyz, derivatives);
+    data.zone.getB(ixyz, ir, 1.0 / ir, iphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      ninvrDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      ninvrDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+    // at r = 0, B is (Br, Bphi) interpolated at iphi, turned along the
+    // phimin direction of the bin. Br and Bphi are linear in r within the
+    // bin: extrapolate them from rmin and rmax, at iphi
+    const double origin[3] = { 0, 0, ixyz[2] };
+    icache.getBVec(origin, 0, iphi, bxyzvec);
+    double Brphi[2][2];
+    for (int k = 0; k < 2; ++k) {
+      const double kr = k ? icache.rmax() : icache.rmin();
+      const double kxyz[3] = { kr * cos(iphi), kr * sin(iphi), ixyz[2] };
+      icache.getB(kxyz, kr, iphi, bxyz);
+      Brphi[k][0] = bxyz[0] * cos(iphi) + bxyz[1] * sin(iphi);
+      Brphi[k][1] = bxyz[1] * cos(iphi) - bxyz[0] * sin(iphi);
+    }
+    const double fr0 = icache.rmin() / (icache.rmax() - icache.rmin());
+    const double Br = Brphi[0][0] - fr0 * (Brphi[1][0] - Brphi[0][0]);
+    const double Bphi = Brphi[0][1] - fr0 * (Brphi[1][1] - Brphi[0][1]);
+    const double cphi = cos(icache.phimin());
+    const double sphi = sin(icache.phimin());
+    const double Bx0 = Br * cphi - Bphi * sphi;
+    const double By0 = Br * sphi + Bphi * cphi;
+    const double tol0 = 1e-9 * (fabs(Br) + fabs(Bphi));
+    ninvrDiffs += (fabs(Bx0 - bxyzvec[0]) > tol0);
+    ninvrDiffs += (fabs(By0 - bxyzvec[1]) > tol0);
+    icache.getB(origin, 0, iphi, bxyz);
+    for (int j = 0; j < 3; ++j) {
+      ninvrDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-14);
+    }
+  }
+  // reciprocal of r in getBBatch, with r = 0 and tiny r in the
+  // vectorized lanes
+  constexpr size_t nrecip = 8;
+  double rx[nrecip];
+  double ry[nrecip];
+  double rz[nrecip];
+  double rr[nrecip];
+  double rphi[nrecip];
+  double rB[3][nrecip];
+  double rderiv[9 * nrecip];
+  BFieldCache rcache;
+  data.zone.getCacheVec(z, r, phi, rcache, 1);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < nrecip; ++i) {
+      rr[i] = 1230. + 3. * i;
+      rphi[i] = phi + 0.01 * i;
+      rz[i] = z0 + 10. * i;
+    }
+    rr[2] = 0;
+    if (pass == 1) {
+      rr[5] = 1e-300;
+    }
+    for (size_t i = 0; i < nrecip; ++i) {
+      rx[i] = rr[i] * cos(rphi[i]);
+      ry[i] = rr[i] * sin(rphi[i]);
+    }
+    rcache.getBBatch(
+      rx, ry, rz, rr, rphi, nrecip, rB[0], rB[1], rB[2], rderiv);
+    for (size_t i = 0; i < nrecip; ++i) {
+      const double rxyz[3] = { rx[i], ry[i], rz[i] };
+      rcache.getBVec(rxyz, rr[i], rphi[i], bxyz, derivatives);
+      for (int j = 0; j < 3; ++j) {
+        ninvrDiffs += (fabs(bxyz[j] - rB[j][i]) > 1e-14);
+      }
+      // relative, the 1/r terms are huge at tiny r
+      for (int j = 0; j < 9; ++j) {
+        const double d = derivatives[j];
+        ninvrDiffs +=
+          (fabs(d - rderiv[j * nrecip + i]) > 1e-14 * (1. + fabs(d)));
+      }
+    }
+  }
+  if (ninvrDiffs) {
+    ++nfailures;
+    std::cout << " invr or r = 0 differs for " << ninvrDiffs << " values"
+              << '\n';
+  }
+  std::cout << " invr and r = 0 checked 100 + 16 points" << '\n';
+
+  // the solenoid: an axially symmetric field on a 3d BFieldMesh<double>
+  // and on a 2d (z, r) BFieldMeshZR, the same up to rounding
+  std::cout << '\n' << " ----  BFieldMesh<double> and BFieldMeshZR ----"
+            << '\n';
+  const BFieldMesh<double> solenoid =
+    generateSolenoid(-3000., 3000., 61, 0., 1200., 25, 9);
+  const BFieldMeshZR solenoidZR =
+    generateSolenoidZR(-3000., 3000., 61, 0., 1200., 25);
+  int nsolenoidDiffs = 0;
+  int nzrDiffs = 0;
+  for (int i = 0; i < 100; ++i) {
+    // off the bin edges, and down to r = 0
+    const double sr = 11.7 * i + 0.3;
+    const double sphi = -3.1 + 0.062 * i;
+    const double sxyz[3] = {
+      sr * cos(sphi), sr * sin(sphi), -2990. + 59.7 * i
+    };
+    BFieldCache cache3d;
+    solenoid.getCacheVec(sxyz[2], sr, sphi, cache3d, 0.9);
+    cache3d.getBVec(sxyz, sr, sphi, bxyz, derivatives);
+    solenoid.getB(sxyz, sr, sphi, bxyzvec, derivativesvec, 0.9);
+    for (int j = 0; j < 3; ++j) {
+      nsolenoidDiffs += (bxyz[j] != bxyzvec[j]);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nsolenoidDiffs += (derivatives[j] != derivativesvec[j]);
+    }
+    BFieldCacheZR cacheZR;
+    solenoidZR.getCache(sxyz[2], sr, cacheZR, 0.9);
+    nzrDiffs += !cacheZR.inside(sxyz[2], sr);
+    cacheZR.getB(sxyz, sr, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nzrDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-15);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nzrDiffs += (fabs(derivatives[j] - derivativesvec[j]) > 1e-15);
+    }
+  }
+  if (nsolenoidDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMesh<double>::getB differs from getCacheVec + getBVec"
+              << " for " << nsolenoidDiffs << " values" << '\n';
+  }
+  if (nzrDiffs) {
+    ++nfailures;
+    std::cout << " BFieldCacheZR differs from the 3d solenoid for " << nzrDiffs
+              << " values" << '\n';
+  }
+  std::cout << " solenoid checked 100 points" << '\n';
+
+  // scale changes: every look-up of the map applies the new factor, the
+  // caches refill, and readers running meanwhile see either factor
+  std::cout << '\n' << " ----  BFieldMap::setScale ----" << '\n';
+  BFieldMap scaled = generateMap(4, 2, 8, 6, 5, 4);
+  const double sxyz0[3] = { 5000. * cos(0.3), 5000. * sin(0.3), 1234. };
+  const double sr0 = 5000.;
+  const double sphi0 = 0.3;
+  BFieldMapCache scaledCache(&scaled);
+  BFieldMultiCache<4> scaledMulti(&scaled);
+  double nominal[5][3];
+  scaled.getB(sxyz0, nominal[0]);
+  scaledCache.getField(sxyz0, nominal[1]);
+  scaledMulti.getField(sxyz0, nominal[2]);
+  scaled.getBBinned(sxyz0, 1, nominal[3]);
+  BFieldCache scaledBin;
+  scaled.getCache(sxyz0[2], sr0, sphi0, scaledBin);
+  scaledBin.getBVec(sxyz0, sr0, sphi0, nominal[4]);
+  const uint64_t generation0 = scaled.scale().generation;
+  scaled.setScale(0.5);
+  int nscaleDiffs = (scaled.scale().generation != generation0 + 1 ||
+                     scaled.scale().factor != 0.5);
+  double halved[5][3];
+  scaled.getB(sxyz0, halved[0]);
+  scaledCache.getField(sxyz0, halved[1]);
+  scaledMulti.getField(sxyz0, halved[2]);
+  scaled.getBBinned(sxyz0, 1, halved[3]);
+  scaled.getCache(sxyz0[2], sr0, sphi0, scaledBin);
+  scaledBin.getBVec(sxyz0, sr0, sphi0, halved[4]);
+  for (int k = 0; k < 5; ++k) {
+    for (int j = 0; j < 3; ++j) {
+      nscaleDiffs += (halved[k][j] != 0.5 * nominal[k][j]);
+    }
+  }
+  // two readers, each with its cache, while the factor flips 1000 times
+  // between 1 and 2, ending at 1
+  scaled.setScale(1.);
+  std::atomic<bool> swapping{ true };
+  std::atomic<int> nreaderDiffs{ 0 };
+  auto reader = [&]() {
+    BFieldMapCache readerCache(&scaled);
+    double rB[3];
+    do {
+      readerCache.getField(sxyz0, rB);
+      for (int j = 0; j < 3; ++j) {
+        if (rB[j] != nominal[1][j] && rB[j] != 2 * nominal[1][j]) {
+          ++nreaderDiffs;
+        }
+      }
+    } while (swapping.load());
+    readerCache.getField(sxyz0, rB);
+    for (int j = 0; j < 3; ++j) {
+      nreaderDiffs += (rB[j] != nominal[1][j]);
+    }
+  };
+  std::thread reader1(reader);
+  std::thread reader2(reader);
+  for (int i = 1; i <= 1000; ++i) {
+    scaled.setScale(i % 2 ? 2. : 1.);
+    std::this_thread::yield();
+  }
+  swapping.store(false);
+  reader1.join();
+  reader2.join();
+  scaled.reclaimScales();
+  nscaleDiffs +=
+    nreaderDiffs + (scaled.scale().generation != generation0 + 1002);
+  if (nscaleDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMap::setScale differs for " << nscaleDiffs
+              << " values" << '\n';
+  }
+  std::cout << " BFieldMap::setScale checked 5 look-ups and 1000 swaps"
+            << '\n';
+
+  // the tricubic cache: exact on a field linear in z, r and phi, as the
+  // trilinear one, equal to it at the nodes, and with the field and
+  // derivatives continuous across the bin edges
+  std::cout << '\n' << " ----  BFieldCacheCubic ----" << '\n';
+  const double linMesh[3][5] = { { -1000., -700., -100., 300., 1000. },
+                                 { 500., 650., 1000., 1200., 1500. },
+                                 { 0., 1., 2.5, 4., 2 * M_PI } };
+  BFieldMesh<double> linear(-1000., 1000., 500., 1500., 0., 2 * M_PI, 1e-3);
+  linear.reserve(5, 5, 5);
+  for (int j = 0; j < 3; ++j) {
+    for (int i = 0; i < 5; ++i) {
+      linear.appendMesh(j, linMesh[j][i]);
+    }
+  }
+  for (int iz = 0; iz < 5; ++iz) {
+    for (int ir = 0; ir < 5; ++ir) {
+      for (int iphi = 0; iphi < 5; ++iphi) {
+        const double lz = linMesh[0][iz];
+        const double lr = linMesh[1][ir];
+        const double lphi = linMesh[2][iphi];
+        linear.appendField(
+          BFieldVector<double>(2. + 1e-3 * lz - 2e-3 * lr + 0.3 * lphi,
+                               -1. + 3e-3 * lz + 1e-3 * lr - 0.2 * lphi,
+                               0.5 - 2e-3 * lz + 4e-3 * lr + 0.1 * lphi));
+      }
+    }
+  }
+  linear.buildLUT();
+  int nlinearDiffs = 0;
+  for (int i = 0; i < 100; ++i) {
+    const double lr = 510. + 9.87 * i;
+    const double lphi = 0.013 + 0.0621 * i;
+    const double lxyz[3] = { lr * cos(lphi), lr * sin(lphi), -995. + 19.9 * i };
+    BFieldCache trilinear;
+    BFieldCacheCubic cubic;
+    linear.getCache(lxyz[2], lr, lphi, trilinear, 0.9);
+    linear.getCache(lxyz[2], lr, lphi, cubic, 0.9);
+    nlinearDiffs += !cubic.inside(lxyz[2], lr, lphi);
+    trilinear.getB(lxyz, lr, lphi, bxyz, derivatives);
+    cubic.getB(lxyz, lr, lphi, bxyzvec, derivativesvec);
+    for (int j = 0; j < 3; ++j) {
+      nlinearDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-15);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nlinearDiffs += (fabs(derivatives[j] - derivativesvec[j]) > 1e-15);
+    }
+    cubic.getB(lxyz, lr, lphi, bxyzvec);
+    for (int j = 0; j < 3; ++j) {
+      nlinearDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-15);
+    }
+  }
+  if (nlinearDiffs) {
+    ++nfailures;
+    std::cout << " BFieldCacheCubic differs from the linear field for "
+              << nlinearDiffs << " values" << '\n';
+  }
+  // at the node (meshz[1], meshr[2], meshphi[2]), and on either side of
+  // the bin edges through it
+  int ncubicDiffs = 0;
+  const double node[3] = { data.meshz[1], data.meshr[2], data.meshphi[2] };
+  for (int axis = -1; axis < 3; ++axis) {
+    double values[2][3];
+    double slopes[2][9];
+    for (int side = 0; side < 2; ++side) {
+      double pos[3] = { node[0], node[1], node[2] };
+      if (axis >= 0) {
+        pos[axis] += (side ? 1e-7 : -1e-7);
+      }
+      const double nxyz[3] = { pos[1] * cos(pos[2]),
+                               pos[1] * sin(pos[2]),
+                               pos[0] };
+      BFieldCacheCubic cubic;
+      data.zone.getCache(pos[0], pos[1], pos[2], cubic, 1);
+      cubic.getB(nxyz, pos[1], pos[2], values[side], slopes[side]);
+      if (axis < 0) {
+        BFieldCache trilinear;
+        data.zone.getCache(pos[0], pos[1], pos[2], trilinear, 1);
+        trilinear.getB(nxyz, pos[1], pos[2], bxyz);
+        for (int j = 0; j < 3; ++j) {
+          ncubicDiffs += (fabs(values[side][j] - bxyz[j]) > 1e-15);
+        }
+      }
+    }
+    // 1e-7 away the changes are below 1e-5 relative, where the
+    // trilinear derivatives jump by order 1
+    for (int j = 0; j < 3; ++j) {
+      ncubicDiffs += (fabs(values[0][j] - values[1][j]) >
+                      1e-5 * fabs(values[0][j]));
+    }
+    for (int j = 0; j < 9; ++j) {
+      ncubicDiffs += (fabs(slopes[0][j] - slopes[1][j]) >
+                      1e-5 * fabs(slopes[0][j]));
+    }
+  }
+  if (ncubicDiffs) {
+    ++nfailures;
+    std::cout << " BFieldCacheCubic differs at a node or across a bin edge"
+              << " for " << ncubicDiffs << " values" << '\n';
+  }
+  std::cout << " BFieldCacheCubic checked 100 points and 3 bin edges"
+            << '\n';
+
+  // node reduction: a linear field needs 2 planes per axis only, and a
+  // reduced zone stays within the tolerance at all the original nodes
+  std::cout << '\n' << " ----  BFieldMesh::reduce ----" << '\n';
+  int nreduceDiffs = 0;
+  BFieldMesh<double> linear2;
+  linear.reduce(1e-12, linear2);
+  for (int j = 0; j < 3; ++j) {
+    nreduceDiffs += (linear2.nmesh(j) != 2);
+  }
+  for (int i = 0; i < 100; ++i) {
+    const double lr = 510. + 9.87 * i;
+    const double lphi = 0.013 + 0.0621 * i;
+    const double lxyz[3] = { lr * cos(lphi), lr * sin(lphi), -995. + 19.9 * i };
+    linear.getB(lxyz, lr, lphi, bxyz, derivatives, 0.9);
+    linear2.getB(lxyz, lr, lphi, bxyzvec, derivativesvec, 0.9);
+    for (int j = 0; j < 3; ++j) {
+      nreduceDiffs += (fabs(bxyz[j] - bxyzvec[j]) > 1e-15);
+    }
+    for (int j = 0; j < 9; ++j) {
+      nreduceDiffs += (fabs(derivatives[j] - derivativesvec[j]) > 1e-15);
+    }
+  }
+  const double tolerance = 2e-5;
+  BFieldZone full = generateZone(7, -3000., 3000., 60, 4000., 10000., 30, 40);
+  full.buildLUT();
+  BFieldZone coarse = full.reduced(tolerance);
+  // also with the zone scaled up, the tolerance applying to the field
+  // returned
+  for (const double factor : { 1., 10. }) {
+    full.scaleBscale(factor);
+    coarse = full.reduced(tolerance);
+    nreduceDiffs += (coarse.id() != 7 || coarse.nfield() >= full.nfield());
+    for (unsigned iz = 0; iz < full.nmesh(0); ++iz) {
+      for (unsigned ir = 0; ir < full.nmesh(1); ++ir) {
+        for (unsigned iphi = 0; iphi < full.nmesh(2); ++iphi) {
+          const double nz = full.mesh(0, iz);
+          const double nr = full.mesh(1, ir);
+          const double nphi = full.mesh(2, iphi);
+          const double nxyz[3] = { nr * cos(nphi), nr * sin(nphi), nz };
+          full.getB(nxyz, nr, nphi, bxyz);
+          coarse.getB(nxyz, nr, nphi, bxyzvec);
+          // each of Bz, Br, Bphi within tolerance
+          const double dx = bxyz[0] - bxyzvec[0];
+          const double dy = bxyz[1] - bxyzvec[1];
+          const double dz = bxyz[2] - bxyzvec[2];
+          nreduceDiffs += (std::sqrt(dx * dx + dy * dy + dz * dz) >
+                           std::sqrt(3.) * tolerance);
+        }
+      }
+    }
+  }
+  if (nreduceDiffs) {
+    ++nfailures;
+    std::cout << " BFieldMesh::reduce differs for " << nreduceDiffs
+              << " values" << '\n';
+  }
+  std::cout << " BFieldMesh::reduce checked " << full.nfield()
+            << " nodes at 2 scales, " << coarse.nfield() << " kept" << '\n';
+
+  // instrumentation: the calls counted per kind and zone, from two
+  // threads, or nothing at all when compiled out
+  std::cout << '\n' << " ----  BFieldStats ----" << '\n';
+  BFieldStats::reset();
+  auto instrumented = [&data]() {
+    for (int i = 0; i < 10; ++i) {
+      const double sxyz[3] = { 1250. * cos(0.1 * i), 1250. * sin(0.1 * i), 0 };
+      BFieldCache scache;
+      double sB[3];
+      data.zone.getCacheVec(0, 1250., 0.1 * i, scache, 1);
+      scache.getBVec(sxyz, 1250., 0.1 * i, sB);
+      scache.getBVec(sxyz, 1250., 0.1 * i, sB);
+      data.zone.getB(sxyz, 1250., 0.1 * i, sB);
+    }
+  };
+  instrumented();
+  std::thread statsThread(instrumented);
+  statsThread.join();
+  BFieldCache solenoidCache;
+  solenoid.getCacheVec(0, 500., 0, solenoidCache, 1);
+  const BFieldStats::Report stats = BFieldStats::report();
+  const int factor = BFieldStats::enabled() ? 1 : 0;
+  const bool statsOK = stats.calls[BFieldStats::Fill] == 21u * factor &&
+                       stats.calls[BFieldStats::Interpolate] == 40u * factor &&
+                       stats.calls[BFieldStats::FusedGetB] == 20u * factor &&
+                       stats.zone[data.id + 1] == 40u * factor &&
+                       stats.zone[0] == 1u * factor;
+  if (!statsOK) {
+    ++nfailures;
+    std::cout << " BFieldStats counts differ" << '\n';
+    stats.print(std::cout);
+  }
+  std::cout << " BFieldStats checked, "
+            << (BFieldStats::enabled() ? "instrumented" : "compiled out")
+            << '\n';
+
+  std::cout << '\n' << " " << nfailures << " failed checks" << '\n';
+  return nfailures ? 1 : 0;
+}
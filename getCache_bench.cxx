@@ -3,9 +3,13 @@
 */
 
 #include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldCacheF.h"
+#include "BFieldGenerator.h"
 #include "BFieldZone.h"
 #include <benchmark/benchmark.h>
 #include <iostream>
+#include <random>
 constexpr int nmeshz{ 4 };
 constexpr int nmeshr{ 5 };
 constexpr int nmeshphi{ 6 };
@@ -14,7 +18,7 @@ constexpr int nfield = nmeshz * nmeshr * nmeshphi;
 struct BFieldData
 {
 
-  double fieldz[nfield] = {
+  short fieldz[nfield] = {
     19487, 19487, 19488, 19488, 19487, 19487, 19531, 19531, 19532, 19532, 19531,
     19531, 6399,  6400,  6400,  6400,  6399,  -1561, -1561, -1560, -1560, -1560,
     -1561, -1516, -1516, -1515, -1515, -1516, -1516, 20310, 20310, 20311, 20311,
@@ -28,7 +32,7 @@ struct BFieldData
     -1560, -1561, -1516, -1516, -1515, -1515, -1515, -1516, -1516, -1516
   };
 
-  double fieldr[nfield] = {
+  short fieldr[nfield] = {
     -1357, -1356, -1353, -1354, -1354, -1357, -1366, -1366, -1362, -1363, -1363,
     -1366, -1378, -1374, -1375, -1375, -1378, -1388, -1388, -1385, -1386, -1386,
     -1388, -1394, -1394, -1390, -1391, -1391, -1394, -318,  -318,  -314,  -315,
@@ -42,7 +46,7 @@ struct BFieldData
     1386,  1383,  1388,  1388,  1393,  1391,  1391,  1388,  1388,  1388
   };
 
-  double fieldphi[nfield] = {
+  short fieldphi[nfield] = {
     -2, 7,  3,  1,  6, -2, -2, 7, 3,  1,  6, -2, -2, 3, 1,  6,  -2, -2, 7, 3,
     1,  6,  -2, -2, 7, 3,  1,  6, -2, -1, 7, 3,  1,  6, -1, -1, 7,  3,  1, 6,
     -1, -1, 3,  1,  6, -1, -1, 7, 3,  1,  6, -1, -1, 8, 3,  1,  6,  -1, 1, 7,
@@ -69,23 +73,10 @@ struct BFieldData
   BFieldData()
     : zone(id, zmin, zmax, rmin, rmax, phimin, phimax, bscale)
   {
-    zone.reserve(nmeshz, nmeshr, nmeshphi);
-    for (int j = 0; j < nmeshz; j++) {
-      zone.appendMesh(0, meshz[j]);
-    }
-
-    for (int j = 0; j < nmeshr; j++) {
-      zone.appendMesh(1, meshr[j]);
-    }
-
-    for (int j = 0; j < nmeshphi; j++) {
-      zone.appendMesh(2, meshphi[j]);
-    }
-
-    for (int j = 0; j < nfield; j++) {
-      BFieldVector<short> field(fieldz[j], fieldr[j], fieldphi[j]);
-      zone.appendField(field);
-    }
+    zone.setMesh(0, meshz, nmeshz);
+    zone.setMesh(1, meshr, nmeshr);
+    zone.setMesh(2, meshphi, nmeshphi);
+    zone.setField(fieldz, fieldr, fieldphi, nfield);
 
     // build (trivial) look up table for zone
     zone.buildLUT();
@@ -104,6 +95,7 @@ getCache(benchmark::State& state)
       BFieldCache cache3d;
       // do interpolation (cache3d has correct scale factor)
       data.zone.getCache(z, r, phi, cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
     }
   }
 }
@@ -122,12 +114,335 @@ getCacheVec(benchmark::State& state)
       BFieldCache cache3d;
       // do interpolation (cache3d has correct scale factor)
       data.zone.getCacheVec(z, r, phi, cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
     }
   }
 }
 
 BENCHMARK(getCacheVec)->RangeMultiplier(2)->Range(1024, 8192);
 
+// the 4 x 4 x 4 nodes of the tricubic cache
+void
+getCacheCubic(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      BFieldCacheCubic cache;
+      data.zone.getCache(z, r, phi, cache, 1);
+      benchmark::DoNotOptimize(cache);
+    }
+  }
+}
+
+BENCHMARK(getCacheCubic)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getCacheVecF(benchmark::State& state)
+{
+  BFieldData data{};
+  double z{ 0 }, r{ 1250 }, phi{ 1.6 };
+  // fill the single precision cache, pass in current scale factor
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      BFieldCacheF cache3d;
+      data.zone.getCacheVec(z, r, phi, cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
+    }
+  }
+}
+
+BENCHMARK(getCacheVecF)->RangeMultiplier(2)->Range(1024, 8192);
+
+// points spread over all the bins of the zone, so that
+// consecutive lookups always miss the previous bin
+struct MissPoints
+{
+  static constexpr int npoints = 64;
+  double xyz[npoints][3];
+  double r[npoints];
+  double phi[npoints];
+  MissPoints()
+  {
+    for (int i = 0; i < npoints; ++i) {
+      const double z = -1390. + ((i * 7) % npoints) * 2780. / npoints;
+      r[i] = 1201. + ((i * 13) % npoints) * 98. / npoints;
+      phi[i] = -3.1 + ((i * 29) % npoints) * 6.2 / npoints;
+      xyz[i][0] = r[i] * cos(phi[i]);
+      xyz[i][1] = r[i] * sin(phi[i]);
+      xyz[i][2] = z;
+    }
+  }
+};
+
+void
+getCacheMiss(benchmark::State& state)
+{
+  BFieldData data{};
+  MissPoints points{};
+  double bxyz[3];
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      const int i = range % MissPoints::npoints;
+      BFieldCache cache3d;
+      data.zone.getCache(
+        points.xyz[i][2], points.r[i], points.phi[i], cache3d, 1);
+      cache3d.getB(points.xyz[i], points.r[i], points.phi[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(getCacheMiss)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getCacheVecMiss(benchmark::State& state)
+{
+  BFieldData data{};
+  MissPoints points{};
+  double bxyz[3];
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      const int i = range % MissPoints::npoints;
+      BFieldCache cache3d;
+      data.zone.getCacheVec(
+        points.xyz[i][2], points.r[i], points.phi[i], cache3d, 1);
+      cache3d.getBVec(points.xyz[i], points.r[i], points.phi[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(getCacheVecMiss)->RangeMultiplier(2)->Range(1024, 8192);
+
+void
+getBFusedMiss(benchmark::State& state)
+{
+  BFieldData data{};
+  MissPoints points{};
+  double bxyz[3];
+  for (auto _ : state) {
+    const int n = state.range(0);
+    for (int range = 0; range < n; ++range) {
+      const int i = range % MissPoints::npoints;
+      data.zone.getB(
+        points.xyz[i], points.r[i], points.phi[i], bxyz, nullptr, 1);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(getBFusedMiss)->RangeMultiplier(2)->Range(1024, 8192);
+
+// A realistically sized toroid zone, 120 x 50 x 100 nodes,
+// queried at random points so that the corners come from memory
+struct LargeZoneData
+{
+  static constexpr int npoints = 8192;
+  BFieldZone zone;
+  BFieldZone binZone;
+  // binZone in an arena on huge pages
+  BFieldZone arenaZone;
+  double z[npoints];
+  double r[npoints];
+  double phi[npoints];
+  LargeZoneData()
+    : zone(generateZone(1, -6000, 6000, 120, 4000, 9000, 50, 100))
+    , binZone(zone)
+    , arenaZone(zone)
+  {
+    zone.buildLUT();
+    binZone.buildLUT(true);
+    BFieldArenaOptions options;
+    options.hugePages = true;
+    arenaZone.buildLUT(true, options);
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> zdist(-6000, 6000);
+    std::uniform_real_distribution<double> rdist(4000, 9000);
+    std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+    for (int i = 0; i < npoints; ++i) {
+      z[i] = zdist(gen);
+      r[i] = rdist(gen);
+      phi[i] = phidist(gen);
+    }
+  }
+  static const LargeZoneData& instance()
+  {
+    static const LargeZoneData data{};
+    return data;
+  }
+};
+
+void
+getCacheVecLarge(benchmark::State& state)
+{
+  const LargeZoneData& data = LargeZoneData::instance();
+  for (auto _ : state) {
+    for (int i = 0; i < LargeZoneData::npoints; ++i) {
+      BFieldCache cache3d;
+      data.zone.getCacheVec(data.z[i], data.r[i], data.phi[i], cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
+    }
+  }
+  state.counters["memSize"] = data.zone.memSize();
+}
+
+BENCHMARK(getCacheVecLarge);
+
+void
+getCacheVecLargeBinMajor(benchmark::State& state)
+{
+  const LargeZoneData& data = LargeZoneData::instance();
+  for (auto _ : state) {
+    for (int i = 0; i < LargeZoneData::npoints; ++i) {
+      BFieldCache cache3d;
+      data.binZone.getCacheVec(data.z[i], data.r[i], data.phi[i], cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
+    }
+  }
+  state.counters["memSize"] = data.binZone.memSize();
+}
+
+BENCHMARK(getCacheVecLargeBinMajor);
+
+void
+getCacheVecLargeArena(benchmark::State& state)
+{
+  const LargeZoneData& data = LargeZoneData::instance();
+  for (auto _ : state) {
+    for (int i = 0; i < LargeZoneData::npoints; ++i) {
+      BFieldCache cache3d;
+      data.arenaZone.getCacheVec(data.z[i], data.r[i], data.phi[i], cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
+    }
+  }
+  state.counters["arenaSize"] = data.arenaZone.arenaSize();
+}
+
+BENCHMARK(getCacheVecLargeArena);
+
+// Points around one bin of the zone, either all inside it (a predictable
+// pattern) or each inside with probability 1/2 (an unpredictable one)
+struct InsidePoints
+{
+  static constexpr int npoints = 4096;
+  BFieldCache cache;
+  double z[npoints];
+  double r[npoints];
+  double phi[npoints];
+  explicit InsidePoints(bool random)
+  {
+    BFieldData data{};
+    data.zone.getCacheVec(0., 1250., 1.6, cache, 1);
+    const double lo[3] = { data.meshz[1], data.meshr[2], data.meshphi[1] };
+    const double hi[3] = { data.meshz[2], data.meshr[3], data.meshphi[2] };
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> udist(0, 1);
+    for (int i = 0; i < npoints; ++i) {
+      double p[3];
+      for (int j = 0; j < 3; ++j) {
+        p[j] = lo[j] + udist(gen) * (hi[j] - lo[j]);
+      }
+      if (random && udist(gen) < 0.5) {
+        // move one coordinate out of the bin
+        const int j = int(udist(gen) * 3);
+        p[j] += (udist(gen) < 0.5 ? -1 : 1) * (hi[j] - lo[j]);
+      }
+      z[i] = p[0];
+      r[i] = p[1];
+      phi[i] = p[2];
+    }
+  }
+};
+
+void
+insideScalar(benchmark::State& state)
+{
+  const InsidePoints points(state.range(0));
+  for (auto _ : state) {
+    int n = 0;
+    for (int i = 0; i < InsidePoints::npoints; ++i) {
+      if (points.cache.inside(points.z[i], points.r[i], points.phi[i])) {
+        ++n;
+      }
+    }
+    benchmark::DoNotOptimize(n);
+  }
+}
+
+BENCHMARK(insideScalar)->Arg(0)->Arg(1);
+
+void
+insideVec(benchmark::State& state)
+{
+  const InsidePoints points(state.range(0));
+  for (auto _ : state) {
+    int n = 0;
+    for (int i = 0; i < InsidePoints::npoints; ++i) {
+      if (points.cache.insideVec(points.z[i], points.r[i], points.phi[i])) {
+        ++n;
+      }
+    }
+    benchmark::DoNotOptimize(n);
+  }
+}
+
+BENCHMARK(insideVec)->Arg(0)->Arg(1);
+
+void
+insideMask(benchmark::State& state)
+{
+  const InsidePoints points(state.range(0));
+  uint64_t mask[InsidePoints::npoints / 64];
+  for (auto _ : state) {
+    points.cache.insideMask(
+      points.z, points.r, points.phi, InsidePoints::npoints, mask);
+    benchmark::DoNotOptimize(mask);
+  }
+}
+
+BENCHMARK(insideMask)->Arg(0)->Arg(1);
+
 // main
+// fill the cache of a solenoid bin, 3d BFieldMesh<double> or 2d (z, r)
+void
+getCacheSolenoid(benchmark::State& state)
+{
+  const BFieldMesh<double> mesh =
+    generateSolenoid(-3000., 3000., 121, 0., 1200., 25, 9);
+  const double z{ 100 }, r{ 500 }, phi{ 1.6 };
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      BFieldCache cache3d;
+      mesh.getCacheVec(z, r, phi, cache3d, 1);
+      benchmark::DoNotOptimize(cache3d);
+    }
+  }
+}
+
+BENCHMARK(getCacheSolenoid);
+
+void
+getCacheSolenoidZR(benchmark::State& state)
+{
+  const BFieldMeshZR mesh =
+    generateSolenoidZR(-3000., 3000., 121, 0., 1200., 25);
+  const double z{ 100 }, r{ 500 };
+  for (auto _ : state) {
+    for (int range = 0; range < 4096; ++range) {
+      BFieldCacheZR cacheZR;
+      mesh.getCache(z, r, cacheZR, 1);
+      benchmark::DoNotOptimize(cacheZR);
+    }
+  }
+}
+
+BENCHMARK(getCacheSolenoidZR);
+
 BENCHMARK_MAIN();
 
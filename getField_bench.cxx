@@ -0,0 +1,312 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+#include "BFieldCache.h"
+#include "BFieldGenerator.h"
+#include "BFieldMap.h"
+#include "BFieldMapCache.h"
+#include "BFieldMapFile.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <unistd.h>
+#include <vector>
+
+// A map of 6 x 2 x 8 zones, queried at random points
+struct MapData
+{
+  static constexpr int npoints = 4096;
+  BFieldMap map;
+  double xyz[npoints][3];
+  double r[npoints];
+  double phi[npoints];
+  // consecutive points along 16 tracks, with 10 mm steps,
+  // as seen by a propagator
+  double track[npoints][3];
+  MapData()
+    : map(generateMap(6, 2, 8, 20, 10, 8))
+  {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> zdist(-12000, 12000);
+    std::uniform_real_distribution<double> rdist(4000, 10000);
+    std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+    for (int i = 0; i < npoints; ++i) {
+      r[i] = rdist(gen);
+      phi[i] = phidist(gen);
+      xyz[i][0] = r[i] * cos(phi[i]);
+      xyz[i][1] = r[i] * sin(phi[i]);
+      xyz[i][2] = zdist(gen);
+    }
+    const int ntracks = 16;
+    const int nsteps = npoints / ntracks;
+    for (int t = 0; t < ntracks; ++t) {
+      // slowly curving in phi, leaving the map in r before its end
+      const double phi0 = phidist(gen);
+      const double dz = (zdist(gen) / 12000) * 10.;
+      for (int i = 0; i < nsteps; ++i) {
+        const double s = 10. * i;
+        const double rt = 4100. + 0.5 * s;
+        const double phit = phi0 + 1e-5 * s;
+        double* p = track[t * nsteps + i];
+        p[0] = rt * cos(phit);
+        p[1] = rt * sin(phit);
+        p[2] = dz * i;
+      }
+    }
+  }
+  static const MapData& instance()
+  {
+    static const MapData data{};
+    return data;
+  }
+};
+
+// find the zone by trying each one in turn
+void
+findZoneScan(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      const BFieldZone* found = nullptr;
+      for (unsigned k = 0; k < data.map.nzones(); ++k) {
+        if (data.map.zone(k).inside(data.xyz[i][2], data.r[i], data.phi[i])) {
+          found = &data.map.zone(k);
+          break;
+        }
+      }
+      benchmark::DoNotOptimize(found);
+    }
+  }
+}
+
+BENCHMARK(findZoneScan);
+
+// find the zone through the map look-up table
+void
+findZoneLUT(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      const BFieldZone* found =
+        data.map.findZone(data.xyz[i][2], data.r[i], data.phi[i]);
+      benchmark::DoNotOptimize(found);
+    }
+  }
+}
+
+BENCHMARK(findZoneLUT);
+
+void
+mapGetB(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  double bxyz[3];
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      data.map.getB(data.xyz[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(mapGetB);
+
+// along tracks, looking up the zone and bin for each point
+void
+mapGetBTrack(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  double bxyz[3];
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      data.map.getB(data.track[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(mapGetBTrack);
+
+// along tracks, through a per-thread cache of the last bin.
+// With more than one thread, each owns its context and
+// shares the map.
+void
+mapCacheTrack(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  BFieldMapCache cache(&data.map, true);
+  double bxyz[3];
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      cache.getField(data.track[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+  state.counters["hitRatio"] = benchmark::Counter(
+    double(cache.hits()) / double(cache.hits() + cache.misses()),
+    benchmark::Counter::kAvgThreads);
+}
+
+BENCHMARK(mapCacheTrack)->ThreadRange(1, 4);
+
+// as mapCacheTrack, with thread 0 also changing the scale factor of the
+// map every 256 points, mid-track, and all the caches refilling after
+// each change
+void
+mapCacheTrackSwap(benchmark::State& state)
+{
+  static BFieldMap map = generateMap(6, 2, 8, 20, 10, 8);
+  const MapData& data = MapData::instance();
+  BFieldMapCache cache(&map, true);
+  double bxyz[3];
+  int nswaps = 0;
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      if (state.thread_index() == 0 && i % 256 == 128) {
+        map.setScale(++nswaps % 2 ? 1.01 : 1.);
+      }
+      cache.getField(data.track[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+  state.counters["hitRatio"] = benchmark::Counter(
+    double(cache.hits()) / double(cache.hits() + cache.misses()),
+    benchmark::Counter::kAvgThreads);
+}
+
+BENCHMARK(mapCacheTrackSwap)->ThreadRange(1, 4);
+
+// at random points, where the cache nearly always misses
+void
+mapCacheRandom(benchmark::State& state)
+{
+  const MapData& data = MapData::instance();
+  BFieldMapCache cache(&data.map);
+  double bxyz[3];
+  for (auto _ : state) {
+    for (int i = 0; i < MapData::npoints; ++i) {
+      cache.getField(data.xyz[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+}
+
+BENCHMARK(mapCacheRandom);
+
+// Startup: fill every zone of the map node by node and build the LUTs,
+// as done when the map is read from its original source
+void
+mapStartupAppend(benchmark::State& state)
+{
+  const BFieldMap& source = MapData::instance().map;
+  for (auto _ : state) {
+    BFieldMap map;
+    for (unsigned k = 0; k < source.nzones(); ++k) {
+      const BFieldZone& from = source.zone(k);
+      BFieldZone zone(from.id(),
+                      from.zmin(),
+                      from.zmax(),
+                      from.rmin(),
+                      from.rmax(),
+                      from.phimin(),
+                      from.phimax(),
+                      from.bscale());
+      zone.reserve(from.nmesh(0), from.nmesh(1), from.nmesh(2));
+      for (int j = 0; j < 3; ++j) {
+        for (unsigned i = 0; i < from.nmesh(j); ++i) {
+          zone.appendMesh(j, from.mesh(j, i));
+        }
+      }
+      for (unsigned i = 0; i < from.nfield(); ++i) {
+        zone.appendField(from.field(i));
+      }
+      zone.buildLUT();
+      map.appendZone(std::move(zone));
+    }
+    map.buildLUT();
+    benchmark::DoNotOptimize(map);
+  }
+}
+
+BENCHMARK(mapStartupAppend)->Unit(benchmark::kMicrosecond);
+
+// Startup: fill every zone in bulk, from one array per mesh axis and
+// per field component, and build the LUTs
+void
+mapStartupSet(benchmark::State& state)
+{
+  const BFieldMap& source = MapData::instance().map;
+  // the input arrays, as read from the original source
+  const unsigned nzones = source.nzones();
+  std::vector<std::vector<double>> mesh(3 * nzones);
+  std::vector<std::vector<short>> field(3 * nzones);
+  for (unsigned k = 0; k < nzones; ++k) {
+    const BFieldZone& from = source.zone(k);
+    for (int j = 0; j < 3; ++j) {
+      for (unsigned i = 0; i < from.nmesh(j); ++i) {
+        mesh[3 * k + j].push_back(from.mesh(j, i));
+      }
+      for (unsigned i = 0; i < from.nfield(); ++i) {
+        field[3 * k + j].push_back(from.field(i)[j]);
+      }
+    }
+  }
+  for (auto _ : state) {
+    BFieldMap map;
+    for (unsigned k = 0; k < nzones; ++k) {
+      const BFieldZone& from = source.zone(k);
+      BFieldZone zone(from.id(),
+                      from.zmin(),
+                      from.zmax(),
+                      from.rmin(),
+                      from.rmax(),
+                      from.phimin(),
+                      from.phimax(),
+                      from.bscale());
+      for (int j = 0; j < 3; ++j) {
+        zone.setMesh(j, mesh[3 * k + j].data(), mesh[3 * k + j].size());
+      }
+      zone.setField(field[3 * k].data(),
+                    field[3 * k + 1].data(),
+                    field[3 * k + 2].data(),
+                    from.nfield());
+      zone.buildLUT();
+      map.appendZone(std::move(zone));
+    }
+    map.buildLUT();
+    benchmark::DoNotOptimize(map);
+  }
+}
+
+BENCHMARK(mapStartupSet)->Unit(benchmark::kMicrosecond);
+
+// Startup: map the binary file of the same map
+void
+mapStartupFile(benchmark::State& state)
+{
+  char path[] = "/tmp/getField_bench_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    state.SkipWithError("cannot create the map file");
+    return;
+  }
+  close(fd);
+  if (!writeBFieldMap(MapData::instance().map, path)) {
+    unlink(path);
+    state.SkipWithError("cannot write the map file");
+    return;
+  }
+  for (auto _ : state) {
+    BFieldMap map;
+    mapBFieldMap(path, map);
+    benchmark::DoNotOptimize(map);
+  }
+  unlink(path);
+}
+
+BENCHMARK(mapStartupFile)->Unit(benchmark::kMicrosecond);
+
+// main
+BENCHMARK_MAIN();
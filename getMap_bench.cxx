@@ -0,0 +1,556 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// Benchmarks on a map of ATLAS toroid size, 64 zones of 100 x 40 x 40 nodes
+// (about 1 MB of field each, 61 MB in total), replaying the access
+// patterns of
+//  - helical tracks, stepped by 10 mm from the inner radius outwards
+//  - random points, uniform over the map
+//  - points alternating across zone boundaries
+//  - four helical tracks stepped in turn
+//  - a grid scan of a small region, in random order
+// on the full map, on the map reduced for fast simulation by
+// BFieldMap::reduced, and on its flat export (BFieldFlat.h).
+//
+// Each benchmark reports
+//  - perCall : time per field evaluation
+//  - hitRatio : fraction of calls served by the cache of the previous bin
+//  - bytesTouched : distinct bytes of the field array read by the pattern
+// and, when built with BFIELD_INSTRUMENT, the counters of BFieldStats
+// over all of them.
+//
+#include "BFieldCache.h"
+#include "BFieldFlatBuffers.h"
+#include "BFieldGenerator.h"
+#include "BFieldMap.h"
+#include "BFieldMultiCache.h"
+#include "BFieldStats.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+enum class Pattern
+{
+  helix,
+  random,
+  crossing,
+  interleaved,
+  scan
+};
+
+// the map, built once
+const BFieldMap&
+fullMap()
+{
+  static const BFieldMap map = generateMap(4, 2, 8, 100, 40, 40);
+  return map;
+}
+
+// the map reduced to within 1e-5 kT (0.5% of its 2 T) at its nodes
+const BFieldMap&
+reducedMap()
+{
+  static const BFieldMap map = fullMap().reduced(1e-5);
+  return map;
+}
+
+// a replayable sequence of points
+struct Points
+{
+  std::vector<double> xyz; // 3 per point
+  std::vector<double> r;
+  std::vector<double> phi;
+  double bytesTouched = 0;
+  size_t size() const { return r.size(); }
+  void add(double x, double y, double z)
+  {
+    xyz.insert(xyz.end(), { x, y, z });
+    r.push_back(std::sqrt(x * x + y * y));
+    phi.push_back(std::atan2(y, x));
+  }
+};
+
+constexpr size_t npoints = 1 << 16;
+
+// helices starting at the inner radius, with radius of curvature
+// between 5 and 50 m and |eta| < 2.5, followed until they leave the map
+void
+fillHelix(Points& points, std::mt19937& gen)
+{
+  std::uniform_real_distribution<double> udist(0, 1);
+  const double step = 10.;
+  while (points.size() < npoints) {
+    const double phi0 = 2 * M_PI * udist(gen);
+    const double eta = -2.5 + 5 * udist(gen);
+    const double cotTheta = std::sinh(eta);
+    const double charge = udist(gen) < 0.5 ? -1 : 1;
+    const double rho = (5000. + 45000. * udist(gen)) * charge;
+    // start on the inner cylinder, at r = 4000 mm, or on the end cap
+    double x = 4000.5 * std::cos(phi0);
+    double y = 4000.5 * std::sin(phi0);
+    double z = 4000.5 * cotTheta;
+    double dir = phi0;
+    while (points.size() < npoints) {
+      const double r = std::sqrt(x * x + y * y);
+      if (r > 10000. || std::fabs(z) > 12000. || r < 4000.) {
+        break;
+      }
+      points.add(x, y, z);
+      x += step * std::cos(dir);
+      y += step * std::sin(dir);
+      z += step * cotTheta;
+      dir += step / rho;
+    }
+  }
+}
+
+// uniform in z, r and phi over the map
+void
+fillRandom(Points& points, std::mt19937& gen)
+{
+  std::uniform_real_distribution<double> zdist(-12000, 12000);
+  std::uniform_real_distribution<double> rdist(4000, 10000);
+  std::uniform_real_distribution<double> phidist(-M_PI, M_PI);
+  while (points.size() < npoints) {
+    const double r = rdist(gen);
+    const double phi = phidist(gen);
+    points.add(r * std::cos(phi), r * std::sin(phi), zdist(gen));
+  }
+}
+
+// pairs of points 1 mm on either side of a random zone boundary in z
+// or phi, so that every call lands in a different zone than the last
+void
+fillCrossing(Points& points, std::mt19937& gen)
+{
+  std::uniform_real_distribution<double> udist(0, 1);
+  const double dz = 24000. / 4;
+  const double dphi = 2 * M_PI / 8;
+  while (points.size() < npoints) {
+    double z = -12000. + 24000. * udist(gen);
+    double phi = 2 * M_PI * udist(gen);
+    const double r = 4000. + 6000. * udist(gen);
+    const bool inz = udist(gen) < 0.5;
+    if (inz) {
+      z = -12000. + dz * (1 + int(udist(gen) * 3));
+    } else {
+      phi = dphi * (int(udist(gen) * 8) + 0.5);
+    }
+    for (int side = -1; side <= 1; side += 2) {
+      const double zs = inz ? z + side : z;
+      const double phis = inz ? phi : phi + side / r;
+      points.add(r * std::cos(phis), r * std::sin(phis), zs);
+    }
+  }
+}
+
+// the distinct bytes of the field arrays read for the 8 corners
+// of the bins the points fall in, counted in 64 byte lines
+double
+bytesTouched(const BFieldMap& map, const Points& points)
+{
+  std::unordered_set<const void*> lines;
+  for (size_t i = 0; i < points.size(); ++i) {
+    const double z = points.xyz[3 * i + 2];
+    double phi = points.phi[i];
+    const BFieldZone* zone = map.findZone(z, points.r[i], phi);
+    if (!zone) {
+      continue;
+    }
+    if (phi < zone->phimin()) {
+      phi += 2 * M_PI;
+    }
+    const BFieldZone::View& view = zone->view();
+    const double pos[3] = { z, points.r[i], phi };
+    int index[3];
+    for (int j = 0; j < 3; ++j) {
+      const double* mesh = view.mesh[j];
+      const double* end = mesh + view.nmesh[j];
+      index[j] = std::upper_bound(mesh + 1, end - 1, pos[j]) - mesh - 1;
+    }
+    const int im0 = index[0] * view.zoff + index[1] * view.roff + index[2];
+    const int offset[8] = { 0,
+                            view.roff,
+                            view.zoff,
+                            view.zoff + view.roff,
+                            1,
+                            view.roff + 1,
+                            view.zoff + 1,
+                            view.zoff + view.roff + 1 };
+    for (int k = 0; k < 8; ++k) {
+      const uintptr_t address =
+        reinterpret_cast<uintptr_t>(view.field + im0 + offset[k]);
+      lines.insert(reinterpret_cast<const void*>(address / 64 * 64));
+    }
+  }
+  return 64. * lines.size();
+}
+
+// the helix points split in four sequences of tracks, stepped in turn,
+// as by a propagator handling several tracks at once
+void
+fillInterleaved(Points& points, std::mt19937& gen)
+{
+  Points helix;
+  fillHelix(helix, gen);
+  const size_t quarter = helix.size() / 4;
+  for (size_t i = 0; i < quarter; ++i) {
+    for (size_t k = 0; k < 4; ++k) {
+      const double* xyz = &helix.xyz[3 * (k * quarter + i)];
+      points.add(xyz[0], xyz[1], xyz[2]);
+    }
+  }
+}
+
+// a 64 x 32 x 32 grid over 640 mm in z and r and 0.2 in phi, about
+// 70 points per bin, shuffled as in a validation scan
+void
+fillScan(Points& points, std::mt19937& gen)
+{
+  std::vector<size_t> order(npoints);
+  for (size_t i = 0; i < npoints; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), gen);
+  for (size_t i : order) {
+    const double z = 10. * (i / 1024);
+    const double r = 5000. + 20. * (i / 32 % 32);
+    const double phi = 0.1 + 0.00625 * (i % 32);
+    points.add(r * std::cos(phi), r * std::sin(phi), z);
+  }
+}
+
+const Points&
+points(Pattern pattern)
+{
+  static Points all[5];
+  Points& p = all[static_cast<int>(pattern)];
+  if (p.size() == 0) {
+    std::mt19937 gen(2020 + static_cast<int>(pattern));
+    switch (pattern) {
+      case Pattern::helix:
+        fillHelix(p, gen);
+        break;
+      case Pattern::random:
+        fillRandom(p, gen);
+        break;
+      case Pattern::crossing:
+        fillCrossing(p, gen);
+        break;
+      case Pattern::interleaved:
+        fillInterleaved(p, gen);
+        break;
+      case Pattern::scan:
+        fillScan(p, gen);
+        break;
+    }
+    p.bytesTouched = bytesTouched(fullMap(), p);
+  }
+  return p;
+}
+
+void
+setCounters(benchmark::State& state,
+            const Points& p,
+            double hits,
+            double calls)
+{
+  // seconds per call, shown with an n prefix
+  state.counters["perCall"] = benchmark::Counter(
+    p.size(),
+    benchmark::Counter::kIsIterationInvariantRate |
+      benchmark::Counter::kInvert);
+  state.counters["hitRatio"] = calls > 0 ? hits / calls : 0;
+  state.counters["bytesTouched"] = p.bytesTouched;
+}
+
+} // namespace
+
+// scalar path: the cache of the previous bin, refilled with getCache
+// and interpolated with getB
+void
+mapScalar(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  BFieldCache cache;
+  double bxyz[3];
+  double hits = 0;
+  double calls = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      const double* xyz = &p.xyz[3 * i];
+      const double r = p.r[i];
+      const double phi = p.phi[i];
+      if (cache.inside(xyz[2], r, phi)) {
+        ++hits;
+      } else {
+        const BFieldZone* zone = map.findZone(xyz[2], r, phi);
+        if (!zone) {
+          cache.invalidate();
+          continue;
+        }
+        zone->getCache(xyz[2], r, phi, cache, 1);
+      }
+      cache.getB(xyz, r, phi, bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+    calls += p.size();
+  }
+  setCounters(state, p, hits, calls);
+}
+
+// as mapScalar, with getCacheVec and getBVec
+void
+mapVec(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  BFieldCache cache;
+  double bxyz[3];
+  double hits = 0;
+  double calls = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      const double* xyz = &p.xyz[3 * i];
+      const double r = p.r[i];
+      const double phi = p.phi[i];
+      if (cache.inside(xyz[2], r, phi)) {
+        ++hits;
+      } else if (!map.getCache(xyz[2], r, phi, cache)) {
+        continue;
+      }
+      cache.getBVec(xyz, r, phi, bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+    calls += p.size();
+  }
+  setCounters(state, p, hits, calls);
+}
+
+// as mapVec, on the reduced map: bytesTouched is that of the reduced map
+void
+mapReduced(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = reducedMap();
+  const Points& p = points(pattern);
+  BFieldCache cache;
+  double bxyz[3];
+  double hits = 0;
+  double calls = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      const double* xyz = &p.xyz[3 * i];
+      const double r = p.r[i];
+      const double phi = p.phi[i];
+      if (cache.inside(xyz[2], r, phi)) {
+        ++hits;
+      } else if (!map.getCache(xyz[2], r, phi, cache)) {
+        continue;
+      }
+      cache.getBVec(xyz, r, phi, bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+    calls += p.size();
+  }
+  setCounters(state, p, hits, calls);
+  state.counters["bytesTouched"] = bytesTouched(map, p);
+}
+
+// as mapVec, also prefetching the bin of the next point, as a stepper
+// knowing its next step would, when that point is outside the cache
+void
+mapVecPrefetch(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  BFieldCache cache;
+  double bxyz[3];
+  double hits = 0;
+  double calls = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      const double* xyz = &p.xyz[3 * i];
+      const double r = p.r[i];
+      const double phi = p.phi[i];
+      if (cache.inside(xyz[2], r, phi)) {
+        ++hits;
+      } else if (!map.getCache(xyz[2], r, phi, cache)) {
+        continue;
+      }
+      const size_t next = i + 1 < p.size() ? i + 1 : 0;
+      const double znext = p.xyz[3 * next + 2];
+      if (!cache.inside(znext, p.r[next], p.phi[next])) {
+        map.prefetch(znext, p.r[next], p.phi[next]);
+      }
+      cache.getBVec(xyz, r, phi, bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+    calls += p.size();
+  }
+  setCounters(state, p, hits, calls);
+}
+
+// as mapVec, with the last N bins cached
+template<int N>
+void
+mapMultiCache(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  BFieldMultiCache<N> cache(&map, true);
+  double bxyz[3];
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      cache.getField(&p.xyz[3 * i], p.r[i], p.phi[i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+  setCounters(state, p, cache.hits(), cache.hits() + cache.misses());
+}
+
+void
+mapMultiCache2(benchmark::State& state, Pattern pattern)
+{
+  mapMultiCache<2>(state, pattern);
+}
+
+void
+mapMultiCache4(benchmark::State& state, Pattern pattern)
+{
+  mapMultiCache<4>(state, pattern);
+}
+
+void
+mapMultiCache8(benchmark::State& state, Pattern pattern)
+{
+  mapMultiCache<8>(state, pattern);
+}
+
+// the whole pattern as one batch, grouped by bin
+void
+mapBinned(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  std::vector<double> bxyz(3 * p.size());
+  for (auto _ : state) {
+    map.getBBinned(p.xyz.data(), p.size(), bxyz.data());
+    benchmark::DoNotOptimize(bxyz.data());
+  }
+  setCounters(state, p, 0, 0);
+}
+
+// the whole pattern as one batch, on state.range(0) threads
+void
+mapParallel(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  std::vector<double> bxyz(3 * p.size());
+  for (auto _ : state) {
+    map.getBParallel(p.xyz.data(), p.size(), bxyz.data(), state.range(0));
+    benchmark::DoNotOptimize(bxyz.data());
+  }
+  setCounters(state, p, 0, 0);
+}
+
+// no cache: every call locates the zone and bin and interpolates
+void
+mapFused(benchmark::State& state, Pattern pattern)
+{
+  const BFieldMap& map = fullMap();
+  const Points& p = points(pattern);
+  double bxyz[3];
+  for (auto _ : state) {
+    for (size_t i = 0; i < p.size(); ++i) {
+      map.getB(&p.xyz[3 * i], bxyz, nullptr);
+      benchmark::DoNotOptimize(bxyz);
+    }
+  }
+  setCounters(state, p, 0, 0);
+}
+
+// the flat export of the map, the whole pattern as one batch of the
+// host build of the device kernel
+void
+mapFlat(benchmark::State& state, Pattern pattern)
+{
+  static const BFieldFlatBuffers buffers(fullMap());
+  const BFieldFlatMap map = buffers.view();
+  const Points& p = points(pattern);
+  std::vector<double> bxyz(3 * p.size());
+  for (auto _ : state) {
+    bfieldFlatGetBBatch(map, p.xyz.data(), p.size(), bxyz.data());
+    benchmark::DoNotOptimize(bxyz.data());
+  }
+  setCounters(state, p, 0, 0);
+}
+
+BENCHMARK_CAPTURE(mapScalar, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapScalar, random, Pattern::random);
+BENCHMARK_CAPTURE(mapScalar, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapVec, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapVec, random, Pattern::random);
+BENCHMARK_CAPTURE(mapVec, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapVecPrefetch, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapVecPrefetch, random, Pattern::random);
+BENCHMARK_CAPTURE(mapVecPrefetch, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapVec, interleaved, Pattern::interleaved);
+BENCHMARK_CAPTURE(mapReduced, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapReduced, random, Pattern::random);
+BENCHMARK_CAPTURE(mapReduced, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapMultiCache2, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapMultiCache2, interleaved, Pattern::interleaved);
+BENCHMARK_CAPTURE(mapMultiCache2, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapMultiCache4, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapMultiCache4, interleaved, Pattern::interleaved);
+BENCHMARK_CAPTURE(mapMultiCache4, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapMultiCache8, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapMultiCache8, interleaved, Pattern::interleaved);
+BENCHMARK_CAPTURE(mapMultiCache8, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapVec, scan, Pattern::scan);
+BENCHMARK_CAPTURE(mapBinned, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapBinned, random, Pattern::random);
+BENCHMARK_CAPTURE(mapBinned, interleaved, Pattern::interleaved);
+BENCHMARK_CAPTURE(mapBinned, scan, Pattern::scan);
+BENCHMARK_CAPTURE(mapParallel, helix, Pattern::helix)
+  ->RangeMultiplier(2)
+  ->Range(1, 8)
+  ->UseRealTime();
+BENCHMARK_CAPTURE(mapParallel, random, Pattern::random)
+  ->RangeMultiplier(2)
+  ->Range(1, 8)
+  ->UseRealTime();
+BENCHMARK_CAPTURE(mapFused, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapFused, random, Pattern::random);
+BENCHMARK_CAPTURE(mapFused, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapFused, scan, Pattern::scan);
+BENCHMARK_CAPTURE(mapFlat, helix, Pattern::helix);
+BENCHMARK_CAPTURE(mapFlat, random, Pattern::random);
+BENCHMARK_CAPTURE(mapFlat, crossing, Pattern::crossing);
+BENCHMARK_CAPTURE(mapFlat, scan, Pattern::scan);
+
+// main, printing the merged counters if instrumented
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  if (BFieldStats::enabled()) {
+    BFieldStats::report().print(std::cout);
+  }
+  return 0;
+}
@@ -0,0 +1,367 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// Adaptive Runge-Kutta tracking through the map of getMap_bench, 64 zones
+// of 100 x 40 x 40 nodes, with the trilinear BFieldCache and with the
+// tricubic BFieldCacheCubic. The kinks of the trilinear field at the bin
+// edges spoil the step-doubling error estimate of RK4 there, and the
+// stepper shrinks its steps to cross them.
+//
+// Each benchmark propagates 64 tracks of 1 to 10 GeV from the inner
+// radius until they leave the map, to a tolerance of 10^-arg mm per step,
+// and reports per track
+//  - steps : accepted steps
+//  - rejected : rejected steps
+//  - fieldCalls : field evaluations, 11 per attempted step
+// and perCall, the time per field evaluation.
+//
+// The rknSteps benchmarks propagate the same tracks with fixed steps of
+// arg mm of a Runge-Kutta-Nystrom stepper, whose stage points are
+// predicted from the field at the start of the step, and compare
+// getField at each of the 4 stages with one
+// BFieldMapCache::getFieldStages per step. They report perStep, the
+// time per step.
+//
+#include "BFieldCache.h"
+#include "BFieldCacheCubic.h"
+#include "BFieldGenerator.h"
+#include "BFieldMap.h"
+#include "BFieldMapCache.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace {
+
+// the map, built once
+const BFieldMap&
+fullMap()
+{
+  static const BFieldMap map = generateMap(4, 2, 8, 100, 40, 40);
+  return map;
+}
+
+// the field with the trilinear cache of the previous bin
+struct TrilinearField
+{
+  BFieldMapCache cache{ &fullMap() };
+  void getField(const double* xyz, double* B) { cache.getField(xyz, B); }
+};
+
+// the field with the tricubic cache of the previous bin
+struct CubicField
+{
+  BFieldCacheCubic cache;
+  void getField(const double* xyz, double* B)
+  {
+    const double r = std::sqrt(xyz[0] * xyz[0] + xyz[1] * xyz[1]);
+    const double phi = std::atan2(xyz[1], xyz[0]);
+    if (!cache.inside(xyz[2], r, phi) &&
+        !fullMap().getCache(xyz[2], r, phi, cache)) {
+      std::fill(B, B + 3, 0.);
+      return;
+    }
+    cache.getB(xyz, r, phi, B);
+  }
+};
+
+// position (mm) and unit direction of a track, and its q/p (1/GeV)
+struct Track
+{
+  double y[6];
+  double qop;
+};
+
+std::vector<Track>
+makeTracks()
+{
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> udist(0, 1);
+  std::vector<Track> tracks(64);
+  for (Track& track : tracks) {
+    const double phi0 = 2 * M_PI * udist(gen);
+    const double eta = -1.5 + 3 * udist(gen);
+    const double theta = 2 * std::atan(std::exp(-eta));
+    const double r0 = 4000.5;
+    track.y[0] = r0 * std::cos(phi0);
+    track.y[1] = r0 * std::sin(phi0);
+    track.y[2] = r0 / std::tan(theta);
+    track.y[3] = std::sin(theta) * std::cos(phi0);
+    track.y[4] = std::sin(theta) * std::sin(phi0);
+    track.y[5] = std::cos(theta);
+    track.qop = (udist(gen) < 0.5 ? -1 : 1) / (1. + 9. * udist(gen));
+  }
+  return tracks;
+}
+
+// dy/ds of the state y: the direction, and the bending of the direction,
+// 0.299792458 (q/p) t x B per mm with B in kT and p in GeV
+inline void
+derivative(const double* y, const double* B, double qop, double* dy)
+{
+  const double k = 0.299792458 * qop;
+  dy[0] = y[3];
+  dy[1] = y[4];
+  dy[2] = y[5];
+  dy[3] = k * (y[4] * B[2] - y[5] * B[1]);
+  dy[4] = k * (y[5] * B[0] - y[3] * B[2]);
+  dy[5] = k * (y[3] * B[1] - y[4] * B[0]);
+}
+
+// one classical RK4 step of length h from y, given dy/ds at y (k1).
+// Returns the end state in out, calling the field 3 times.
+template<class Field>
+void
+rk4Step(Field& field,
+        const double* y,
+        const double* k1,
+        double qop,
+        double h,
+        double* out)
+{
+  double k2[6];
+  double k3[6];
+  double k4[6];
+  double tmp[6];
+  double B[3];
+  for (int i = 0; i < 6; ++i) {
+    tmp[i] = y[i] + 0.5 * h * k1[i];
+  }
+  field.getField(tmp, B);
+  derivative(tmp, B, qop, k2);
+  for (int i = 0; i < 6; ++i) {
+    tmp[i] = y[i] + 0.5 * h * k2[i];
+  }
+  field.getField(tmp, B);
+  derivative(tmp, B, qop, k3);
+  for (int i = 0; i < 6; ++i) {
+    tmp[i] = y[i] + h * k3[i];
+  }
+  field.getField(tmp, B);
+  derivative(tmp, B, qop, k4);
+  for (int i = 0; i < 6; ++i) {
+    out[i] = y[i] + h / 6. * (k1[i] + 2. * (k2[i] + k3[i]) + k4[i]);
+  }
+}
+
+struct StepCounts
+{
+  double steps = 0;
+  double rejected = 0;
+  double fieldCalls = 0;
+};
+
+// propagate the track until it leaves the map, with step doubling: a step
+// h is compared with two steps h/2, and accepted if their positions agree
+// to tolerance (mm), with directions weighted by h
+template<class Field>
+void
+propagate(Field& field,
+          const Track& track,
+          double tolerance,
+          StepCounts& counts)
+{
+  double y[6];
+  std::copy(track.y, track.y + 6, y);
+  double h = 100.;
+  double path = 0.;
+  while (path < 30000.) {
+    const double r = std::sqrt(y[0] * y[0] + y[1] * y[1]);
+    if (r < 4000. || r > 10000. || std::fabs(y[2]) > 12000.) {
+      break;
+    }
+    double B[3];
+    double k1[6];
+    field.getField(y, B);
+    derivative(y, B, track.qop, k1);
+    double full[6];
+    double half[6];
+    double kHalf[6];
+    double twoHalves[6];
+    rk4Step(field, y, k1, track.qop, h, full);
+    rk4Step(field, y, k1, track.qop, 0.5 * h, half);
+    field.getField(half, B);
+    derivative(half, B, track.qop, kHalf);
+    rk4Step(field, half, kHalf, track.qop, 0.5 * h, twoHalves);
+    counts.fieldCalls += 11;
+    double error = 0.;
+    for (int i = 0; i < 3; ++i) {
+      error = std::max(error, std::fabs(twoHalves[i] - full[i]));
+      error = std::max(error, h * std::fabs(twoHalves[i + 3] - full[i + 3]));
+    }
+    error /= 15.;
+    const double factor =
+      error > 0 ? std::clamp(0.9 * std::pow(tolerance / error, 0.2), 0.2, 4.)
+                : 4.;
+    if (error <= tolerance) {
+      std::copy(twoHalves, twoHalves + 6, y);
+      path += h;
+      counts.steps += 1;
+    } else {
+      counts.rejected += 1;
+    }
+    h = std::min(h * factor, 1000.);
+  }
+}
+
+template<class Field>
+void
+trackSteps(benchmark::State& state)
+{
+  fullMap();
+  const double tolerance = std::pow(10., -state.range(0));
+  const std::vector<Track> tracks = makeTracks();
+  StepCounts counts;
+  for (auto _ : state) {
+    counts = StepCounts();
+    Field field;
+    for (const Track& track : tracks) {
+      propagate(field, track, tolerance, counts);
+    }
+    benchmark::DoNotOptimize(counts);
+  }
+  const double ntracks = tracks.size();
+  state.counters["steps"] = counts.steps / ntracks;
+  state.counters["rejected"] = counts.rejected / ntracks;
+  state.counters["fieldCalls"] = counts.fieldCalls / ntracks;
+  // seconds per field evaluation, shown with an n prefix
+  state.counters["perCall"] =
+    benchmark::Counter(counts.fieldCalls,
+                       benchmark::Counter::kIsIterationInvariantRate |
+                         benchmark::Counter::kInvert);
+}
+
+// the stage fields of a step from getField at each of the 4 stages
+struct PerStageField
+{
+  BFieldMapCache cache{ &fullMap() };
+  void getStages(const double* y,
+                 double qop,
+                 double h,
+                 const double* Bstart,
+                 double* B)
+  {
+    const double k = 0.299792458 * qop;
+    const double* t = y + 3;
+    const double A[3] = { k * (t[1] * Bstart[2] - t[2] * Bstart[1]),
+                          k * (t[2] * Bstart[0] - t[0] * Bstart[2]),
+                          k * (t[0] * Bstart[1] - t[1] * Bstart[0]) };
+    cache.getField(y, B);
+    double mid[3];
+    double end[3];
+    for (int i = 0; i < 3; ++i) {
+      mid[i] = y[i] + 0.5 * h * t[i] + 0.125 * h * h * A[i];
+      end[i] = y[i] + h * t[i] + 0.5 * h * h * A[i];
+    }
+    cache.getField(mid, B + 3);
+    cache.getField(mid, B + 6);
+    cache.getField(end, B + 9);
+  }
+};
+
+// the stage fields of a step from one getFieldStages
+struct StagesField
+{
+  BFieldMapCache cache{ &fullMap() };
+  void getStages(const double* y,
+                 double qop,
+                 double h,
+                 const double* Bstart,
+                 double* B)
+  {
+    cache.getFieldStages(y, qop, h, Bstart, B);
+  }
+};
+
+// propagate the track in fixed steps h until it leaves the map. The
+// stage points are predicted with the field at the end of the previous
+// step.
+template<class Stages>
+void
+propagateFixed(Stages& stages, const Track& track, double h, double& nsteps)
+{
+  const double k = 0.299792458 * track.qop;
+  double y[6];
+  std::copy(track.y, track.y + 6, y);
+  double Bstart[3];
+  stages.cache.getField(y, Bstart);
+  for (double path = 0.; path < 30000.; path += h) {
+    const double r = std::sqrt(y[0] * y[0] + y[1] * y[1]);
+    if (r < 4000. || r > 10000. || std::fabs(y[2]) > 12000.) {
+      break;
+    }
+    double B[12];
+    stages.getStages(y, track.qop, h, Bstart, B);
+    // the bending k t x B at each stage, with the direction of the stage
+    double A[4][3];
+    double t[3] = { y[3], y[4], y[5] };
+    const double c[4] = { 0.5 * h, 0.5 * h, h, 0. };
+    for (int s = 0; s < 4; ++s) {
+      const double* Bs = B + 3 * s;
+      A[s][0] = k * (t[1] * Bs[2] - t[2] * Bs[1]);
+      A[s][1] = k * (t[2] * Bs[0] - t[0] * Bs[2]);
+      A[s][2] = k * (t[0] * Bs[1] - t[1] * Bs[0]);
+      for (int i = 0; i < 3; ++i) {
+        t[i] = y[i + 3] + c[s] * A[s][i];
+      }
+    }
+    for (int i = 0; i < 3; ++i) {
+      y[i] += h * y[i + 3] + h * h / 6. * (A[0][i] + A[1][i] + A[2][i]);
+      y[i + 3] += h / 6. * (A[0][i] + 2. * (A[1][i] + A[2][i]) + A[3][i]);
+    }
+    std::copy(B + 9, B + 12, Bstart);
+    nsteps += 1;
+  }
+}
+
+template<class Stages>
+void
+rknSteps(benchmark::State& state)
+{
+  fullMap();
+  const double h = state.range(0);
+  const std::vector<Track> tracks = makeTracks();
+  double nsteps = 0;
+  for (auto _ : state) {
+    nsteps = 0;
+    Stages stages;
+    for (const Track& track : tracks) {
+      propagateFixed(stages, track, h, nsteps);
+    }
+    benchmark::DoNotOptimize(nsteps);
+  }
+  state.counters["steps"] = nsteps / tracks.size();
+  // seconds per step, shown with an n prefix
+  state.counters["perStep"] =
+    benchmark::Counter(nsteps,
+                       benchmark::Counter::kIsIterationInvariantRate |
+                         benchmark::Counter::kInvert);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(trackSteps, TrilinearField)
+  ->Arg(4)
+  ->Arg(6)
+  ->Arg(8)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(trackSteps, CubicField)
+  ->Arg(4)
+  ->Arg(6)
+  ->Arg(8)
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(rknSteps, PerStageField)
+  ->Arg(10)
+  ->Arg(100)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(rknSteps, StagesField)
+  ->Arg(10)
+  ->Arg(100)
+  ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,86 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// Write a reduced field map, for fast simulation, in the binary format of
+// BFieldMapFile.h.
+//
+// usage: reduceBFieldMap output tolerance
+//                        [nzslice nrslice nsector nz nr nphi [binMajor]]
+//
+// The map is the synthetic one of writeBFieldMap, with the same sizes and
+// defaults. Its zones are reduced with BFieldMesh::reduce, dropping the mesh
+// planes the field varies linearly across to within tolerance (in kT, at
+// the bscale of each zone, before any scale factor of the map), and the
+// nodes and memSize() of the map are printed before and after.
+//
+#include "BFieldGenerator.h"
+#include "BFieldMapFile.h"
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+// number of field nodes of all the zones
+unsigned long
+nodes(const BFieldMap& map)
+{
+  unsigned long n = 0;
+  for (unsigned i = 0; i < map.nzones(); ++i) {
+    n += map.zone(i).nfield();
+  }
+  return n;
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  if (argc != 3 && argc != 9 && argc != 10) {
+    std::cerr << "usage: " << argv[0]
+              << " output tolerance"
+                 " [nzslice nrslice nsector nz nr nphi [binMajor]]"
+              << '\n';
+    return 1;
+  }
+  const double tolerance = std::atof(argv[2]);
+  if (!(tolerance >= 0)) {
+    std::cerr << "invalid tolerance " << argv[2] << '\n';
+    return 1;
+  }
+  int n[6] = { 6, 2, 8, 20, 10, 8 };
+  if (argc > 3) {
+    for (int i = 0; i < 6; ++i) {
+      n[i] = std::atoi(argv[i + 3]);
+      // at least one zone, of at least one bin
+      if (n[i] < (i < 3 ? 1 : 2)) {
+        std::cerr << "invalid size " << argv[i + 3] << '\n';
+        return 1;
+      }
+    }
+  }
+  const bool binMajor = argc == 10 && std::atoi(argv[9]) != 0;
+  const BFieldMap map = generateMap(n[0],
+                                    n[1],
+                                    n[2],
+                                    n[3],
+                                    n[4],
+                                    n[5],
+                                    12000.,
+                                    4000.,
+                                    10000.,
+                                    binMajor);
+  const BFieldMap reduced = map.reduced(tolerance);
+  std::cout << "nodes " << nodes(map) << " -> " << nodes(reduced)
+            << ", memSize " << map.memSize() << " -> " << reduced.memSize()
+            << " bytes (" << 100. * reduced.memSize() / map.memSize()
+            << "%)" << '\n';
+  if (!writeBFieldMap(reduced, argv[1])) {
+    std::cerr << "cannot write " << argv[1] << '\n';
+    return 1;
+  }
+  std::cout << "wrote " << reduced.nzones() << " zones to " << argv[1] << '\n';
+  return 0;
+}
@@ -82,6 +82,11 @@
  *                          indicates that the element number i-N
  *                          from the second input vector should be placed 
  *                          in the corresponding position in the result vector.
+ *  - @c CxxUtils::vconvert (VEC1& dst, const VEC2& src)
+ *                          converts each element of @c src to the
+ *                          element type of @c dst.
+ *                          dst[i] = static_cast<vec_type_t<VEC1>>(src[i])
+ *                          e.g widens shorts to doubles in registers.
  *
  * In terms of expected performance it might be  advantageous to
  * use vector types that fit the size of the ISA.
@@ -111,6 +116,14 @@
 #define HAVE_VECTOR_TERNARY_OPERATOR 0
 #endif
 
+// Do we have __builtin_convertvector.
+// GCC >=9 and clang
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 9))
+#define HAVE_CONVERT_VECTOR 1
+#else
+#define HAVE_CONVERT_VECTOR 0
+#endif
+
 namespace CxxUtils {
 
 /// Define a nice alias for a built-in vectorized type.
@@ -315,6 +328,29 @@ vblend(VEC& dst, const VEC& src1, const VEC& src2)
 #endif
 }
 
+/*
+ * @brief vconvert function.
+ * converts the elements of src to the element type of dst.
+ * dst[i] = static_cast<vec_type_t<VEC1>>(src[i])
+ * VEC1 and VEC2 must have the same number of elements.
+ */
+template<typename VEC1, typename VEC2>
+inline void
+vconvert(VEC1& dst, const VEC2& src)
+{
+  static_assert((vec_size<VEC1>() == vec_size<VEC2>()),
+                "vconvert dst and src have different number of elements");
+#if HAVE_CONVERT_VECTOR
+  dst = __builtin_convertvector(src, VEC1);
+#else
+  typedef vec_type_t<VEC1> ELT;
+  constexpr size_t N = vec_size<VEC1>();
+  for (size_t i = 0; i < N; ++i) {
+    dst[i] = static_cast<ELT>(src[i]);
+  }
+#endif
+}
+
 } // namespace CxxUtils
 
 #endif // not CXXUTILS_VEC_H
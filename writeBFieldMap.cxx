@@ -0,0 +1,55 @@
+/*
+  Copyright (C) 2002-2020 CERN for the benefit of the ATLAS collaboration
+*/
+
+//
+// Write a field map in the binary format of BFieldMapFile.h.
+//
+// usage: writeBFieldMap output [nzslice nrslice nsector nz nr nphi [binMajor]]
+//
+// The map is the synthetic one of BFieldGenerator.h, with nzslice x nrslice
+// x nsector zones of nz x nr x nphi nodes (default 6 2 8 20 10 8).
+//
+#include "BFieldGenerator.h"
+#include "BFieldMapFile.h"
+#include <cstdlib>
+#include <iostream>
+
+int
+main(int argc, char** argv)
+{
+  if (argc != 2 && argc != 8 && argc != 9) {
+    std::cerr << "usage: " << argv[0]
+              << " output [nzslice nrslice nsector nz nr nphi [binMajor]]"
+              << '\n';
+    return 1;
+  }
+  int n[6] = { 6, 2, 8, 20, 10, 8 };
+  if (argc > 2) {
+    for (int i = 0; i < 6; ++i) {
+      n[i] = std::atoi(argv[i + 2]);
+      // at least one zone, of at least one bin
+      if (n[i] < (i < 3 ? 1 : 2)) {
+        std::cerr << "invalid size " << argv[i + 2] << '\n';
+        return 1;
+      }
+    }
+  }
+  const bool binMajor = argc == 9 && std::atoi(argv[8]) != 0;
+  const BFieldMap map = generateMap(n[0],
+                                    n[1],
+                                    n[2],
+                                    n[3],
+                                    n[4],
+                                    n[5],
+                                    12000.,
+                                    4000.,
+                                    10000.,
+                                    binMajor);
+  if (!writeBFieldMap(map, argv[1])) {
+    std::cerr << "cannot write " << argv[1] << '\n';
+    return 1;
+  }
+  std::cout << "wrote " << map.nzones() << " zones to " << argv[1] << '\n';
+  return 0;
+}